@@ -0,0 +1,116 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// alsa sequencer throughput on a synthetic flood, a drain after every
+// event as the former output thread did, against one drain per batch
+// of up to 256 events (the size of the output queue) as XAlsa does now.
+// A second client receive and count the events. Need /dev/snd/seq.
+
+#include <atomic>
+#include <cerrno>
+#include <thread>
+#include <unistd.h>
+
+#include <alsa/asoundlib.h>
+
+#include "BenchUtil.h"
+
+static const int events = 200000;
+static const int batch = 256;
+
+typedef struct {
+    snd_seq_t *seq;
+    int port;
+} Client;
+
+static bool open_client(Client *c, const char *name, unsigned int caps) {
+    if (snd_seq_open(&c->seq, "default", SND_SEQ_OPEN_DUPLEX, 0) < 0) return false;
+    snd_seq_set_client_name(c->seq, name);
+    c->port = snd_seq_create_simple_port(c->seq, name, caps, SND_SEQ_PORT_TYPE_APPLICATION);
+    return c->port >= 0;
+}
+
+// send the flood, drain after every event or once per batch,
+// return events per second as seen by the receiver
+static double flood(bool drain_per_event) {
+    Client out;
+    Client in;
+    if (!open_client(&out, "mamba-flood-out", SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ) ||
+        !open_client(&in, "mamba-flood-in", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE)) {
+        fprintf(stderr, "can't open the alsa sequencer\n");
+        exit(1);
+    }
+    snd_seq_connect_to(out.seq, out.port, snd_seq_client_id(in.seq), in.port);
+
+    // the receiver poll, so events lost to a full input pool can't hang it,
+    // it give up one second after the sender finished
+    std::atomic<int> received(0);
+    std::atomic<int> overruns(0);
+    std::atomic<uint64_t> sent_at(0);
+    uint64_t last = 0;
+    snd_seq_nonblock(in.seq, 1);
+    std::thread receiver([&] () {
+        snd_seq_event_t *ev = nullptr;
+        while (received.load(std::memory_order_relaxed) < events) {
+            const int err = snd_seq_event_input(in.seq, &ev);
+            if (err >= 0) {
+                received.fetch_add(1, std::memory_order_relaxed);
+                last = benchutil::now_ns();
+            } else if (err == -ENOSPC) {
+                overruns.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                const uint64_t t = sent_at.load(std::memory_order_acquire);
+                if (t && benchutil::now_ns() - t > 1000000000ULL) break;
+                usleep(100);
+            }
+        }
+    });
+
+    snd_seq_event_t ev;
+    const uint64_t start = benchutil::now_ns();
+    for (int i = 0; i < events; i++) {
+        snd_seq_ev_clear(&ev);
+        snd_seq_ev_set_source(&ev, out.port);
+        snd_seq_ev_set_subs(&ev);
+        snd_seq_ev_set_direct(&ev);
+        if (i & 1) snd_seq_ev_set_noteoff(&ev, i & 15, 36 + (i >> 1) % 48, 0);
+        else snd_seq_ev_set_noteon(&ev, i & 15, 36 + (i >> 1) % 48, 100);
+        snd_seq_event_output(out.seq, &ev);
+        if (drain_per_event || (i % batch) == batch - 1) snd_seq_drain_output(out.seq);
+    }
+    snd_seq_drain_output(out.seq);
+    sent_at.store(benchutil::now_ns(), std::memory_order_release);
+    receiver.join();
+    const double seconds = (last - start) / 1e9;
+    snd_seq_close(out.seq);
+    snd_seq_close(in.seq);
+    if (received.load() < events)
+        fprintf(stderr, "%d events lost, %d input overruns\n", events - received.load(), overruns.load());
+    return received.load() / seconds;
+}
+
+int main() {
+    const double per_event = flood(true);
+    const double per_batch = flood(false);
+    fprintf(stdout, "%d events\n", events);
+    fprintf(stdout, "%-28s %10.0f events/s\n", "drain per event", per_event);
+    fprintf(stdout, "%-28s %10.0f events/s\n", "drain per batch", per_batch);
+    return 0;
+}
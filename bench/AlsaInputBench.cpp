@@ -0,0 +1,147 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// throughput and cpu cost of the XAlsa input thread. A forked client
+// flood the XAlsa input port with note on/off at 10k events/s, 10 events
+// per millisecond. XAlsa push them with their receive stamp into a
+// MidiQueue, the main thread drain it once per millisecond as the jack
+// process callback would. The sender run in its own process, so the
+// cpu time of this one (getrusage) is the input thread, plus the drain.
+// Need /dev/snd/seq.
+
+#include <atomic>
+#include <csignal>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "BenchUtil.h"
+#include "XAlsa.h"
+
+static const int rate = 10000;
+static const int seconds = 3;
+static const int events = rate * seconds;
+static const int per_ms = rate / 1000;
+
+// process cpu time, user and system, in nanoseconds
+static uint64_t cpu_ns() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t(ru.ru_utime.tv_sec) + uint64_t(ru.ru_stime.tv_sec)) * 1000000000ULL +
+           (uint64_t(ru.ru_utime.tv_usec) + uint64_t(ru.ru_stime.tv_usec)) * 1000ULL;
+}
+
+// the sender, hand over its address and wait for the go before flooding
+static int sender(int to_parent, int from_parent) {
+    snd_seq_t *seq;
+    if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0) return 1;
+    snd_seq_set_client_name(seq, "mamba-input-flood");
+    const int port = snd_seq_create_simple_port(seq, "out",
+        SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, SND_SEQ_PORT_TYPE_APPLICATION);
+    const int addr[2] = {snd_seq_client_id(seq), port};
+    if (port < 0 || write(to_parent, addr, sizeof(addr)) != sizeof(addr)) return 1;
+    char go;
+    if (read(from_parent, &go, 1) != 1) return 1;
+
+    snd_seq_event_t ev;
+    timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int i = 0; i < events;) {
+        for (int n = 0; n < per_ms; n++, i++) {
+            snd_seq_ev_clear(&ev);
+            snd_seq_ev_set_source(&ev, port);
+            snd_seq_ev_set_subs(&ev);
+            snd_seq_ev_set_direct(&ev);
+            if (i & 1) snd_seq_ev_set_noteoff(&ev, 0, 36 + (i >> 1) % 48, 0);
+            else snd_seq_ev_set_noteon(&ev, 0, 36 + (i >> 1) % 48, 100);
+            snd_seq_event_output(seq, &ev);
+        }
+        snd_seq_drain_output(seq);
+        next.tv_nsec += 1000000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    snd_seq_close(seq);
+    return 0;
+}
+
+int main() {
+    int up[2];
+    int down[2];
+    if (pipe(up) || pipe(down)) return 1;
+    // fork before any thread exist
+    const pid_t pid = fork();
+    if (pid < 0) return 1;
+    if (pid == 0) _exit(sender(up[1], down[0]));
+    close(up[1]);
+    close(down[0]);
+
+    midiqueue::MidiQueue<256> queue;
+    xalsa::XAlsa xalsa(
+        [&queue] (const uint8_t* m, uint8_t n, uint32_t time) noexcept {queue.push(m, n, time);},
+        [] (const uint8_t*, uint8_t) noexcept {});
+    xalsa.frame_time = [] () noexcept -> uint32_t {return uint32_t(benchutil::now_ns() / 1000);};
+    int addr[2];
+    if (xalsa.xalsa_init("mamba-alsainputbench", "input", "output") < 0 ||
+            read(up[0], addr, sizeof(addr)) != sizeof(addr)) {
+        fprintf(stderr, "can't open the alsa sequencer\n");
+        kill(pid, SIGTERM);
+        return 1;
+    }
+    xalsa.xalsa_start([] (int, int, bool) {});
+    xalsa.xalsa_connect(addr[0], addr[1]);
+
+    const uint64_t cpu_start = cpu_ns();
+    const uint64_t start = benchutil::now_ns();
+    uint64_t first = 0;
+    uint64_t last = 0;
+    int received = 0;
+    if (write(down[1], "g", 1) != 1) return 1;
+    // drain once per millisecond, give up one second after the sender finished
+    midiqueue::MidiQueue<256>::Event ev;
+    uint64_t done = 0;
+    while (received < events) {
+        usleep(1000);
+        const uint64_t now = benchutil::now_ns();
+        while (queue.pop(&ev)) {
+            if (!first) first = now;
+            last = now;
+            received++;
+        }
+        if (!done && waitpid(pid, NULL, WNOHANG) == pid) done = now;
+        if (done && now - done > 1000000000ULL) break;
+        if (now - start > uint64_t(seconds + 10) * 1000000000ULL) break;
+    }
+    const uint64_t cpu = cpu_ns() - cpu_start;
+    xalsa.xalsa_stop();
+    if (!done) waitpid(pid, NULL, 0);
+
+    const double span = last > first ? (last - first) / 1e9 : 0.0;
+    fprintf(stdout, "%d events sent at %d events/s\n", events, rate);
+    fprintf(stdout, "%-28s %10d\n", "delivered", received);
+    fprintf(stdout, "%-28s %10.0f events/s\n", "throughput", span > 0.0 ? received / span : 0.0);
+    fprintf(stdout, "%-28s %10.2f us\n", "cpu per event", received ? cpu / 1000.0 / received : 0.0);
+    if (received < events)
+        fprintf(stderr, "%d events lost, %u queue overflows\n", events - received, queue.get_overflows());
+    return 0;
+}
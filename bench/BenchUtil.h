@@ -0,0 +1,90 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+
+#pragma once
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+namespace benchutil {
+
+// monotonic time in nanoseconds
+inline uint64_t now_ns() noexcept {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+// keep the optimizer from dropping a result
+template <typename T>
+inline void keep(T const& value) noexcept {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+
+/****************************************************************
+ ** class Samples
+ **
+ ** collect timings in nanoseconds and print min/mean/percentiles/max
+ ** in microseconds
+ */
+
+class Samples {
+private:
+    std::vector<uint64_t> values;
+
+public:
+    void reserve(size_t n) { values.reserve(n); }
+    void clear() noexcept { values.clear(); }
+    inline void add(uint64_t ns) { values.push_back(ns); }
+    size_t size() const noexcept { return values.size(); }
+
+    double mean_us() const noexcept {
+        if (values.empty()) return 0.0;
+        double sum = 0.0;
+        for (auto v : values) sum += double(v);
+        return sum / values.size() / 1000.0;
+    }
+
+    // p in [0, 1]
+    double percentile_us(double p) const {
+        if (values.empty()) return 0.0;
+        std::vector<uint64_t> sorted(values);
+        std::sort(sorted.begin(), sorted.end());
+        size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+        return sorted[i] / 1000.0;
+    }
+
+    void print(const char* label) const {
+        fprintf(stdout, "%-28s n %7zu  min %9.2f  mean %9.2f  p99 %9.2f  max %9.2f us\n",
+            label, values.size(), percentile_us(0.0), mean_us(),
+            percentile_us(0.99), percentile_us(1.0));
+    }
+};
+
+} // namespace benchutil
+
+#endif //BENCHUTIL_H
@@ -0,0 +1,140 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// memory and time scans of the EventStore against the former
+// std::vector<MidiEvent> on 1M events, or on the events of the
+// midi file given as argument:
+//   ./build/eventstorebench [file.mid]
+
+#include <random>
+
+#include "BenchUtil.h"
+#include "Mamba.h"
+
+// the former loop event, 32 bytes
+typedef struct {
+    unsigned char buffer[3];
+    int num;
+    double deltaTime;
+    double absoluteTime;
+} OldMidiEvent;
+
+static const size_t events = 1000000;
+static const int repeats = 20;
+static const int lookups = 200;
+
+int main(int argc, char **argv) {
+    mamba::EventStore store;
+    if (argc > 1) {
+        mamba::EventStore play[16];
+        int song_bpm = 120;
+        mamba::MidiLoad load;
+        if (!load.load_from_file(play, &song_bpm, argv[1])) {
+            fprintf(stderr, "can't load %s\n", argv[1]);
+            return 1;
+        }
+        for (int i = 0; i < 16; i++) {
+            for (size_t j = 0; j < play[i].size(); j++) store.push_back(play[i].get(j));
+        }
+        store.sort();
+    } else {
+        // a dense GM arrangement, a event every 2 ticks on average
+        std::mt19937 rng(1);
+        uint32_t t = 0;
+        store.reserve(events);
+        for (size_t i = 0; i < events; i++) {
+            t += rng() % 5;
+            const mamba::MidiEvent ev = {{uint8_t(0x90 | (i & 15)), uint8_t(rng() % 128),
+                                                    uint8_t(rng() % 128)}, 3, t};
+            store.push_back(ev);
+        }
+    }
+    const size_t n = store.size();
+    if (!n) return 1;
+
+    std::vector<OldMidiEvent> old;
+    old.reserve(n);
+    double last = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        const mamba::MidiEvent ev = store.get(i);
+        const OldMidiEvent oev = {{ev.buffer[0], ev.buffer[1], ev.buffer[2]}, ev.num,
+                                    ev.absoluteTime - last, double(ev.absoluteTime)};
+        last = ev.absoluteTime;
+        old.push_back(oev);
+    }
+
+    fprintf(stdout, "%zu events\n", n);
+    fprintf(stdout, "%-28s %8.2f MB (%zu bytes per event)\n", "std::vector<MidiEvent>",
+        old.capacity() * sizeof(OldMidiEvent) / 1048576.0, sizeof(OldMidiEvent));
+    fprintf(stdout, "%-28s %8.2f MB (%.1f bytes per event)\n\n", "EventStore",
+        store.memory_usage() / 1048576.0, double(store.memory_usage()) / n);
+
+    // count the events in a window, the way the scheduler walk a loop
+    const uint32_t end = store.back_time();
+    const uint32_t lo = end / 4;
+    const uint32_t hi = end - end / 4;
+    benchutil::Samples s;
+    for (int r = 0; r < repeats; r++) {
+        const uint64_t start = benchutil::now_ns();
+        size_t count = 0;
+        for (const OldMidiEvent& ev : old) count += ev.absoluteTime >= lo && ev.absoluteTime < hi;
+        s.add(benchutil::now_ns() - start);
+        benchutil::keep(count);
+    }
+    s.print("time scan, vector");
+    s.clear();
+    for (int r = 0; r < repeats; r++) {
+        const uint64_t start = benchutil::now_ns();
+        size_t count = 0;
+        for (size_t i = 0; i < n; i++) {
+            const uint32_t t = store.get_time(i);
+            count += t >= lo && t < hi;
+        }
+        s.add(benchutil::now_ns() - start);
+        benchutil::keep(count);
+    }
+    s.print("time scan, EventStore");
+
+    // find_pos_for_playtime, former linear search against find_time()
+    std::mt19937 rng(2);
+    std::vector<uint32_t> targets(lookups);
+    for (auto& t : targets) t = rng() % (end + 1);
+    s.clear();
+    for (uint32_t target : targets) {
+        const uint64_t start = benchutil::now_ns();
+        size_t pos = 0;
+        for (const OldMidiEvent& ev : old) {
+            if (ev.absoluteTime >= target) break;
+            pos++;
+        }
+        s.add(benchutil::now_ns() - start);
+        benchutil::keep(pos);
+    }
+    s.print("find play pos, vector");
+    s.clear();
+    for (uint32_t target : targets) {
+        const uint64_t start = benchutil::now_ns();
+        size_t pos = store.find_time(target);
+        s.add(benchutil::now_ns() - start);
+        benchutil::keep(pos);
+    }
+    s.print("find play pos, EventStore");
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// latency and jitter of events a non realtime thread (the GUI, alsa, the
+// mapper) send through the MidiMessenger to the XJack output, with the
+// enqueue frame stamp and without it (the former placement at the start
+// of the next period). A second client record the output. Need a running
+// jack server, run it once per period size:
+//   jackd -d dummy -r 48000 -p 256 &    (and -p 1024)
+//   ./build/jittertest
+
+#include <random>
+#include <unistd.h>
+
+#include "XJack.h"
+
+static const unsigned int events = 1000;
+
+static jack_nframes_t enqueued[events];
+static jack_nframes_t played[events];
+static std::atomic<unsigned int> played_count(0);
+static jack_port_t *rec_port = nullptr;
+
+// every event carry its index in the controller number and value
+static int rec_process(jack_nframes_t nframes, void *arg) {
+    jack_client_t *client = (jack_client_t*)arg;
+    void *buf = jack_port_get_buffer(rec_port, nframes);
+    const jack_nframes_t cycle_start = jack_last_frame_time(client);
+    jack_midi_event_t in_event;
+    unsigned int n = played_count.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < jack_midi_get_event_count(buf); i++) {
+        jack_midi_event_get(&in_event, buf, i);
+        if (in_event.size != 3 || (in_event.buffer[0] & 0xf0) != 0xB0) continue;
+        const unsigned int index = (in_event.buffer[2] << 7) | in_event.buffer[1];
+        if (index >= events) continue;
+        played[index] = cycle_start + in_event.time;
+        n++;
+    }
+    played_count.store(n, std::memory_order_release);
+    return 0;
+}
+
+static void run(xjack::XJack& xjack, mamba::MidiMessenger& mmessage, bool stamped) {
+    mmessage.frame_time = nullptr;
+    if (stamped) mmessage.frame_time = [&xjack] () noexcept -> uint32_t
+                                        { return jack_frame_time(xjack.client); };
+    played_count.store(0, std::memory_order_release);
+    // send at random moments, so the events fall anywhere in the period
+    std::mt19937 rng(1);
+    for (unsigned int i = 0; i < events; i++) {
+        usleep(500 + rng() % 2500);
+        enqueued[i] = jack_frame_time(xjack.client);
+        mmessage.send_midi_cc(0xB0, i & 0x7f, (i >> 7) & 0x7f, 3, true);
+    }
+    for (int i = 0; i < 100 && played_count.load(std::memory_order_acquire) < events; i++)
+        usleep(10000);
+
+    const jack_nframes_t period = jack_get_buffer_size(xjack.client);
+    const double us_per_frame = 1e6 / jack_get_sample_rate(xjack.client);
+    int32_t lo = INT32_MAX;
+    int32_t hi = INT32_MIN;
+    double sum = 0.0;
+    for (unsigned int i = 0; i < events; i++) {
+        const int32_t latency = int32_t(played[i] - enqueued[i]);
+        if (latency < lo) lo = latency;
+        if (latency > hi) hi = latency;
+        sum += latency;
+    }
+    fprintf(stdout, "%-10s period %4u  latency min %5d  mean %7.1f  max %5d frames"
+        "  jitter %5d frames (%.0f us)\n", stamped ? "stamped" : "unstamped", period,
+        lo, sum / events, hi, hi - lo, (hi - lo) * us_per_frame);
+    if (played_count.load(std::memory_order_acquire) < events)
+        fprintf(stderr, "only %u of %u events recorded\n", played_count.load(), events);
+}
+
+int main() {
+    mamba::MidiMessenger mmessage;
+    velocitycurve::VelocityCurves vcurves;
+    xjack::XJack xjack(&mmessage,
+        [] (const uint8_t*, uint8_t, uint32_t) {},
+        [] (int) {},
+        [] () -> const midimapper::KbmTable* { return nullptr; },
+        [] (int) {},
+        [] () -> const miditransform::TransformTable* { return nullptr; },
+        [&vcurves] () noexcept { return vcurves.rt_acquire(); },
+        [] () {});
+    xjack.client_name = "mamba-jittertest";
+    if (!xjack.init_jack()) return 1;
+
+    jack_client_t *rec_client = jack_client_open("mamba-jitterrec", JackNullOption, NULL);
+    if (!rec_client) {
+        fprintf(stderr, "can't open the recording client\n");
+        return 1;
+    }
+    rec_port = jack_port_register(rec_client, "in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+    jack_set_process_callback(rec_client, rec_process, rec_client);
+    if (jack_activate(rec_client) ||
+            jack_connect(rec_client, jack_port_name(xjack.out_port), jack_port_name(rec_port))) {
+        fprintf(stderr, "can't connect the recording client\n");
+        return 1;
+    }
+
+    run(xjack, mmessage, false);
+    run(xjack, mmessage, true);
+    mmessage.frame_time = nullptr;
+    jack_client_close(rec_client);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// frames per second of the keyboard expose on a cairo image surface:
+// a full rasterization of the keyboard (the cache dropped every frame,
+// what every expose cost before), a single key change with the cached
+// keyboard and key sprites, and a expose without change. xputty need a
+// X display for its setup, the window is never mapped, Xvfb will do:
+//   xvfb-run ./build/keyboarddrawbench
+
+#include "BenchUtil.h"
+#include "xmkeyboard.h"
+
+static const int width = 1400;
+static const int height = 160;
+static const double seconds = 1.0;
+
+// draw frames until the time is up, call change before each frame
+template <typename Change>
+static double fps(Widget_t *w, Change change) {
+    const uint64_t start = benchutil::now_ns();
+    const uint64_t end = start + uint64_t(seconds * 1e9);
+    uint64_t now = start;
+    int frames = 0;
+    while (now < end) {
+        change(frames);
+        w->func.expose_callback(w, NULL);
+        frames++;
+        now = benchutil::now_ns();
+    }
+    cairo_surface_flush(cairo_get_target(w->crb));
+    return frames / ((now - start) / 1e9);
+}
+
+int main() {
+    Xputty app;
+    main_init(&app);
+    Widget_t *w = create_window(&app, DefaultRootWindow(app.dpy), 0, 0, width, height);
+    mamba_add_keyboard(w, "");
+    MambaKeyboard *keys = (MambaKeyboard*)w->parent_struct;
+
+    // draw to a image surface instead of the window buffer
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    cairo_t *crb = w->crb;
+    w->crb = cairo_create(surface);
+    w->width = width;
+    w->height = height;
+
+    // a chord held on another channel, so there are keys to composite
+    mamba_set_key_in_matrix(&keys->in_key_matrix[1], 48, true);
+    mamba_set_key_in_matrix(&keys->in_key_matrix[1], 52, true);
+    mamba_set_key_in_matrix(&keys->in_key_matrix[1], 55, true);
+
+    const double full = fps(w, [keys] (int frame) {
+        keys->drawn_layout[0] = -1;
+        mamba_set_key_in_matrix(&keys->in_key_matrix[0], 60 + frame % 12, !(frame & 1));
+    });
+    const double change = fps(w, [keys] (int frame) {
+        mamba_set_key_in_matrix(&keys->in_key_matrix[0], 60 + frame % 12, !(frame & 1));
+    });
+    const double idle = fps(w, [] (int) {});
+
+    fprintf(stdout, "keyboard %dx%d\n", width, height);
+    fprintf(stdout, "%-28s %10.0f fps\n", "full redraw", full);
+    fprintf(stdout, "%-28s %10.0f fps\n", "one key, cached", change);
+    fprintf(stdout, "%-28s %10.0f fps\n", "expose, cached", idle);
+
+    cairo_destroy(w->crb);
+    w->crb = crb;
+    cairo_surface_destroy(surface);
+    main_quit(&app);
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// play a known loop through XJack and record the jack output with a second
+// client, every event must land on the frame given by the TimeBase, chords
+// on the same frame, for several loop passes. Need a running jack server,
+// the dummy backend will do:
+//   jackd -d dummy -r 48000 -p 256 &
+//   ./build/looptimingtest
+
+#include <cstdlib>
+#include <map>
+#include <vector>
+#include <unistd.h>
+
+#include "XJack.h"
+
+static const int passes = 3;
+static const uint32_t loop_ticks = 4 * mamba::TimeBase::ppqn;
+
+typedef struct {
+    jack_nframes_t frame;
+    uint8_t data[3];
+} Recorded;
+
+static const unsigned int max_recorded = 4096;
+static Recorded recorded[max_recorded];
+static std::atomic<unsigned int> recorded_count(0);
+static jack_port_t *rec_port = nullptr;
+
+static int rec_process(jack_nframes_t nframes, void *arg) {
+    jack_client_t *client = (jack_client_t*)arg;
+    void *buf = jack_port_get_buffer(rec_port, nframes);
+    const jack_nframes_t cycle_start = jack_last_frame_time(client);
+    unsigned int n = recorded_count.load(std::memory_order_relaxed);
+    jack_midi_event_t in_event;
+    for (uint32_t i = 0; i < jack_midi_get_event_count(buf); i++) {
+        if (n >= max_recorded) break;
+        jack_midi_event_get(&in_event, buf, i);
+        recorded[n].frame = cycle_start + in_event.time;
+        memset(recorded[n].data, 0, 3);
+        memcpy(recorded[n].data, in_event.buffer, in_event.size < 3 ? in_event.size : 3);
+        n++;
+    }
+    recorded_count.store(n, std::memory_order_release);
+    return 0;
+}
+
+static void add(mamba::EventStore& loop, uint8_t status, uint8_t key, uint8_t vel, uint32_t time) {
+    const mamba::MidiEvent ev = {{status, key, vel}, 3, time};
+    loop.push_back(ev);
+}
+
+static int key(const uint8_t *data) {
+    return (data[0] << 16) | (data[1] << 8) | data[2];
+}
+
+int main() {
+    mamba::MidiMessenger mmessage;
+    velocitycurve::VelocityCurves vcurves;
+    xjack::XJack xjack(&mmessage,
+        [] (const uint8_t*, uint8_t, uint32_t) {},
+        [] (int) {},
+        [] () -> const midimapper::KbmTable* { return nullptr; },
+        [] (int) {},
+        [] () -> const miditransform::TransformTable* { return nullptr; },
+        [&vcurves] () noexcept { return vcurves.rt_acquire(); },
+        [] () {});
+    xjack.client_name = "mamba-looptest";
+    if (!xjack.init_jack()) return 1;
+
+    jack_client_t *rec_client = jack_client_open("mamba-looprec", JackNullOption, NULL);
+    if (!rec_client) {
+        fprintf(stderr, "can't open the recording client\n");
+        return 1;
+    }
+    rec_port = jack_port_register(rec_client, "in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+    jack_set_process_callback(rec_client, rec_process, rec_client);
+    if (jack_activate(rec_client) ||
+            jack_connect(rec_client, jack_port_name(xjack.out_port), jack_port_name(rec_port))) {
+        fprintf(stderr, "can't connect the recording client\n");
+        return 1;
+    }
+
+    const jack_nframes_t period = jack_get_buffer_size(xjack.client);
+    xjack.timebase.set_samplerate(jack_get_sample_rate(xjack.client));
+    xjack.timebase.set_bpm(120.0);
+
+    // channel 0 set the loop length: a chord on the first beat, then
+    // sixteenth notes, channel 1 play off the grid
+    mamba::EventStore loop0;
+    mamba::EventStore loop1;
+    add(loop0, 0x90, 60, 100, 0);
+    add(loop0, 0x90, 64, 100, 0);
+    add(loop0, 0x90, 67, 100, 0);
+    for (uint32_t t = 240; t < loop_ticks; t += 240) {
+        add(loop0, 0x90, 72 + (t/240) % 12, 90, t);
+        add(loop0, 0x80, 72 + (t/240) % 12, 0, t + 120);
+    }
+    add(loop0, 0x80, 60, 0, loop_ticks);
+    add(loop0, 0x80, 64, 0, loop_ticks);
+    add(loop0, 0x80, 67, 0, loop_ticks);
+    for (uint32_t t = 7; t < loop_ticks - 200; t += 333) {
+        add(loop1, 0x91, 48 + t % 24, 80, t);
+        add(loop1, 0x81, 48 + t % 24, 0, t + 101);
+    }
+    loop1.sort();
+    const size_t per_pass = loop0.size() + loop1.size();
+
+    // the frames relative to the loop start each event must land on
+    std::map<int, std::vector<jack_nframes_t> > expected;
+    const jack_nframes_t loop_frames = xjack.timebase.ticks_to_frames(loop_ticks);
+    for (int p = 0; p < passes; p++) {
+        for (const mamba::EventStore *l : {&loop0, &loop1}) {
+            for (size_t i = 0; i < l->size(); i++) {
+                expected[key(l->get_data(i))].push_back(p * loop_frames +
+                                    xjack.timebase.ticks_to_frames(l->get_time(i)));
+            }
+        }
+    }
+
+    xjack.rec.loops.set(0, std::move(loop0));
+    xjack.rec.loops.set(1, std::move(loop1));
+    xjack.first_play = true;
+    xjack.play.store(1, std::memory_order_release);
+
+    // every pass end with the closing notes off, on the frame of the
+    // chord which start the next pass
+    const unsigned int wanted = passes * per_pass;
+    for (int i = 0; i < 1000 && recorded_count.load(std::memory_order_acquire) < wanted; i++)
+        usleep(10000);
+    xjack.play.store(0, std::memory_order_release);
+    usleep(100000);
+    jack_client_close(rec_client);
+
+    const unsigned int n = recorded_count.load(std::memory_order_acquire);
+    if (n < wanted) {
+        fprintf(stderr, "recorded %u of %u events\n", n, wanted);
+        return 1;
+    }
+    jack_nframes_t origin = recorded[0].frame;
+    std::map<int, std::vector<jack_nframes_t> > got;
+    for (unsigned int i = 0; i < wanted; i++)
+        got[key(recorded[i].data)].push_back(recorded[i].frame - origin);
+
+    int errors = 0;
+    int32_t max_error = 0;
+    for (auto& e : expected) {
+        const std::vector<jack_nframes_t>& g = got[e.first];
+        if (g.size() != e.second.size()) {
+            fprintf(stderr, "event %06x: recorded %zu times, expected %zu\n",
+                e.first, g.size(), e.second.size());
+            errors++;
+            continue;
+        }
+        for (size_t i = 0; i < g.size(); i++) {
+            const int32_t diff = int32_t(g[i] - e.second[i]);
+            if (diff) {
+                errors++;
+                if (abs(diff) > abs(max_error)) max_error = diff;
+            }
+        }
+    }
+    fprintf(stdout, "period %u frames, %u events in %d passes, %d off their frame, max error %d frames\n",
+        period, wanted, passes, errors, max_error);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// the MidiQueue against the former 25 slot messenger: delivered and
+// reordered events with one and with three producers, repeated notes,
+// the push cost and the consumer poll of an empty queue
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.h"
+#include "MidiQueue.h"
+
+
+/****************************************************************
+ ** class OldMessenger
+ **
+ ** the former MidiMessenger, AlsaMidiMessenger and MidiMapperMessenger
+ */
+
+class OldMessenger {
+private:
+    static const int max_midi_cc_cnt = 25;
+    std::atomic<bool> send_cc[max_midi_cc_cnt];
+    uint8_t cc_num[max_midi_cc_cnt];
+    uint8_t pg_num[max_midi_cc_cnt];
+    uint8_t bg_num[max_midi_cc_cnt];
+    uint8_t me_num[max_midi_cc_cnt];
+public:
+    OldMessenger() {
+        for (int i = 0; i < max_midi_cc_cnt; i++) send_cc[i] = false;
+    }
+
+    int next(int i = -1) const noexcept {
+        while (++i < max_midi_cc_cnt) {
+            if (send_cc[i].load(std::memory_order_acquire)) return i;
+        }
+        return -1;
+    }
+
+    inline uint8_t size(const int i) const noexcept { return me_num[i]; }
+
+    void fill(unsigned char *midi_send, const int i) noexcept {
+        if (size(i) == 3) midi_send[2] = bg_num[i];
+        midi_send[1] = pg_num[i];
+        midi_send[0] = cc_num[i];
+        send_cc[i].store(false, std::memory_order_release);
+    }
+
+    bool send_midi_cc(uint8_t _cc, const uint8_t _pg, const uint8_t _bgn,
+                                    const uint8_t _num) noexcept {
+        for (int i = 0; i < max_midi_cc_cnt; i++) {
+            if (send_cc[i].load(std::memory_order_acquire)) {
+                if (cc_num[i] == _cc && pg_num[i] == _pg &&
+                    bg_num[i] == _bgn && me_num[i] == _num)
+                    return true;
+            } else if (!send_cc[i].load(std::memory_order_acquire)) {
+                cc_num[i] = _cc;
+                pg_num[i] = _pg;
+                bg_num[i] = _bgn;
+                me_num[i] = _num;
+                send_cc[i].store(true, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+typedef midiqueue::MidiQueue<256> Queue;
+
+static const uint32_t events = 300000;
+
+// every producer send on its own channel a 14 bit sequence number, so the
+// consumer could tell lost and reordered events apart
+static inline void make_event(int producer, uint32_t i, uint8_t *data) {
+    data[0] = 0x90 | producer;
+    data[1] = (i >> 7) & 0x7f;
+    data[2] = i & 0x7f;
+}
+
+typedef struct {
+    uint32_t delivered;
+    uint32_t reordered;
+} Result;
+
+template <typename Push, typename Drain>
+static Result run(int producers, Push push, Drain drain) {
+    std::atomic<int> running(producers);
+    uint32_t seen[16] = {0};
+    Result r = {0, 0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([p, &push, &running] () {
+            uint8_t data[3];
+            for (uint32_t i = 0; i < events; i++) {
+                make_event(p, i, data);
+                push(data);
+                // give the consumer a chance, like a player would
+                if (!(i & 63)) std::this_thread::yield();
+            }
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    auto consume = [&r, &seen, producers] (const uint8_t *data) {
+        const int p = data[0] & 0x0f;
+        const uint32_t i = (data[1] << 7) | data[2];
+        // the sequence wrap, so going back is a difference of more than half the range
+        if ((data[0] & 0xf0) != 0x90 || p >= producers || ((i - seen[p]) & 0x3fff) >= 0x2000) r.reordered++;
+        else seen[p] = i;
+        r.delivered++;
+    };
+    while (running.load(std::memory_order_acquire)) drain(consume);
+    for (auto& t : threads) t.join();
+    drain(consume);
+    return r;
+}
+
+static void print(const char* label, int producers, const Result& r) {
+    const uint32_t sent = events * producers;
+    fprintf(stdout, "%-22s %d producer%s  delivered %6.2f %%  out of order %u\n",
+        label, producers, producers > 1 ? "s" : " ", 100.0 * r.delivered / sent, r.reordered);
+}
+
+int main() {
+    for (int producers : {1, 3}) {
+        OldMessenger *old = new OldMessenger();
+        Result r = run(producers, [old] (const uint8_t *data) {
+            old->send_midi_cc(data[0], data[1], data[2], 3);
+        }, [old] (std::function<void(const uint8_t*)> consume) {
+            uint8_t data[3];
+            for (int i = old->next(); i > -1; i = old->next(i)) {
+                old->fill(data, i);
+                consume(data);
+            }
+        });
+        print("25 slot messenger", producers, r);
+        delete old;
+
+        Queue *queue = new Queue();
+        r = run(producers, [queue] (const uint8_t *data) {
+            queue->push(data, 3);
+        }, [queue] (std::function<void(const uint8_t*)> consume) {
+            while (const Queue::Event *e = queue->front()) {
+                consume(e->data);
+                queue->pop();
+            }
+        });
+        print("MidiQueue", producers, r);
+        fprintf(stdout, "%-22s overflows %u\n\n", "", queue->get_overflows());
+        delete queue;
+    }
+
+    // a drum roll, the same note eight times before the consumer run
+    OldMessenger old;
+    Queue queue;
+    const uint8_t note[3] = {0x99, 38, 100};
+    int old_count = 0;
+    int count = 0;
+    for (int i = 0; i < 8; i++) {
+        old.send_midi_cc(note[0], note[1], note[2], 3);
+        queue.push(note, 3);
+    }
+    uint8_t data[3];
+    for (int i = old.next(); i > -1; i = old.next(i), old_count++) old.fill(data, i);
+    while (queue.front()) { queue.pop(); count++; }
+    fprintf(stdout, "repeated note, 8 sent: 25 slot messenger deliver %d, MidiQueue %d\n\n",
+        old_count, count);
+
+    // push and pop without contention, the former one with 20 pending
+    // events, as the slots are scanned on every push
+    const int pushes = 1000000;
+    for (int i = 0; i < 20; i++) old.send_midi_cc(0xB0, i, 0, 3);
+    uint64_t start = benchutil::now_ns();
+    for (int i = 0; i < pushes; i++) {
+        old.send_midi_cc(note[0], note[1], note[2], 3);
+        old.fill(data, 20);
+    }
+    const double old_push = double(benchutil::now_ns() - start) / pushes;
+    for (int i = old.next(); i > -1; i = old.next(i)) old.fill(data, i);
+    start = benchutil::now_ns();
+    for (int i = 0; i < pushes; i++) {
+        queue.push(note, 3);
+        queue.pop();
+    }
+    const double push = double(benchutil::now_ns() - start) / pushes;
+    fprintf(stdout, "push + pop: 25 slot messenger %.1f ns, MidiQueue %.1f ns\n", old_push, push);
+
+    // the consumer poll once per jack period, mostly on an empty queue
+    const int polls = 1000000;
+    start = benchutil::now_ns();
+    int found = 0;
+    for (int i = 0; i < polls; i++) found += old.next() > -1;
+    const double old_poll = double(benchutil::now_ns() - start) / polls;
+    benchutil::keep(found);
+    start = benchutil::now_ns();
+    for (int i = 0; i < polls; i++) found += queue.front() != nullptr;
+    const double poll = double(benchutil::now_ns() - start) / polls;
+    benchutil::keep(found);
+    fprintf(stdout, "empty poll: 25 slot messenger %.1f ns, MidiQueue %.1f ns\n", old_poll, poll);
+    return 0;
+}
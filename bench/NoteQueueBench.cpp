@@ -0,0 +1,107 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// time the note notification work of a simulated jack process callback,
+// the NoteEventQueue against the former std::async per note,
+// at 1k and 10k notes per second, 48kHz with 256 frames per period
+
+#include <future>
+#include <thread>
+#include <unistd.h>
+
+#include "BenchUtil.h"
+#include "Mamba.h"
+
+static const int samplerate = 48000;
+static const int period = 256;
+static const int seconds = 2;
+
+// stands in for the keyboard matrix update in the GUI
+static std::atomic<uint32_t> key_matrix[16][4];
+
+static void trigger_get_midi_in(int channel, int key, bool on) {
+    if (on) key_matrix[channel][key>>5].fetch_or(1u << (key&31), std::memory_order_relaxed);
+    else key_matrix[channel][key>>5].fetch_and(~(1u << (key&31)), std::memory_order_relaxed);
+}
+
+// run the periods in real time, so the consumer sees the load it would see
+// with jack, and return the number of callbacks which missed the period
+template <typename Notify>
+static int run(int notes_per_second, benchutil::Samples& s, Notify notify) {
+    const int periods = seconds * samplerate / period;
+    const uint64_t period_ns = 1000000000ULL * period / samplerate;
+    double due = 0.0;
+    int note = 0;
+    int missed = 0;
+    uint64_t deadline = benchutil::now_ns();
+    for (int p = 0; p < periods; p++) {
+        due += double(notes_per_second) * period / samplerate;
+        const uint64_t start = benchutil::now_ns();
+        for (; due >= 1.0; due -= 1.0, note++) {
+            notify(note & 15, 36 + (note>>1) % 48, !(note & 1));
+        }
+        const uint64_t t = benchutil::now_ns() - start;
+        s.add(t);
+        if (t > period_ns) missed++;
+        deadline += period_ns;
+        const uint64_t n = benchutil::now_ns();
+        if (n < deadline) usleep((deadline - n) / 1000);
+    }
+    return missed;
+}
+
+int main() {
+    fprintf(stdout, "note notification per period, %d frames at %d Hz (%.0f us budget)\n\n",
+        period, samplerate, 1e6 * period / samplerate);
+    for (int rate : {1000, 10000}) {
+        benchutil::Samples s;
+
+        // the former path, a thread per note from inside the callback,
+        // the discarded future join it right away
+        int missed = run(rate, s, [] (int ch, int key, bool on) {
+            auto f = std::async(std::launch::async, trigger_get_midi_in, ch, key, on);
+        });
+        char label[64];
+        snprintf(label, sizeof label, "std::async %5d notes/s", rate);
+        s.print(label);
+        fprintf(stdout, "%-28s missed periods %d\n", "", missed);
+
+        // the ring, drained by a GUI like consumer every 10 ms
+        mamba::NoteEventQueue queue;
+        std::atomic<bool> stop(false);
+        std::thread consumer([&] () {
+            mamba::NoteEvent ev;
+            while (!stop.load(std::memory_order_acquire)) {
+                while (queue.pop(&ev)) trigger_get_midi_in(ev.channel, ev.key, ev.on);
+                usleep(10000);
+            }
+        });
+        s.clear();
+        missed = run(rate, s, [&queue] (int ch, int key, bool on) {
+            queue.push(ch, key, on);
+        });
+        stop.store(true, std::memory_order_release);
+        consumer.join();
+        snprintf(label, sizeof label, "NoteEventQueue %5d notes/s", rate);
+        s.print(label);
+        fprintf(stdout, "%-28s missed periods %d  overflows %u\n\n", "", missed, queue.get_overflows());
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// flush latency of the recorder when overdubbing a loop of 10k to 500k
+// events with chunks of 256 events, the former append + std::sort against
+// EventStore::merge() and the whole LoopStore::update() the record
+// thread run (copy, merge, publish)
+
+#include <random>
+
+#include "BenchUtil.h"
+#include "Mamba.h"
+
+// the former loop event
+typedef struct {
+    unsigned char buffer[3];
+    int num;
+    double deltaTime;
+    double absoluteTime;
+} OldMidiEvent;
+
+static const uint32_t chunk_size = 256;
+static const int flushes = 20;
+
+int main() {
+    for (size_t events : {10000, 50000, 100000, 500000}) {
+        // the base loop, 4 ticks between events on average
+        std::mt19937 rng(1);
+        mamba::EventStore base;
+        std::vector<OldMidiEvent> old;
+        base.reserve(events);
+        old.reserve(events);
+        uint32_t t = 0;
+        for (size_t i = 0; i < events; i++) {
+            t += rng() % 8;
+            const mamba::MidiEvent ev = {{0x90, uint8_t(rng() % 128), 100}, 3, t};
+            base.push_back(ev);
+            const OldMidiEvent oev = {{0x90, ev.buffer[1], 100}, 3, 0.0, double(t)};
+            old.push_back(oev);
+        }
+        const uint32_t end = t;
+
+        // the overdub chunks, each one in time order somewhere in the loop
+        std::vector<std::vector<mamba::MidiEvent> > chunks(flushes);
+        for (auto& chunk : chunks) {
+            uint32_t ct = rng() % end;
+            for (uint32_t i = 0; i < chunk_size; i++) {
+                ct += rng() % 8;
+                const mamba::MidiEvent ev = {{0x91, uint8_t(rng() % 128), 100}, 3, ct};
+                chunk.push_back(ev);
+            }
+        }
+
+        fprintf(stdout, "%zu events\n", events);
+        benchutil::Samples s;
+        for (auto& chunk : chunks) {
+            const uint64_t start = benchutil::now_ns();
+            old.reserve(old.size() + chunk.size());
+            for (const mamba::MidiEvent& ev : chunk) {
+                const OldMidiEvent oev = {{ev.buffer[0], ev.buffer[1], ev.buffer[2]}, 3,
+                                                    0.0, double(ev.absoluteTime)};
+                old.push_back(oev);
+            }
+            std::sort(old.begin(), old.end(), [] (const OldMidiEvent& lhs, const OldMidiEvent& rhs) {
+                return lhs.absoluteTime < rhs.absoluteTime;
+            });
+            s.add(benchutil::now_ns() - start);
+        }
+        s.print("append + std::sort");
+
+        s.clear();
+        mamba::EventStore merged(base);
+        for (auto& chunk : chunks) {
+            const uint64_t start = benchutil::now_ns();
+            merged.merge(chunk.data(), chunk.size());
+            s.add(benchutil::now_ns() - start);
+        }
+        s.print("EventStore::merge");
+
+        s.clear();
+        mamba::LoopStore loops;
+        loops.set(0, mamba::EventStore(base));
+        for (auto& chunk : chunks) {
+            const uint64_t start = benchutil::now_ns();
+            loops.update(0, [&chunk] (mamba::EventStore& play) {
+                play.merge(chunk.data(), chunk.size());
+            });
+            s.add(benchutil::now_ns() - start);
+            loops.reclaim();
+        }
+        s.print("LoopStore::update");
+        fprintf(stdout, "\n");
+    }
+    return 0;
+}
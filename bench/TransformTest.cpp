@@ -0,0 +1,87 @@
+/*
+ *                           0BSD
+ *
+ *                    BSD Zero Clause License
+ *
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// load rule sets and check what the compiled table let pass the way
+// XJack ask it, a SysEx F0..F7 from the jack input must be dropped by
+// "drop sysex" while notes and other sources stay untouched.
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "MidiTransform.h"
+
+static int failed = 0;
+
+static void expect(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        failed++;
+    }
+}
+
+// write the rules to a temporary file and load them
+static const miditransform::TransformTable *load(miditransform::MidiTransform *xf, const char *rules) {
+    char path[] = "/tmp/mamba-transformtest-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) return nullptr;
+    close(fd);
+    std::ofstream(path) << rules;
+    std::string error;
+    const bool ok = xf->load(path, &error);
+    unlink(path);
+    if (!ok) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return nullptr;
+    }
+    return xf->rt_acquire();
+}
+
+int main() {
+    const uint8_t sysex[6] = {0xf0, 0x7e, 0x7f, 0x06, 0x01, 0xf7};
+    const uint8_t note[3] = {0x90, 60, 100};
+    uint8_t out[miditransform::max_out][3];
+
+    miditransform::MidiTransform all;
+    const miditransform::TransformTable *t = load(&all, "drop sysex\n");
+    expect(t, "load drop sysex");
+    if (t) {
+        expect(!t->pass_long(miditransform::SRC_JACK, sysex), "jack sysex dropped");
+        expect(t->apply(miditransform::SRC_JACK, note, 3, out) == 1, "jack note pass");
+    }
+
+    miditransform::MidiTransform jack;
+    t = load(&jack, "source jack\ndrop sysex\nsource alsa\ndrop clock\n");
+    expect(t, "load per source rules");
+    if (t) {
+        expect(!t->pass_long(miditransform::SRC_JACK, sysex), "jack sysex dropped by a jack rule");
+        expect(t->pass_long(miditransform::SRC_ALSA, sysex), "alsa sysex pass a jack rule");
+    }
+
+    miditransform::MidiTransform other;
+    t = load(&other, "drop clock\n");
+    expect(t, "load drop clock");
+    if (t) expect(t->pass_long(miditransform::SRC_JACK, sysex), "jack sysex pass drop clock");
+
+    if (failed) return 1;
+    fprintf(stdout, "transform rules ok\n");
+    return 0;
+}
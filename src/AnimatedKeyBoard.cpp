@@ -19,6 +19,10 @@
  */
 
 
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
 #include "AnimatedKeyBoard.h"
 
 
@@ -26,38 +30,61 @@
  ** class AnimatedKeyBoard
  **
  ** animate midi input from jack on the keyboard in a extra thread
- ** 
+ ** when woken up by a key change
  */
 
 namespace animatedkeyboard {
 
 AnimatedKeyBoard::AnimatedKeyBoard() 
     :_execute(false) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 }
 
 AnimatedKeyBoard::~AnimatedKeyBoard() {
     if( _execute.load(std::memory_order_acquire) ) {
         stop();
     };
+    if (wake_fd >= 0) close(wake_fd);
 }
 
 void AnimatedKeyBoard::stop() {
     _execute.store(false, std::memory_order_release);
+    if (wake_fd >= 0) {
+        const uint64_t one = 1;
+        ssize_t ret = write(wake_fd, &one, sizeof(one));
+        (void)ret;
+    }
     if (_thd.joinable()) {
         _thd.join();
     }
 }
 
-void AnimatedKeyBoard::start(int interval, std::function<void(void)> func) {
+void AnimatedKeyBoard::notify() noexcept {
+    if (wake_fd < 0 || !_execute.load(std::memory_order_acquire)) return;
+    const uint64_t one = 1;
+    ssize_t ret = write(wake_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+void AnimatedKeyBoard::start(std::function<int(void)> func) {
     if( _execute.load(std::memory_order_acquire) ) {
         stop();
     };
     _execute.store(true, std::memory_order_release);
-    _thd = std::thread([this, interval, func]() {
+    _thd = std::thread([this, func]() {
+        pollfd pfd = {wake_fd, POLLIN, 0};
         while (_execute.load(std::memory_order_acquire)) {
-            func();                   
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(interval));
+            int timeout = func();
+            // without a eventfd fall back to polling
+            if (wake_fd < 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeout < 0 ? 30 : timeout));
+                continue;
+            }
+            if (poll(&pfd, 1, timeout) > 0) {
+                uint64_t count;
+                ssize_t ret = read(wake_fd, &count, sizeof(count));
+                (void)ret;
+            }
         }
     });
 }
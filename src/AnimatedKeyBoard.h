@@ -32,8 +32,9 @@
 /****************************************************************
  ** class AnimatedKeyBoard
  **
- ** animate midi input from jack on the keyboard in a extra thread
- ** 
+ ** animate midi input from jack on the keyboard in a extra thread,
+ ** the thread sleep on a eventfd until notify() or the timeout
+ ** returned by the last run pass.
  */
 
 namespace animatedkeyboard {
@@ -42,12 +43,18 @@ class AnimatedKeyBoard {
 private:
     std::atomic<bool> _execute;
     std::thread _thd;
+    // wake up the thread
+    int wake_fd;
 
 public:
     AnimatedKeyBoard();
     ~AnimatedKeyBoard();
     void stop();
-    void start(int interval, std::function<void(void)> func);
+    // func return the time in ms until it want to run again, -1 to
+    // sleep until the next notify()
+    void start(std::function<int(void)> func);
+    // wake the thread, a single write, safe from the jack thread
+    void notify() noexcept;
     bool is_running() const noexcept;
 };
 
@@ -0,0 +1,158 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "DspStats.h"
+#include <cstdio>
+
+namespace dspstats {
+
+
+/****************************************************************
+ ** class DspStats
+ **
+ ** per stage timing of the jack process callback
+ */
+
+static const char *stage_names[STAGES+1] = {
+    "transport", "midi in", "midi out", "record", "cycle"
+};
+
+DspStats::DspStats()
+    : cycles(0),
+    events_in(0),
+    events_out(0),
+    peak_in(0),
+    peak_out(0),
+    budget(0),
+    cycle_start(0),
+    mark(0),
+    current(TRANSPORT) {
+    for (int i = 0; i < STAGES+1; i++) {
+        for (int j = 0; j < buckets; j++) hist[i][j].store(0, std::memory_order_relaxed);
+        total[i].store(0, std::memory_order_relaxed);
+        peak[i].store(0, std::memory_order_relaxed);
+        last[i].store(0, std::memory_order_relaxed);
+        xruns[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < STAGES; i++) {
+        slow[i].store(0, std::memory_order_relaxed);
+        cycle_ns[i] = 0;
+    }
+}
+
+// bucket 0 is below 1us, bucket n below 2^n us, the last is open
+int DspStats::bucket(uint32_t ns) noexcept {
+    uint32_t us = ns / 1000;
+    int b = 0;
+    while (us && b < buckets - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+Stage DspStats::longest_stage() const noexcept {
+    Stage s = TRANSPORT;
+    for (int i = 1; i < STAGES; i++) {
+        if (last[i].load(std::memory_order_relaxed) > last[s].load(std::memory_order_relaxed))
+            s = (Stage)i;
+    }
+    return s;
+}
+
+void DspStats::end_cycle(uint32_t in, uint32_t out) noexcept {
+    enter(current);
+    const uint32_t cycle = (uint32_t)(mark - cycle_start);
+    for (int i = 0; i < STAGES; i++) {
+        bump(hist[i][bucket(cycle_ns[i])]);
+        bump(total[i], (uint64_t)cycle_ns[i]);
+        raise(peak[i], cycle_ns[i]);
+        last[i].store(cycle_ns[i], std::memory_order_relaxed);
+    }
+    bump(hist[STAGES][bucket(cycle)]);
+    bump(total[STAGES], (uint64_t)cycle);
+    raise(peak[STAGES], cycle);
+    last[STAGES].store(cycle, std::memory_order_relaxed);
+    // a cycle using more than a quarter of the period is slow
+    const uint32_t b = budget.load(std::memory_order_relaxed);
+    if (b && cycle > b / 4) bump(slow[longest_stage()]);
+    bump(events_in, (uint64_t)in);
+    bump(events_out, (uint64_t)out);
+    raise(peak_in, in);
+    raise(peak_out, out);
+    cycles.store(cycles.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void DspStats::set_period(jack_nframes_t nframes, jack_nframes_t samplerate) noexcept {
+    if (!samplerate) return;
+    budget.store((uint32_t)((uint64_t)nframes * 1000000000ULL / samplerate), std::memory_order_relaxed);
+}
+
+// blame the rest of the graph when mamba used less than half the period
+void DspStats::xrun() noexcept {
+    const uint32_t b = budget.load(std::memory_order_relaxed);
+    if (b && last[STAGES].load(std::memory_order_relaxed) < b / 2) {
+        xruns[STAGES].fetch_add(1, std::memory_order_relaxed);
+    } else {
+        xruns[longest_stage()].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::string DspStats::report(float dsp_load) const {
+    const uint64_t n = cycles.load(std::memory_order_acquire);
+    char line[160];
+    std::string r;
+    uint32_t all_xruns = 0;
+    for (int i = 0; i < STAGES+1; i++) all_xruns += xruns[i].load(std::memory_order_relaxed);
+    snprintf(line, sizeof(line), "cycles %llu  period %.2f ms  jack dsp load %.1f%%\n",
+        (unsigned long long)n, budget.load(std::memory_order_relaxed) / 1e6, dsp_load);
+    r += line;
+    snprintf(line, sizeof(line), "%-10s %8s %8s %8s %8s %6s %6s\n",
+        "stage", "avg us", "p99 <us", "peak us", "last us", "slow", "xruns");
+    r += line;
+    for (int i = 0; i < STAGES+1; i++) {
+        // upper bound of the bucket holding the 99th percentile
+        uint64_t count = 0;
+        int p99 = 0;
+        for (int j = 0; j < buckets; j++) {
+            count += hist[i][j].load(std::memory_order_relaxed);
+            p99 = j;
+            if (n && count * 100 >= n * 99) break;
+        }
+        snprintf(line, sizeof(line), "%-10s %8.2f %8u %8.2f %8.2f %6s %6u\n", stage_names[i],
+            n ? total[i].load(std::memory_order_relaxed) / 1e3 / n : 0.0,
+            1u << p99,
+            peak[i].load(std::memory_order_relaxed) / 1e3,
+            last[i].load(std::memory_order_relaxed) / 1e3,
+            i < STAGES ? std::to_string(slow[i].load(std::memory_order_relaxed)).c_str() : "-",
+            i < STAGES ? xruns[i].load(std::memory_order_relaxed) : all_xruns);
+        r += line;
+    }
+    snprintf(line, sizeof(line), "xruns outside mamba %u\n",
+        xruns[STAGES].load(std::memory_order_relaxed));
+    r += line;
+    snprintf(line, sizeof(line), "events in %llu (peak %u/cycle)  out %llu (peak %u/cycle)\n",
+        (unsigned long long)events_in.load(std::memory_order_relaxed), peak_in.load(std::memory_order_relaxed),
+        (unsigned long long)events_out.load(std::memory_order_relaxed), peak_out.load(std::memory_order_relaxed));
+    r += line;
+    return r;
+}
+
+} // namespace dspstats
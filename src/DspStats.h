@@ -0,0 +1,122 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <string>
+#include <time.h>
+
+#include <jack/jack.h>
+
+#pragma once
+
+#ifndef DSPSTATS_H
+#define DSPSTATS_H
+
+
+namespace dspstats {
+
+// stages of the jack process callback
+typedef enum {
+    TRANSPORT,
+    MIDI_IN,
+    MIDI_OUT,
+    RECORD,
+    STAGES
+} Stage;
+
+
+/****************************************************************
+ ** class DspStats
+ **
+ ** per stage timing of the jack process callback. The jack thread
+ ** write lock free histograms (power of two microsecond buckets),
+ ** the xrun callback blame the stage which ran longest in the last
+ ** cycle, or the rest of the graph when mamba used little of the
+ ** period. report() may be called from any non realtime thread.
+ */
+
+class DspStats {
+public:
+    static constexpr int buckets = 16;
+
+private:
+    std::atomic<uint32_t> hist[STAGES+1][buckets];
+    std::atomic<uint64_t> total[STAGES+1];
+    std::atomic<uint32_t> peak[STAGES+1];
+    std::atomic<uint32_t> last[STAGES+1];
+    std::atomic<uint32_t> slow[STAGES];
+    std::atomic<uint32_t> xruns[STAGES+1];
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> events_in;
+    std::atomic<uint64_t> events_out;
+    std::atomic<uint32_t> peak_in;
+    std::atomic<uint32_t> peak_out;
+    std::atomic<uint32_t> budget;
+    // jack thread only
+    uint32_t cycle_ns[STAGES];
+    uint64_t cycle_start;
+    uint64_t mark;
+    Stage current;
+
+    // single writer, so a plain load/store is enough
+    template <typename T>
+    static inline void bump(std::atomic<T>& a, T v = 1) noexcept {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    template <typename T>
+    static inline void raise(std::atomic<T>& a, T v) noexcept {
+        if (v > a.load(std::memory_order_relaxed)) a.store(v, std::memory_order_relaxed);
+    }
+    static int bucket(uint32_t ns) noexcept;
+    Stage longest_stage() const noexcept;
+
+public:
+    DspStats();
+    static inline uint64_t now() noexcept {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+    // jack process thread
+    inline void begin_cycle(Stage s) noexcept {
+        cycle_start = mark = now();
+        current = s;
+        for (int i = 0; i < STAGES; i++) cycle_ns[i] = 0;
+    }
+    // switch to stage s, return the stage to switch back to
+    inline Stage enter(Stage s) noexcept {
+        const uint64_t t = now();
+        cycle_ns[current] += (uint32_t)(t - mark);
+        mark = t;
+        const Stage prev = current;
+        current = s;
+        return prev;
+    }
+    void end_cycle(uint32_t in, uint32_t out) noexcept;
+    // jack notification thread
+    void set_period(jack_nframes_t nframes, jack_nframes_t samplerate) noexcept;
+    void xrun() noexcept;
+    // non realtime reader
+    std::string report(float dsp_load) const;
+};
+
+} // namespace dspstats
+
+#endif //DSPSTATS_H
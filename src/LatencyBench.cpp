@@ -0,0 +1,234 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "LatencyBench.h"
+#include "XJack.h"
+#include "XAlsa.h"
+#include "MidiMapper.h"
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+namespace latencybench {
+
+
+/****************************************************************
+ ** class ProbeTap
+ **
+ ** realtime side of the latency benchmark
+ */
+
+static const char *path_names[PATHS] = {
+    "loopback", "through", "mapper", "alsa"
+};
+
+ProbeTap::ProbeTap()
+    : active(false),
+    count(0),
+    lost(0),
+    path(LOOPBACK),
+    wanted(0),
+    interval(0),
+    timeout(0),
+    next_due(0),
+    sent_at(0),
+    id(0),
+    hops(0),
+    outstanding(false),
+    armed(false) {
+}
+
+void ProbeTap::start(Path p, uint32_t probes, jack_nframes_t interval_, jack_nframes_t timeout_) noexcept {
+    path = p;
+    wanted = std::min(probes, max_probes);
+    interval = interval_;
+    timeout = timeout_;
+    outstanding = false;
+    armed = false;
+    hops = 0;
+    count.store(0, std::memory_order_relaxed);
+    lost.store(0, std::memory_order_relaxed);
+    active.store(true, std::memory_order_release);
+}
+
+void ProbeTap::stop() noexcept {
+    active.store(false, std::memory_order_release);
+}
+
+bool ProbeTap::done() const noexcept {
+    return !active.load(std::memory_order_acquire);
+}
+
+uint32_t ProbeTap::get_count() const noexcept {
+    return count.load(std::memory_order_acquire);
+}
+
+uint32_t ProbeTap::get_lost() const noexcept {
+    return lost.load(std::memory_order_acquire);
+}
+
+// called at the end of the output stage, so the probe is the last event
+void ProbeTap::emit(void *buf, jack_nframes_t nframes, jack_nframes_t frame) noexcept {
+    if (!active.load(std::memory_order_acquire)) return;
+    if (!armed) {
+        next_due = frame;
+        armed = true;
+    }
+    if (outstanding) {
+        if (frame - sent_at < timeout) return;
+        outstanding = false;
+        next_due = frame;
+        lost.store(lost.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        if (count.load(std::memory_order_relaxed) + lost.load(std::memory_order_relaxed) >= wanted) {
+            active.store(false, std::memory_order_release);
+            return;
+        }
+    }
+    if ((int32_t)(frame - next_due) < 0) return;
+    // walk the probe through the period to catch offset dependent jitter
+    const jack_nframes_t offset = (id * 37u) % nframes;
+    unsigned char* midi_send = jack_midi_event_reserve(buf, offset, 3);
+    if (!midi_send) return;
+    midi_send[0] = 0x9F;
+    midi_send[1] = id;
+    midi_send[2] = 0;
+    sent_at = frame + offset;
+    outstanding = true;
+    hops = 0;
+}
+
+Route ProbeTap::arrived(jack_nframes_t frame, const uint8_t *m) noexcept {
+    if (!active.load(std::memory_order_acquire) || !outstanding || m[1] != id) return CONSUME;
+    // all paths but the plain loopback pass the input once more
+    if (++hops < (path == LOOPBACK ? 1 : 2)) return path == ALSA ? TO_ALSA : PASS;
+    const uint32_t c = count.load(std::memory_order_relaxed);
+    result[c] = (int32_t)(frame - sent_at);
+    outstanding = false;
+    id = (id + 1) & 0x7f;
+    next_due = sent_at + interval;
+    count.store(c + 1, std::memory_order_release);
+    if (c + 1 + lost.load(std::memory_order_relaxed) >= wanted)
+        active.store(false, std::memory_order_release);
+    return CONSUME;
+}
+
+
+/****************************************************************
+ ** class LatencyBench
+ **
+ ** headless --bench-latency mode
+ */
+
+LatencyBench::LatencyBench(xjack::XJack *xjack_, xalsa::XAlsa *xalsa_,
+                                    midimapper::MidiMapper *midimap_)
+    : xjack(xjack_),
+    xalsa(xalsa_),
+    midimap(midimap_),
+    tap() {
+    xjack->probe.store(&tap, std::memory_order_release);
+}
+
+LatencyBench::~LatencyBench() {
+    xjack->probe.store(nullptr, std::memory_order_release);
+    // let the jack thread drop the pointer
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+bool LatencyBench::measure(Path p, uint32_t probes) {
+    const jack_nframes_t srate = jack_get_sample_rate(xjack->client);
+    const jack_nframes_t period = jack_get_buffer_size(xjack->client);
+    const jack_nframes_t interval = std::max(period * 4, srate / 100);
+    xjack->midi_through = p == THROUGH;
+    xjack->midi_map = p == MAPPER;
+    xalsa->mmap = 0;
+    if (p == ALSA) xalsa->xalsa_loopback(true);
+
+    tap.start(p, probes, interval, srate);
+    // two intervals per probe plus a second for the lost ones
+    const int64_t max_ms = (int64_t)probes * 2000 * (interval + period) / srate + 1000;
+    for (int64_t ms = 0; !tap.done() && ms < max_ms; ms += 10)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const bool finished = tap.done();
+    tap.stop();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * 1000 * period / srate + 10));
+
+    if (p == ALSA) xalsa->xalsa_loopback(false);
+    xjack->midi_through = 1;
+    xjack->midi_map = 0;
+    return finished;
+}
+
+void LatencyBench::report(Path p) {
+    const uint32_t n = tap.get_count();
+    const uint32_t lost = tap.get_lost();
+    if (!n) {
+        fprintf(stdout, "%-9s %6u %6u   no probe returned\n", path_names[p], n, lost);
+        return;
+    }
+    std::vector<int32_t> v(tap.get_results(), tap.get_results() + n);
+    std::sort(v.begin(), v.end());
+    double mean = 0.0;
+    for (auto l : v) mean += l;
+    mean /= n;
+    double var = 0.0;
+    for (auto l : v) var += (l - mean) * (l - mean);
+    const double jitter = std::sqrt(var / n);
+    const int32_t p99 = v[std::min((size_t)n - 1, (size_t)n * 99 / 100)];
+    const double ms = 1000.0 / jack_get_sample_rate(xjack->client);
+    fprintf(stdout, "%-9s %6u %6u %7d %8.1f %7d %7d %8.2f %8.3f\n", path_names[p], n, lost,
+        v.front(), mean, p99, v.back(), jitter, mean * ms);
+}
+
+int LatencyBench::run(uint32_t probes) {
+    if (!xjack->client) return 1;
+    const char *out = jack_port_name(xjack->out_port);
+    const char *in = jack_port_name(xjack->in_port);
+    if (jack_connect(xjack->client, out, in) && !jack_port_connected_to(xjack->out_port, in)) {
+        fprintf(stderr, "bench: couldn't connect %s to %s\n", out, in);
+        return 1;
+    }
+    midimap->mmapper_start([] (int, int, bool) {});
+    const bool have_alsa = xalsa->xalsa_init(xjack->client_name.c_str(), "input", "output") >= 0;
+    if (have_alsa) xalsa->xalsa_start([] (int, int, bool) {});
+
+    fprintf(stdout, "MIDI round trip latency in frames, %u probes per path, period %u, samplerate %u\n",
+        std::min(probes, ProbeTap::max_probes), jack_get_buffer_size(xjack->client),
+        jack_get_sample_rate(xjack->client));
+    fprintf(stdout, "%-9s %6s %6s %7s %8s %7s %7s %8s %8s\n",
+        "path", "probes", "lost", "min", "mean", "p99", "max", "jitter", "mean ms");
+    int ret = 0;
+    for (int p = 0; p < PATHS; p++) {
+        if (p == ALSA && !have_alsa) {
+            fprintf(stdout, "%-9s skipped, alsa sequencer not available\n", path_names[p]);
+            continue;
+        }
+        if (!measure((Path)p, probes)) ret = 1;
+        report((Path)p);
+    }
+    fflush(stdout);
+    jack_disconnect(xjack->client, out, in);
+    return ret;
+}
+
+} // namespace latencybench
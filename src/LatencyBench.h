@@ -0,0 +1,128 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <cstdint>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+#pragma once
+
+#ifndef LATENCYBENCH_H
+#define LATENCYBENCH_H
+
+namespace xjack { class XJack; }
+namespace xalsa { class XAlsa; }
+namespace midimapper { class MidiMapper; }
+
+namespace latencybench {
+
+// the paths a probe could take before it comes back to the input port
+typedef enum {
+    LOOPBACK,
+    THROUGH,
+    MAPPER,
+    ALSA,
+    PATHS
+} Path;
+
+// what the jack thread should do with a arrived probe
+typedef enum {
+    CONSUME,
+    PASS,
+    TO_ALSA
+} Route;
+
+
+/****************************************************************
+ ** class ProbeTap
+ **
+ ** realtime side of the latency benchmark. Emit one probe at a time
+ ** (note off on channel 16, note = probe id) from the jack output
+ ** and take the round trip time in frames when it arrive back at
+ ** the jack input after the hops the measured path needs.
+ */
+
+class ProbeTap {
+public:
+    static constexpr uint32_t max_probes = 4096;
+
+private:
+    std::atomic<bool> active;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> lost;
+    int32_t result[max_probes];
+    // set before active, read by the jack thread only
+    Path path;
+    uint32_t wanted;
+    jack_nframes_t interval;
+    jack_nframes_t timeout;
+    // jack thread only
+    jack_nframes_t next_due;
+    jack_nframes_t sent_at;
+    uint8_t id;
+    int hops;
+    bool outstanding;
+    bool armed;
+
+public:
+    ProbeTap();
+    static inline bool is_probe(const uint8_t *m) noexcept {
+        return (m[0] == 0x9F || m[0] == 0x8F) && !m[2];
+    }
+    // non realtime control
+    void start(Path p, uint32_t probes, jack_nframes_t interval, jack_nframes_t timeout) noexcept;
+    void stop() noexcept;
+    bool done() const noexcept;
+    uint32_t get_count() const noexcept;
+    uint32_t get_lost() const noexcept;
+    const int32_t *get_results() const noexcept { return result; }
+    // jack thread
+    void emit(void *buf, jack_nframes_t nframes, jack_nframes_t frame) noexcept;
+    Route arrived(jack_nframes_t frame, const uint8_t *m) noexcept;
+};
+
+
+/****************************************************************
+ ** class LatencyBench
+ **
+ ** headless --bench-latency mode, connect the jack (and alsa) ports
+ ** in a loop and measure each path Mamba could route a event
+ */
+
+class LatencyBench {
+private:
+    xjack::XJack *xjack;
+    xalsa::XAlsa *xalsa;
+    midimapper::MidiMapper *midimap;
+    ProbeTap tap;
+    bool measure(Path p, uint32_t probes);
+    void report(Path p);
+
+public:
+    LatencyBench(xjack::XJack *xjack, xalsa::XAlsa *xalsa, midimapper::MidiMapper *midimap);
+    ~LatencyBench();
+    int run(uint32_t probes);
+};
+
+} // namespace latencybench
+
+#endif //LATENCYBENCH_H
@@ -27,54 +27,280 @@ namespace mamba {
 
 
 /****************************************************************
- ** class MidiMessenger
+ ** class TimeBase
  **
- ** create, collect and send all midi events to jack_midi out buffer
+ ** convert between tempo independent loop ticks (ppqn) and jack frames,
+ ** the 32.32 fixed point factors are only recalculated when the tempo
+ ** or the samplerate change
  */
 
-MidiMessenger::MidiMessenger() {
-    channel = 0;
-    for (int i = 0; i < max_midi_cc_cnt; i++) {
-        send_cc[i] = false;
+TimeBase::TimeBase()
+    : samplerate(48000),
+    bpm(120.0),
+    frames_per_tick(0),
+    ticks_per_frame(0),
+    generation(0) {
+    update();
+}
+
+void TimeBase::update() noexcept {
+    const double fpt = ((double)samplerate * 60.0) / (bpm * (double)ppqn);
+    frames_per_tick.store((uint64_t)std::llround(fpt * 4294967296.0), std::memory_order_relaxed);
+    ticks_per_frame.store((uint64_t)std::llround(4294967296.0 / fpt), std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+void TimeBase::set_samplerate(unsigned int samplerate_) noexcept {
+    std::lock_guard<std::mutex> lk(m);
+    if (!samplerate_ || samplerate_ == samplerate) return;
+    samplerate = samplerate_;
+    update();
+}
+
+void TimeBase::set_bpm(double bpm_) noexcept {
+    std::lock_guard<std::mutex> lk(m);
+    if (bpm_ <= 0.0 || bpm_ == bpm) return;
+    bpm = bpm_;
+    update();
+}
+
+double TimeBase::ticks_to_seconds(uint32_t ticks) noexcept {
+    std::lock_guard<std::mutex> lk(m);
+    return ((double)ticks * 60.0) / (bpm * (double)ppqn);
+}
+
+
+/****************************************************************
+ ** class EventStore
+ **
+ ** packed column store for loop events, the absolute time and the
+ ** midi bytes live in separate arrays (7 bytes per event), so time
+ ** scans only touch the time array. The message length is derived
+ ** from the status byte.
+ */
+
+// index of the first event at or after t
+size_t EventStore::find_time(uint32_t t) const noexcept {
+    return std::lower_bound(time.begin(), time.end(), t) - time.begin();
+}
+
+bool EventStore::push_back(const MidiEvent& ev) {
+    if (!message_size(ev.buffer[0])) return false;
+    time.push_back(ev.absoluteTime);
+    data.insert(data.end(), ev.buffer, ev.buffer + 3);
+    return true;
+}
+
+void EventStore::set(size_t i, const MidiEvent& ev) noexcept {
+    time[i] = ev.absoluteTime;
+    std::copy(ev.buffer, ev.buffer + 3, data.begin() + i*3);
+}
+
+void EventStore::erase(size_t first, size_t last) {
+    time.erase(time.begin() + first, time.begin() + last);
+    data.erase(data.begin() + first*3, data.begin() + last*3);
+}
+
+void EventStore::reserve(size_t n) {
+    time.reserve(n);
+    data.reserve(n*3);
+}
+
+void EventStore::clear() noexcept {
+    time.clear();
+    data.clear();
+}
+
+// stable sort by time, events at the same tick keep their order
+void EventStore::sort() {
+    if (is_sorted()) return;
+    std::vector<uint32_t> index(time.size());
+    for (uint32_t i = 0; i < index.size(); i++) index[i] = i;
+    std::stable_sort(index.begin(), index.end(),
+        [this](const uint32_t lhs, const uint32_t rhs) { return time[lhs] < time[rhs]; });
+    std::vector<uint32_t> stime(time.size());
+    std::vector<uint8_t> sdata(data.size());
+    for (size_t i = 0; i < index.size(); i++) {
+        stime[i] = time[index[i]];
+        std::copy(data.begin() + index[i]*3, data.begin() + index[i]*3 + 3, sdata.begin() + i*3);
     }
+    time.swap(stime);
+    data.swap(sdata);
 }
 
-int MidiMessenger::next(int i) const noexcept {
-    while (++i < max_midi_cc_cnt) {
-        if (send_cc[i].load(std::memory_order_acquire)) {
-            return i;
+// merge a chunk of events in linear time, the chunk is sorted first
+// when needed. Events at the same tick go behind the existing ones.
+// Return true when events were inserted before the end of the store.
+bool EventStore::merge(const MidiEvent *ev, size_t n) {
+    EventStore chunk;
+    chunk.reserve(n);
+    for (size_t i = 0; i < n; i++) chunk.push_back(ev[i]);
+    if (chunk.empty()) return false;
+    chunk.sort();
+    const size_t n0 = time.size();
+    const size_t m = chunk.size();
+    time.insert(time.end(), chunk.time.begin(), chunk.time.end());
+    data.insert(data.end(), chunk.data.begin(), chunk.data.end());
+    // plain append, the usual case for a fresh take
+    if (!n0 || time[n0-1] <= chunk.time[0]) return false;
+    // merge from the back, so nothing needs to be moved twice
+    size_t i = n0, j = m, k = n0 + m;
+    while (j) {
+        if (i && time[i-1] > chunk.time[j-1]) {
+            --i; --k;
+            time[k] = time[i];
+            std::copy(data.begin() + i*3, data.begin() + i*3 + 3, data.begin() + k*3);
+        } else {
+            --j; --k;
+            time[k] = chunk.time[j];
+            std::copy(chunk.data.begin() + j*3, chunk.data.begin() + j*3 + 3, data.begin() + k*3);
         }
     }
-    return -1;
+    return true;
+}
+
+size_t EventStore::memory_usage() const noexcept {
+    return time.capacity() * sizeof(uint32_t) + data.capacity();
+}
+
+
+/****************************************************************
+ ** class LoopSnapshot
+ **
+ ** immutable view of the loops of all 16 channels, unchanged
+ ** channels are shared between snapshots
+ */
+
+const EventStore& LoopSnapshot::channel(int ch) const noexcept {
+    static const EventStore empty;
+    return loop[ch] ? *loop[ch] : empty;
 }
 
-void MidiMessenger::fill(unsigned char *midi_send, int i) noexcept {
-    if (size(i) == 3) {
-        midi_send[2] =  bg_num[i];
+
+/****************************************************************
+ ** class LoopStore
+ **
+ ** publish loop snapshots RCU style: writers copy, edit and swap in
+ ** a new snapshot under a mutex, the jack thread pick up the current
+ ** one wait free. Replaced snapshots are deleted by the writers once
+ ** the jack thread moved on, so it never free memory.
+ */
+
+LoopStore::LoopStore()
+    : snapshots(new LoopSnapshot()) {
+}
+
+const LoopSnapshot *LoopStore::rt_acquire() noexcept {
+    return snapshots.rt_acquire();
+}
+
+LoopSnapshot LoopStore::get_snapshot() {
+    std::lock_guard<std::mutex> lk(m);
+    return *snapshots.get();
+}
+
+void LoopStore::update(int ch, std::function<void(EventStore&)> edit) {
+    std::lock_guard<std::mutex> lk(m);
+    LoopSnapshot *snap = new LoopSnapshot(*snapshots.get());
+    EventStore *loop = new EventStore(snap->channel(ch));
+    edit(*loop);
+    snap->loop[ch].reset(loop);
+    snapshots.publish(snap);
+}
+
+void LoopStore::update_all(std::function<void(EventStore*)> edit) {
+    std::lock_guard<std::mutex> lk(m);
+    LoopSnapshot *snap = new LoopSnapshot(*snapshots.get());
+    EventStore play[16];
+    for (int j = 0; j < 16; j++) play[j] = snap->channel(j);
+    edit(play);
+    for (int j = 0; j < 16; j++) {
+        if (play[j].size()) snap->loop[j] = std::make_shared<const EventStore>(std::move(play[j]));
+        else snap->loop[j].reset();
     }
-    midi_send[1] = pg_num[i];    // program value
-    midi_send[0] = cc_num[i];    // controller+ channel
-    send_cc[i].store(false, std::memory_order_release);
+    snapshots.publish(snap);
+}
+
+void LoopStore::set(int ch, EventStore&& loop) {
+    std::lock_guard<std::mutex> lk(m);
+    LoopSnapshot *snap = new LoopSnapshot(*snapshots.get());
+    if (loop.size()) snap->loop[ch] = std::make_shared<const EventStore>(std::move(loop));
+    else snap->loop[ch].reset();
+    snapshots.publish(snap);
+}
+
+void LoopStore::clear(int ch) {
+    std::lock_guard<std::mutex> lk(m);
+    LoopSnapshot *snap = new LoopSnapshot(*snapshots.get());
+    snap->loop[ch].reset();
+    snapshots.publish(snap);
+}
+
+void LoopStore::clear_all() {
+    std::lock_guard<std::mutex> lk(m);
+    snapshots.publish(new LoopSnapshot());
+}
+
+// free snapshots the jack thread was still using on the last publish
+void LoopStore::reclaim() {
+    std::lock_guard<std::mutex> lk(m);
+    snapshots.reclaim();
+}
+
+
+/****************************************************************
+ ** class MidiMessenger
+ **
+ ** create, collect and send all midi events to jack_midi out buffer
+ */
+
+MidiMessenger::MidiMessenger()
+    : channel(0) {
 }
 
 bool MidiMessenger::send_midi_cc(uint8_t _cc, const uint8_t _pg, const uint8_t _bgn,
                                 const uint8_t _num, const bool have_channel) noexcept {
     if (!have_channel && channel < 16) _cc |=channel;
-    for(int i = 0; i < max_midi_cc_cnt; i++) {
-        if (send_cc[i].load(std::memory_order_acquire)) {
-            if (cc_num[i] == _cc && pg_num[i] == _pg &&
-                bg_num[i] == _bgn && me_num[i] == _num)
-                return true;
-        } else if (!send_cc[i].load(std::memory_order_acquire)) {
-            cc_num[i] = _cc;
-            pg_num[i] = _pg;
-            bg_num[i] = _bgn;
-            me_num[i] = _num;
-            send_cc[i].store(true, std::memory_order_release);
-            return true;
-        }
+    const uint8_t data[3] = {_cc, _pg, _bgn};
+    return push(data, _num, frame_time ? frame_time() : 0);
+}
+
+
+/****************************************************************
+ ** class NoteEventQueue
+ **
+ ** lock free single producer/single consumer ring, pass note on/off
+ ** events from the jack process callback to the GUI thread
+ */
+
+NoteEventQueue::NoteEventQueue()
+    : write_pos(0),
+    read_pos(0),
+    overflows(0) {
+}
+
+// called from the jack process callback only, never block
+bool NoteEventQueue::push(const uint8_t channel, const uint8_t key, const bool on) noexcept {
+    const uint32_t w = write_pos.load(std::memory_order_relaxed);
+    if (w - read_pos.load(std::memory_order_acquire) >= queue_size) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
-    return false;
+    NoteEvent& ev = events[w & (queue_size - 1)];
+    ev.channel = channel;
+    ev.key = key;
+    ev.on = on;
+    write_pos.store(w + 1, std::memory_order_release);
+    return true;
+}
+
+// called from the consumer thread only
+bool NoteEventQueue::pop(NoteEvent *ev) noexcept {
+    const uint32_t r = read_pos.load(std::memory_order_relaxed);
+    if (r == write_pos.load(std::memory_order_acquire)) return false;
+    (*ev) = events[r & (queue_size - 1)];
+    read_pos.store(r + 1, std::memory_order_release);
+    return true;
 }
 
 
@@ -88,17 +314,14 @@ bool MidiMessenger::send_midi_cc(uint8_t _cc, const uint8_t _pg, const uint8_t _
 MidiLoad::MidiLoad() {
     smf = NULL;
     smf_event = NULL;
-    deltaTime = 0.0;
-    absoluteTime = 0.0;
+    absoluteTime = 0;
 }
 
 MidiLoad::~MidiLoad() {
     if (smf) smf_delete(smf);
 }
 
-bool MidiLoad::load_file(std::vector<MidiEvent> *play, int *song_bpm, const char* file_name) {
-    smf = smf_new();
-    deltaTime = 0.0;
+bool MidiLoad::load_file(EventStore *play, int *song_bpm, const char* file_name) {
     if(!(smf = smf_load(file_name))) return false;
     // fprintf(stderr, "ppqn = %i\n", smf->ppqn);
     // fprintf(stderr, "length = %f sec\n", smf_get_length_seconds(smf));
@@ -106,6 +329,8 @@ bool MidiLoad::load_file(std::vector<MidiEvent> *play, int *song_bpm, const char
     *(song_bpm) = 120;
     int count = 0;
     int stamp = positions[positions.size()-1];
+    const size_t first = play->size();
+    file_time.clear();
     while ((smf_event = smf_get_next_event(smf)) !=NULL) {
         if (smf_event_is_metadata(smf_event)) {
             // char *decoded = smf_event_decode(smf_event);
@@ -125,47 +350,56 @@ bool MidiLoad::load_file(std::vector<MidiEvent> *play, int *song_bpm, const char
             continue;
         }
         ev = {{smf_event->midi_buffer[0], smf_event->midi_buffer[1], smf_event->midi_buffer[2]},
-                                        smf_event->midi_buffer_length, smf_event->time_seconds - deltaTime,
-                                                                    smf_event->time_seconds + absoluteTime};
-        play->push_back(ev);
-        deltaTime = smf_event->time_seconds;
+                                        smf_event->midi_buffer_length, 0};
+        // sysex messages can't be stored in the loop
+        if (!play->push_back(ev)) continue;
+        file_time.push_back(smf_event->time_seconds);
         count++;
         //fprintf(stderr,"%d: %f seconds, %d pulses, %d delta pulses\n", smf_event->event_number,
         //    smf_event->time_seconds, smf_event->time_pulses, smf_event->delta_time_pulses);
 
     }
     positions.push_back(count+stamp);
-    // time_pulse to seconds = time_pulse*(song_bpm x smf->ppqn)*(1/60)
+
+    // convert the file time (seconds) to ticks at the song tempo
+    for (size_t i = 0; i < file_time.size(); i++) {
+        play->set_time(first+i, absoluteTime + TimeBase::seconds_to_ticks(file_time[i], *(song_bpm)));
+    }
+    file_time.clear();
 
     if (smf) smf_delete(smf);
     smf = NULL;
     return true;
 }
 
-bool MidiLoad::load_from_file(std::vector<MidiEvent> *play, int *song_bpm, const char* file_name) {
+bool MidiLoad::load_from_file(EventStore *play, int *song_bpm, const char* file_name) {
     play->clear();
     positions.clear();
     positions.push_back(0);
-    absoluteTime = 0.0;
+    absoluteTime = 0;
     return load_file(play, song_bpm, file_name);
 }
 
-bool MidiLoad::add_from_file(std::vector<MidiEvent> *play, int *song_bpm, const char* file_name) {
+bool MidiLoad::add_from_file(EventStore *play, int *song_bpm, const char* file_name) {
     if (!positions.size()) positions.push_back(0);
     if (play->size()) {
-        const mamba::MidiEvent ev = play[0][play->size()-1];
-        absoluteTime = ev.absoluteTime;
+        absoluteTime = play->back_time();
     } else {
-        absoluteTime = 0.0;
+        absoluteTime = 0;
     }
     return load_file(play, song_bpm, file_name);
 }
 
-void MidiLoad::remove_file(std::vector<MidiEvent> *play, int f) {
+void MidiLoad::remove_file(EventStore *play, int f) {
     if (!((int)positions.size()>f)) return;
     int stamp = positions[f];
     int stamp2 = positions[f+1];
-    play[0].erase(play[0].begin()+stamp,play[0].begin()+stamp2);
+    // the files after the removed one move forward by its length
+    uint32_t length = 0;
+    if (stamp2 > stamp) {
+        length = play->get_time(stamp2-1) - (stamp ? play->get_time(stamp-1) : 0);
+    }
+    play->erase(stamp, stamp2);
 
     for(std::vector<int>::iterator i = positions.begin()+f+1;
                                     i != positions.end(); i++) {
@@ -173,11 +407,8 @@ void MidiLoad::remove_file(std::vector<MidiEvent> *play, int f) {
     }
     positions.erase(positions.begin()+f+1);
     
-    double aTime = 0.0;
-    for(std::vector<MidiEvent>::iterator i = play[0].begin();
-                                    i != play[0].end(); ++i) {
-        (*i).absoluteTime = (*i).deltaTime + aTime;
-        aTime = (*i).absoluteTime;
+    for(size_t i = stamp; i < play->size(); i++) {
+        play->set_time(i, play->get_time(i) - length);
     }
 }
 
@@ -234,43 +465,65 @@ void MidiSave::reset_smf() {
     }    
 }
 
-double MidiSave::get_max_time(std::vector<MidiEvent> *play) noexcept {
-    double ret = 0;
+uint32_t MidiSave::get_max_time(const LoopSnapshot& loops) noexcept {
+    uint32_t ret = 0;
     for (int j = 0; j<16;j++) {
-        if (!play[j].size()) continue;
-        const MidiEvent ev = play[j][play[j].size()-1];
-        if (ev.absoluteTime > ret) ret = ev.absoluteTime;
+        if (!loops.size(j)) continue;
+        if (loops.back_time(j) > ret) ret = loops.back_time(j);
     }
     return ret;
 }
 
-void MidiSave::save_to_file(std::vector<MidiEvent> *play, const char* file_name) {
-    double t[16] = {0.0};
-    double max_time = get_max_time(play);
+// store the song tempo, so that the ticks could be read back unchanged
+void MidiSave::add_tempo(smf_track_t *track, int song_bpm) {
+    const uint32_t mspqn = 60000000 / (song_bpm > 0 ? song_bpm : 120);
+    unsigned char tempo[6] = {0xff, 0x51, 0x03, (unsigned char)((mspqn >> 16) & 0xff),
+                            (unsigned char)((mspqn >> 8) & 0xff), (unsigned char)(mspqn & 0xff)};
+    smf_event = smf_event_new_from_pointer((void*)tempo, 6);
+    if (smf_event == NULL) return;
+    smf_track_add_event_pulses(track, smf_event, 0);
+}
+
+void MidiSave::save_to_file(const LoopSnapshot& loops, int song_bpm, const char* file_name) {
+    smf_set_ppqn(smf, TimeBase::ppqn);
+    uint32_t max_time = get_max_time(loops);
     for (int j = 0; j<16;j++) {
-        for(std::vector<MidiEvent>::const_iterator i = play[j].begin(); i != play[j].end(); ++i) {
-            smf_event = smf_event_new_from_pointer((void*)(*i).buffer, (*i).num);
+        if (!loops.size(j)) continue;
+        const EventStore& play = loops.channel(j);
+        const uint32_t loop_time = play.back_time();
+        uint32_t t = 0;
+        for(size_t i = 0; i < play.size(); i++) {
+            const uint8_t *buffer = play.get_data(i);
+            smf_event = smf_event_new_from_pointer((void*)buffer, EventStore::message_size(buffer[0]));
 
             if (smf_event == NULL) continue;
             if(smf_event->midi_buffer_length < 1) continue;
 
             channel = smf_event->midi_buffer[0] & 0x0F;
 
-            smf_track_add_event_seconds(tracks[channel], smf_event,(*i).deltaTime + t[j]);
-            t[j] += (*i).deltaTime;
+            const uint32_t pulses = t + play.get_time(i);
+            smf_track_add_event_pulses(tracks[channel], smf_event, pulses);
             if (!freewheel) {
-                if (t[j]<max_time && i == play[j].end()-1) {
-                    i = play[j].begin();
+                // repeat shorter loops up to the length of the master loop
+                if (pulses<max_time && i == play.size()-1 && loop_time) {
+                    t += loop_time;
+                    i = 0;
                 } 
-                if ( t[j] >= max_time) {
-                    i = play[j].end()-1;
-                    if (t[j] > max_time) {
+                if ( pulses >= max_time) {
+                    i = play.size()-1;
+                    if (pulses > max_time) {
                         smf_event_remove_from_track(smf_event);
                     }
                 }
             }
         }
     }
+    for (int i = 0; i < 16; i++) {
+        if (tracks[i] != NULL && tracks[i]->number_of_events != 0) {
+            add_tempo(tracks[i], song_bpm);
+            break;
+        }
+    }
     smf_rewind(smf);
 
     for (int i = 0; i < 16; i++) {
@@ -289,6 +542,65 @@ void MidiSave::save_to_file(std::vector<MidiEvent> *play, const char* file_name)
 }
 
 
+/****************************************************************
+ ** class CaptureArena
+ **
+ ** chunked single producer, single consumer ring for recorded events
+ */
+
+CaptureArena::CaptureArena()
+    : head(0),
+    tail(0),
+    overflow(0),
+    wpos(0) {
+    for (uint32_t i = 0; i < chunk_count; i++) fill[i] = 0;
+}
+
+bool CaptureArena::push(const MidiEvent& ev) noexcept {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    // all chunks are sealed and not drained yet
+    if (!wpos && h - tail.load(std::memory_order_acquire) >= chunk_count) {
+        overflow.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    chunk[h % chunk_count][wpos++] = ev;
+    if (wpos < chunk_size) return false;
+    return flush();
+}
+
+bool CaptureArena::flush() noexcept {
+    if (!wpos) return false;
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    fill[h % chunk_count] = wpos;
+    wpos = 0;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+bool CaptureArena::read(std::function<void(const MidiEvent*, uint32_t)> drain) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false;
+    drain(chunk[t % chunk_count], fill[t % chunk_count]);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+bool CaptureArena::empty() const noexcept {
+    return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+}
+
+void CaptureArena::discard() noexcept {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+uint32_t CaptureArena::get_overflow() const noexcept {
+    return overflow.load(std::memory_order_relaxed);
+}
+
+void CaptureArena::reset_overflow() noexcept {
+    overflow.store(0, std::memory_order_relaxed);
+}
+
 /****************************************************************
  ** class MidiRecord
  **
@@ -299,7 +611,6 @@ void MidiSave::save_to_file(std::vector<MidiEvent> *play, const char* file_name)
 MidiRecord::MidiRecord()
     : _execute(false),
     is_sorted(false) {
-    st = NULL;
     channel = 0;
 }
 
@@ -312,7 +623,7 @@ MidiRecord::~MidiRecord() {
 void MidiRecord::stop() {
     _execute.store(false, std::memory_order_release);
     if (_thd.joinable()) {
-        cv.notify_one();
+        sig.notify();
         _thd.join();
     }
 }
@@ -321,38 +632,42 @@ void MidiRecord::start() {
     if( _execute.load(std::memory_order_acquire) ) {
         stop();
     };
+    // chunks left over from a aborted take
+    capture.discard();
+    capture.reset_overflow();
     _execute.store(true, std::memory_order_release);
     _thd = std::thread([this]() {
         while (_execute.load(std::memory_order_acquire)) {
-            std::unique_lock<std::mutex> lk(m);
-            // wait for signal from jack that record vector is ready
-            cv.wait(lk);
-            // reserve space in play vector to push the recorded vector into
-            play[channel].reserve(play[channel].size() + st->size());
-
-            // push recorded vector to play vector
-            for (unsigned int i=0; i<st->size(); i++) 
-                play[channel].push_back((*st)[i]);
-            st->clear();
-
-            // sort vector ascending to absolute time in loop
-            std::sort( play[channel].begin(), play[channel].end(),
-                    [this](const MidiEvent& lhs, const MidiEvent& rhs) {
-                if (lhs.absoluteTime > rhs.absoluteTime)
-                    is_sorted.store(true, std::memory_order_release);
-                return lhs.absoluteTime < rhs.absoluteTime;
-            });
-        }
-        // when record stop, recalculate the delta time for sorted vector
-        double aTime = 0.0;
-        for(std::vector<MidiEvent>::iterator i = play[channel].begin();
-                                        i != play[channel].end(); ++i) {
-            (*i).deltaTime = (*i).absoluteTime - aTime;
-            aTime = (*i).absoluteTime;
+            // wait for signal from jack that a chunk is sealed
+            sig.wait();
+            while (!capture.empty()) drain();
         }
     });
 }
 
+// move all sealed chunks into the loop of the record channel
+void MidiRecord::drain(const MidiEvent *last) {
+    loops.update(channel, [this, last](EventStore& play) {
+        bool inserted = false;
+        // merge the sorted chunks into the sorted loop
+        while (capture.read([&play, &inserted](const MidiEvent *ev, uint32_t n) {
+            inserted |= play.merge(ev, n);
+        }));
+        if (last) inserted |= play.merge(last, 1);
+
+        // tell jack to look up the play position again
+        if (inserted) is_sorted.store(true, std::memory_order_release);
+    });
+}
+
+// stop the record thread and append the closing event
+void MidiRecord::finish(const MidiEvent& ev) {
+    stop();
+    drain(&ev);
+    if (capture.get_overflow())
+        fprintf(stderr, "record buffer overflow, %u events dropped\n", capture.get_overflow());
+}
+
 bool MidiRecord::is_running() const noexcept {
     return ( _execute.load(std::memory_order_acquire) && 
              _thd.joinable() );
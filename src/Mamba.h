@@ -34,8 +34,13 @@ extern "C++" {
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 #include <cmath>
 
+#include "MidiQueue.h"
+#include "RcuSlot.h"
+
 #pragma once
 
 #ifndef MAMBA_H
@@ -44,43 +49,222 @@ extern "C++" {
 namespace mamba {
 
 
+/****************************************************************
+ ** class TimeBase
+ **
+ ** convert between tempo independent loop ticks (ppqn) and jack frames,
+ ** the 32.32 fixed point factors are only recalculated when the tempo
+ ** or the samplerate change
+ */
+
+class TimeBase {
+private:
+    std::mutex m;
+    unsigned int samplerate;
+    double bpm;
+    std::atomic<uint64_t> frames_per_tick;
+    std::atomic<uint64_t> ticks_per_frame;
+    std::atomic<uint32_t> generation;
+    void update() noexcept;
+    static inline uint64_t fixed_mul(uint64_t v, uint64_t f) noexcept {
+        return v * (f >> 32) + ((v * (f & 0xffffffff)) >> 32);
+    }
+
+public:
+    TimeBase();
+    static constexpr uint32_t ppqn = 960;
+    void set_samplerate(unsigned int samplerate) noexcept;
+    void set_bpm(double bpm) noexcept;
+    // changes whenever the conversion factors change
+    inline uint32_t get_generation() const noexcept {
+        return generation.load(std::memory_order_acquire);
+    }
+    inline uint32_t ticks_to_frames(uint32_t ticks) const noexcept {
+        return (uint32_t)fixed_mul(ticks, frames_per_tick.load(std::memory_order_relaxed));
+    }
+    inline uint32_t frames_to_ticks(uint32_t frames) const noexcept {
+        return (uint32_t)fixed_mul(frames, ticks_per_frame.load(std::memory_order_relaxed));
+    }
+    double ticks_to_seconds(uint32_t ticks) noexcept;
+    static inline uint32_t seconds_to_ticks(double seconds, double bpm) noexcept {
+        return seconds > 0.0 ? (uint32_t)std::llround(seconds * bpm * ppqn / 60.0) : 0;
+    }
+};
+
+
 /****************************************************************
  ** struct MidiEvent
  **
- ** store midi events in a vector
+ ** a single midi event, time is in TimeBase ticks
  ** 
  */
 
 typedef struct {
     unsigned char buffer[3];
     int num;
-    double deltaTime;
-    double absoluteTime;
+    uint32_t absoluteTime;
 } MidiEvent;
 
 
 /****************************************************************
- ** class MidiMessenger
+ ** class EventStore
+ **
+ ** packed column store for loop events, the absolute time and the
+ ** midi bytes live in separate arrays (7 bytes per event), so time
+ ** scans only touch the time array. The message length is derived
+ ** from the status byte.
+ */
+
+class EventStore {
+private:
+    std::vector<uint32_t> time;
+    std::vector<uint8_t> data;
+
+public:
+    // 0 for messages which can't be stored (sysex)
+    static inline int message_size(const uint8_t status) noexcept {
+        switch (status & 0xf0) {
+            case 0xC0:
+            case 0xD0:
+                return 2;
+            case 0xF0:
+                if (status == 0xF0 || status == 0xF7) return 0;
+                if (status == 0xF1 || status == 0xF3) return 2;
+                return status == 0xF2 ? 3 : 1;
+            default:
+                return status & 0x80 ? 3 : 0;
+        }
+    }
+    inline size_t size() const noexcept { return time.size(); }
+    inline bool empty() const noexcept { return time.empty(); }
+    inline uint32_t get_time(size_t i) const noexcept { return time[i]; }
+    inline uint32_t back_time() const noexcept { return time.back(); }
+    inline const uint8_t *get_data(size_t i) const noexcept { return &data[i*3]; }
+    inline MidiEvent get(size_t i) const noexcept {
+        const uint8_t *d = &data[i*3];
+        return {{d[0], d[1], d[2]}, message_size(d[0]), time[i]};
+    }
+    inline void set_time(size_t i, uint32_t t) noexcept { time[i] = t; }
+    inline bool is_sorted() const noexcept {
+        return std::is_sorted(time.begin(), time.end());
+    }
+    size_t find_time(uint32_t t) const noexcept;
+    bool push_back(const MidiEvent& ev);
+    void set(size_t i, const MidiEvent& ev) noexcept;
+    void erase(size_t first, size_t last);
+    void reserve(size_t n);
+    void clear() noexcept;
+    void sort();
+    bool merge(const MidiEvent *ev, size_t n);
+    size_t memory_usage() const noexcept;
+};
+
+
+/****************************************************************
+ ** class LoopSnapshot
  **
- ** create, collect and send all midi events to jack_midi out buffer
+ ** immutable view of the loops of all 16 channels, unchanged
+ ** channels are shared between snapshots
  */
 
-class MidiMessenger {
+class LoopSnapshot {
+public:
+    std::shared_ptr<const EventStore> loop[16];
+    inline size_t size(int ch) const noexcept {
+        return loop[ch] ? loop[ch]->size() : 0;
+    }
+    inline MidiEvent at(int ch, size_t i) const noexcept {
+        return loop[ch]->get(i);
+    }
+    inline uint32_t get_time(int ch, size_t i) const noexcept {
+        return loop[ch]->get_time(i);
+    }
+    inline uint32_t back_time(int ch) const noexcept {
+        return loop[ch]->back_time();
+    }
+    const EventStore& channel(int ch) const noexcept;
+};
+
+
+/****************************************************************
+ ** class LoopStore
+ **
+ ** publish loop snapshots RCU style: writers copy, edit and swap in
+ ** a new snapshot under a mutex, the jack thread pick up the current
+ ** one wait free. Replaced snapshots are deleted by the writers once
+ ** the jack thread moved on, so it never free memory.
+ */
+
+class LoopStore {
 private:
-    static const int max_midi_cc_cnt = 25;
-    std::atomic<bool> send_cc[max_midi_cc_cnt];
-    uint8_t cc_num[max_midi_cc_cnt];
-    uint8_t pg_num[max_midi_cc_cnt];
-    uint8_t bg_num[max_midi_cc_cnt];
-    uint8_t me_num[max_midi_cc_cnt];
+    std::mutex m;
+    rcuslot::RcuSlot<LoopSnapshot> snapshots;
+
+public:
+    LoopStore();
+    // jack thread only, the snapshot stay valid until the next call
+    const LoopSnapshot *rt_acquire() noexcept;
+    // non realtime readers
+    LoopSnapshot get_snapshot();
+    // writers
+    void update(int ch, std::function<void(EventStore&)> edit);
+    void update_all(std::function<void(EventStore*)> edit);
+    void set(int ch, EventStore&& loop);
+    void clear(int ch);
+    void clear_all();
+    void reclaim();
+};
+
+
+/****************************************************************
+ ** class MidiMessenger
+ **
+ ** create and collect midi events from the GUI, alsa and the mapper,
+ ** the jack process callback drain them to the jack_midi out buffer
+ */
+
+class MidiMessenger : public midiqueue::MidiQueue<256> {
 public:
     MidiMessenger();
     int channel;
+    // the jack frame time used to stamp queued events
+    std::function<uint32_t() > frame_time;
     bool send_midi_cc(uint8_t _cc, const uint8_t _pg, const uint8_t _bgn,
                     const uint8_t _num, const bool have_channel) noexcept;
-    int next(int i = -1) const noexcept;
-    inline uint8_t size(const int i)  const noexcept { return me_num[i]; }
-    void fill(unsigned char *midi_send, const int i) noexcept;
+};
+
+
+/****************************************************************
+ ** class NoteEventQueue
+ **
+ ** lock free single producer/single consumer ring, pass note on/off
+ ** events from the jack process callback to the GUI thread
+ */
+
+typedef struct {
+    uint8_t channel;
+    uint8_t key;
+    bool on;
+} NoteEvent;
+
+class NoteEventQueue {
+private:
+    // must be a power of two
+    static const uint32_t queue_size = 1024;
+    NoteEvent events[queue_size];
+    std::atomic<uint32_t> write_pos;
+    std::atomic<uint32_t> read_pos;
+    std::atomic<uint32_t> overflows;
+public:
+    NoteEventQueue();
+    bool push(const uint8_t channel, const uint8_t key, const bool on) noexcept;
+    bool pop(NoteEvent *ev) noexcept;
+    inline bool empty() const noexcept {
+        return write_pos.load(std::memory_order_acquire) == read_pos.load(std::memory_order_acquire);
+    }
+    inline uint32_t get_overflows() const noexcept {
+        return overflows.load(std::memory_order_relaxed);
+    }
 };
 
 
@@ -98,17 +282,17 @@ private:
     smf_event_t *smf_event;
     MidiEvent ev;
     void reset_smf();
-    double deltaTime;
-    double absoluteTime;
-    bool load_file(std::vector<MidiEvent> *play, int *song_bpm, const char* file_name);
+    uint32_t absoluteTime;
+    std::vector<double> file_time;
+    bool load_file(EventStore *play, int *song_bpm, const char* file_name);
 
 public:
      MidiLoad();
     ~MidiLoad();
     std::vector<int> positions;
-    bool load_from_file(std::vector<MidiEvent> *play, int *song_bpm, const char* file_name);
-    bool add_from_file(std::vector<MidiEvent> *play, int *song_bpm, const char* file_name);
-    void remove_file(std::vector<MidiEvent> *play, int f);
+    bool load_from_file(EventStore *play, int *song_bpm, const char* file_name);
+    bool add_from_file(EventStore *play, int *song_bpm, const char* file_name);
+    void remove_file(EventStore *play, int f);
 };
 
 
@@ -126,14 +310,51 @@ private:
     smf_event_t *smf_event;
     int channel;
     void reset_smf();
-    double get_max_time(std::vector<MidiEvent> *play) noexcept;
+    uint32_t get_max_time(const LoopSnapshot& loops) noexcept;
+    void add_tempo(smf_track_t *track, int song_bpm);
 
 public:
     MidiSave();
     ~MidiSave();
     int freewheel;
 
-    void save_to_file(std::vector<MidiEvent> *play, const char* file_name);
+    void save_to_file(const LoopSnapshot& loops, int song_bpm, const char* file_name);
+};
+
+
+/****************************************************************
+ ** class CaptureArena
+ **
+ ** preallocated ring of event chunks for the record path. The jack
+ ** thread fill the current chunk and hand it over with a atomic
+ ** store, the record thread drain sealed chunks. When no free chunk
+ ** is left the events are dropped and counted, nothing is allocated.
+ */
+
+class CaptureArena {
+public:
+    static constexpr uint32_t chunk_count = 16;
+    static constexpr uint32_t chunk_size = 256;
+
+private:
+    MidiEvent chunk[chunk_count][chunk_size];
+    uint32_t fill[chunk_count];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> overflow;
+    uint32_t wpos;
+
+public:
+    CaptureArena();
+    // producer, jack thread only, return true when a chunk was sealed
+    bool push(const MidiEvent& ev) noexcept;
+    bool flush() noexcept;
+    // consumer, return false when no sealed chunk is available
+    bool read(std::function<void(const MidiEvent*, uint32_t)> drain);
+    bool empty() const noexcept;
+    void discard() noexcept;
+    uint32_t get_overflow() const noexcept;
+    void reset_overflow() noexcept;
 };
 
 
@@ -148,7 +369,6 @@ class MidiRecord {
 private:
     std::atomic<bool> _execute;
     std::thread _thd;
-    std::mutex m;
 
 public:
     MidiRecord();
@@ -156,12 +376,14 @@ public:
     int channel;
     void stop();
     void start();
+    void finish(const MidiEvent& ev);
+    void drain(const MidiEvent *last = nullptr);
     std::atomic<bool> is_sorted;
     bool is_running() const noexcept;
-    std::condition_variable cv;
-    MidiEvent ev;
-    std::vector<MidiEvent> *st;
-    std::vector<MidiEvent> play[16];
+    // posted by jack when a chunk is sealed
+    midiqueue::QueueSignal sig;
+    CaptureArena capture;
+    LoopStore loops;
 };
 
 
@@ -34,12 +34,15 @@
 namespace midikeyboard {
 
 XKeyBoard::XKeyBoard(xjack::XJack *xjack_, xalsa::XAlsa *xalsa_, xsynth::XSynth *xsynth_,
-        midimapper::MidiMapper *midimap,
+        midimapper::MidiMapper *midimap, miditransform::MidiTransform *mtransform_,
+        velocitycurve::VelocityCurves *vcurves_,
         mamba::MidiMessenger *mmessage_, nsmhandler::NsmSignalHandler& nsmsig_,
         signalhandler::PosixSignalHandler& xsig_, animatedkeyboard::AnimatedKeyBoard * animidi_)
     : xalsa(xalsa_),
     xsynth(xsynth_),
     mmapper(midimap),
+    mtransform(mtransform_),
+    vcurves(vcurves_),
     save(),
     load(),
     mmessage(mmessage_),
@@ -78,7 +81,7 @@ XKeyBoard::XKeyBoard(xjack::XJack *xjack_, xalsa::XAlsa *xalsa_, xsynth::XSynth
     mchannel = 0;
     freewheel = 0;
     lchannels = 0;
-    run_one_more = 0;
+    memset(shown_key_matrix, 0, sizeof(shown_key_matrix));
     need_save = false;
     pitch_scroll = false;
     view_has_changed = false;
@@ -315,6 +318,13 @@ void XKeyBoard::read_config() {
                     buf >> value;
                 }
                 mmapper->kbm_map.push_back(std::stoi(value));
+                mmapper->mmapper_update();
+            } else if (key.compare("[velocity_curve]") == 0) {
+                vcurves->from_string(remove_sub(line, "[velocity_curve] "));
+            } else if (key.compare("[transform_file]") == 0) {
+                std::string error;
+                if (!mtransform->load(remove_sub(line, "[transform_file] "), &error))
+                    fprintf(stderr, "midi transform: %s\n", error.c_str());
             } else if (key.compare("[recent_files]") == 0) recent_files.push_back(remove_sub(line, "[recent_files] "));
             else if (key.compare("[recent_sfonts]") == 0) recent_sfonts.push_back(remove_sub(line, "[recent_sfonts] "));
             key.clear();
@@ -330,7 +340,11 @@ void XKeyBoard::read_config() {
         int word = 0;
         double time = 0;
         std::getline(vinfile, line);
+        // older versions stored the time in seconds
+        const bool legacy = line.find("[PPQN]") == std::string::npos;
+        if (!legacy) std::getline(vinfile, line);
         for (int j = 0; j < 16; j++) {
+            mamba::EventStore play;
             while (std::getline(vinfile, line)) {
                 std::istringstream buf(line);
                 if(line.find("CHANNEL") != std::string::npos) break;
@@ -342,13 +356,14 @@ void XKeyBoard::read_config() {
                 ev.buffer[2] = word;
                 buf >> word;
                 ev.num = word;
+                // the delta column is recomputed on save
                 buf >> time;
-                ev.deltaTime = time;
                 buf >> time;
-                ev.absoluteTime = time;
-                xjack->rec.play[j].push_back(ev);
+                ev.absoluteTime = legacy ? mamba::TimeBase::seconds_to_ticks(time, mbpm) : (uint32_t)time;
+                if (!play.push_back(ev)) continue;
                 looper_channel_matrix[int(ev.buffer[0]&0x0f)].store(1, std::memory_order_release);
             }
+            if (play.size()) xjack->rec.loops.set(j, std::move(play));
         }
         vinfile.close();
     }
@@ -490,6 +505,11 @@ void XKeyBoard::save_config() {
              outfile << " " << mmapper->kbm_map[i];
          }
          outfile << std::endl;
+         for (int i = 0; i < velocitycurve::VEL_COUNT; i++) {
+             outfile << "[velocity_curve] " << vcurves->to_string(i) << std::endl;
+         }
+         if (!mtransform->file.empty())
+             outfile << "[transform_file] " << mtransform->file << std::endl;
 
          for (auto i : recent_files) {
              outfile << "[recent_files] "  << i << std::endl;
@@ -502,11 +522,17 @@ void XKeyBoard::save_config() {
     if (need_save ) {
         std::ofstream outfile(config_file+"vec");
         if (outfile.is_open()) {
+            const mamba::LoopSnapshot loops = xjack->rec.loops.get_snapshot();
+            outfile << "[PPQN] " << mamba::TimeBase::ppqn << std::endl;
             for (int j = 0; j < 16; j++) {
                 outfile << "[CHANNEL" << j << "]"  << std::endl;
-                for(std::vector<mamba::MidiEvent>::const_iterator i = xjack->rec.play[j].begin(); i != xjack->rec.play[j].end(); ++i) {
-                    outfile << (int)(*i).buffer[0] << " " << (int)(*i).buffer[1] << " " 
-                        << (int)(*i).buffer[2] << " " << (*i).num << " " << (*i).deltaTime << " " << (*i).absoluteTime << std::endl;
+                const mamba::EventStore& play = loops.channel(j);
+                uint32_t last = 0;
+                for(size_t i = 0; i < play.size(); i++) {
+                    const mamba::MidiEvent ev = play.get(i);
+                    outfile << (int)ev.buffer[0] << " " << (int)ev.buffer[1] << " " 
+                        << (int)ev.buffer[2] << " " << ev.num << " " << ev.absoluteTime - last << " " << ev.absoluteTime << std::endl;
+                    last = ev.absoluteTime;
                 }
             }
             outfile.close();
@@ -559,7 +585,7 @@ void XKeyBoard::show_ui(int present) {
 
 void XKeyBoard::get_midi_in(int c, int n, bool on) {
     MambaKeyboard *keys = (MambaKeyboard*)wid->parent_struct;
-    mamba_set_key_in_matrix(keys->in_key_matrix[c], n, on);
+    mamba_set_key_in_matrix(&keys->in_key_matrix[c], n, on);
 }
 
 void XKeyBoard::quit_by_jack() {
@@ -702,6 +728,10 @@ void XKeyBoard::init_ui(Xputty *app) {
     view_menu->func.key_release_callback = key_release;
     view_proc = menu_add_check_entry(view_menu, _("Channel/Bank/Instrument"));
     view_controller = menu_add_check_entry(view_menu, _("Controls"));
+    view_dsp_stats = menu_add_check_entry(view_menu, _("DSP Statistics"));
+    view_dsp_stats->func.value_changed_callback = dsp_stats_callback;
+    view_piano_roll = menu_add_check_entry(view_menu, _("Piano Roll"));
+    view_piano_roll->func.value_changed_callback = piano_roll_callback;
     key_size_menu = menu_add_submenu(view_menu,_("Keysize"));
     menu_add_radio_entry(key_size_menu,_("Big"));
     menu_add_radio_entry(key_size_menu,_("Normal"));
@@ -751,6 +781,26 @@ void XKeyBoard::init_ui(Xputty *app) {
     adj_set_value(midi_through->adj, static_cast<float>(xjack->midi_through));
     midi_through->func.value_changed_callback = through_callback;
 
+    menu_add_entry(mapping,_("Load Midi T_ransform"));
+    menu_add_entry(mapping,_("Clear Midi Transform"));
+
+    const char *curve_sources[velocitycurve::VEL_COUNT] = {
+        _("Velocity Keyboard"), _("Velocity Jack"), _("Velocity ALSA"), _("Velocity Mapper")};
+    for (int i = 0; i < velocitycurve::VEL_COUNT; i++) {
+        velocity_curve[i] = menu_add_submenu(mapping, curve_sources[i]);
+        menu_add_radio_entry(velocity_curve[i],_("Linear"));
+        menu_add_radio_entry(velocity_curve[i],_("Soft"));
+        menu_add_radio_entry(velocity_curve[i],_("Hard"));
+        menu_add_radio_entry(velocity_curve[i],_("S-Curve"));
+        menu_add_radio_entry(velocity_curve[i],_("Fixed"));
+        menu_add_radio_entry(velocity_curve[i],_("User Points"));
+        const velocitycurve::Curve c = vcurves->get_curve(i);
+        int value = c.type;
+        if (c.type == velocitycurve::CURVE_EXPONENTIAL) value = c.amount < 1.0f ? 1 : 2;
+        else if (c.type > velocitycurve::CURVE_EXPONENTIAL) value = c.type + 1;
+        adj_set_value(velocity_curve[i]->adj, value);
+        velocity_curve[i]->func.value_changed_callback = velocity_curve_callback;
+    }
 
     connection = menubar_add_menu(menubar,_("C_onnect"));
     inputs = menu_add_submenu(connection,_("Jack input"));
@@ -1069,19 +1119,71 @@ void XKeyBoard::init_ui(Xputty *app) {
 
     init_synth_ui(win);
     init_looper_ui(win);
-    // start the timeout thread for keyboard animation
-    animidi->start(30, std::bind(animate_midi_keyboard,(void*)wid));
+    init_dsp_stats_ui(win);
+    init_piano_roll_ui(win);
+    xsynth->soundfont_loaded = [this] () { animidi->notify(); };
+    // start the thread for keyboard animation, woken by key changes
+    animidi->start(std::bind(animate_midi_keyboard,(void*)wid));
     is_inited.store(true, std::memory_order_release);
 }
 
 // static
-void XKeyBoard::animate_midi_keyboard(void *w_) {
+int XKeyBoard::animate_midi_keyboard(void *w_) {
     Widget_t *w = (Widget_t*)w_;
     MambaKeyboard *keys = (MambaKeyboard*)w->parent_struct;
     XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    // sleep until the next notify() unless something is running
+    int timeout = -1;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    // fetch the note events played by jack into the keyboard matrix
+    xjmkb->xjack->process_note_events();
+    xjmkb->xjack->rec.loops.reclaim();
+
+    // refresh the dsp statistics twice a second
+    if (adj_get_value(xjmkb->view_dsp_stats->adj)) {
+        static std::chrono::steady_clock::time_point stats_time;
+        const int wait = 500 - (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - stats_time).count();
+        if (wait <= 0) {
+            stats_time = now;
+            XLockDisplay(w->app->dpy);
+            expose_widget(xjmkb->dsp_stats_ui);
+            XFlush(w->app->dpy);
+            XUnlockDisplay(w->app->dpy);
+            timeout = 500;
+        } else {
+            timeout = wait;
+        }
+    }
+
+    // report the soundfont load progress, swap it in when loaded
+    const int sf_state = xjmkb->xsynth->get_soundfont_state();
+    if (sf_state == xsynth::XSynth::SF_LOADING) {
+        XLockDisplay(w->app->dpy);
+        xjmkb->show_soundfont_progress();
+        XFlush(w->app->dpy);
+        XUnlockDisplay(w->app->dpy);
+        timeout = timeout < 0 ? 200 : min(timeout, 200);
+    } else if (sf_state != xsynth::XSynth::SF_IDLE) {
+        XLockDisplay(w->app->dpy);
+        xjmkb->soundfont_loaded();
+        XFlush(w->app->dpy);
+        XUnlockDisplay(w->app->dpy);
+    }
+
+    // look for changed loops twice a second, the index is build in the background
+    if (adj_get_value(xjmkb->view_piano_roll->adj)) {
+        xjmkb->roll.update(xjmkb->xjack->rec.loops.get_snapshot());
+        if (xjmkb->roll.take_changed()) {
+            XLockDisplay(w->app->dpy);
+            expose_widget(xjmkb->piano_roll_ui);
+            XFlush(w->app->dpy);
+            XUnlockDisplay(w->app->dpy);
+        }
+        timeout = timeout < 0 ? 500 : min(timeout, 500);
+    }
 
-    if (xjmkb->xjack->transport_state_changed.load(std::memory_order_acquire)) {
-        xjmkb->xjack->transport_state_changed.store(false, std::memory_order_release);
+    if (xjmkb->xjack->transport_state_changed.exchange(false, std::memory_order_acq_rel)) {
         XLockDisplay(w->app->dpy);
         xjmkb->play->func.adj_callback = dummy_callback;
         adj_set_value(xjmkb->play->adj,
@@ -1092,8 +1194,7 @@ void XKeyBoard::animate_midi_keyboard(void *w_) {
         XUnlockDisplay(w->app->dpy);
     }
 
-    if (xjmkb->xjack->bpm_changed.load(std::memory_order_acquire)) {
-        xjmkb->xjack->bpm_changed.store(false, std::memory_order_release);
+    if (xjmkb->xjack->bpm_changed.exchange(false, std::memory_order_acq_rel)) {
         XLockDisplay(w->app->dpy);
         xjmkb->bpm->func.adj_callback = dummy_callback;
         adj_set_value(xjmkb->bpm->adj,
@@ -1106,8 +1207,10 @@ void XKeyBoard::animate_midi_keyboard(void *w_) {
 
     if ((xjmkb->xjack->record.load(std::memory_order_acquire) ||
             xjmkb->xjack->play.load(std::memory_order_acquire)) && !xjmkb->xjack->freewheel) {
-        static int scip = 8;
-        if (scip >= 8) {
+        // the time line run 4 times a second
+        static std::chrono::steady_clock::time_point line_time;
+        const int wait = 240 - (int)std::chrono::duration_cast<std::chrono::milliseconds>(now - line_time).count();
+        if (wait <= 0) {
             XLockDisplay(w->app->dpy);
             if ( xjmkb->xjack->play.load(std::memory_order_acquire) && xjmkb->xjack->get_max_loop_time() > 0.0) {
                 snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", 
@@ -1122,33 +1225,37 @@ void XKeyBoard::animate_midi_keyboard(void *w_) {
             }
             xjmkb->time_line->label = xjmkb->time_line->input_label;
             expose_widget(xjmkb->time_line);
+            // move the play head
+            if (adj_get_value(xjmkb->view_piano_roll->adj))
+                expose_widget(xjmkb->piano_roll_ui);
             XFlush(w->app->dpy);
             XUnlockDisplay(w->app->dpy);
-            scip = 0;
-        }
-        scip++;
-        if (xjmkb->xjack->record_off.load(std::memory_order_acquire)) {
-            xjmkb->xjack->record_off.store(false, std::memory_order_release);
-            XLockDisplay(w->app->dpy);
-            xjmkb->record->func.adj_callback = dummy_callback;
-            adj_set_value(xjmkb->record->adj, 0.0);
-            expose_widget(xjmkb->record);
-            XFlush(w->app->dpy);
-            xjmkb->record->func.adj_callback = transparent_draw;
-            XUnlockDisplay(w->app->dpy);
+            line_time = now;
         }
+        const int next = wait <= 0 ? 240 : wait;
+        timeout = timeout < 0 ? next : min(timeout, next);
     }
 
-    bool repeat = mamba_need_redraw(keys);
-    if ((repeat || xjmkb->run_one_more) && xjmkb->xjack->client) {
+    // the take reached the loop length, jack raise the flag once
+    if (xjmkb->xjack->record_off.exchange(false, std::memory_order_acq_rel) &&
+                                                    !xjmkb->xjack->freewheel) {
+        XLockDisplay(w->app->dpy);
+        xjmkb->record->func.adj_callback = dummy_callback;
+        adj_set_value(xjmkb->record->adj, 0.0);
+        expose_widget(xjmkb->record);
+        XFlush(w->app->dpy);
+        xjmkb->record->func.adj_callback = transparent_draw;
+        XUnlockDisplay(w->app->dpy);
+    }
+
+    // the keyboard redraw only the keys which changed
+    if (mamba_need_redraw(keys, xjmkb->shown_key_matrix) && xjmkb->xjack->client) {
         XLockDisplay(w->app->dpy);
         expose_widget(w);
         XFlush(w->app->dpy);
         XUnlockDisplay(w->app->dpy);
-        if (repeat)
-            xjmkb->run_one_more = 10;
     }
-    xjmkb->run_one_more = max(0,xjmkb->run_one_more-1);
+    return timeout;
 }
 
 // static
@@ -1331,6 +1438,17 @@ void XKeyBoard::get_alsa_port_menu() {
         menu_remove_item(menu,view_port->childlist->childs[i]);
     }
 
+    // rawmidi hardware ports are listed as "hw:card,device,subdevice name"
+    std::vector<std::string> raw_ports;
+    std::vector<std::string> raw_oports;
+    xalsa->raw.xrawmidi_get_ports(&raw_ports, &raw_oports);
+    alsa_ports.insert(alsa_ports.end(), raw_ports.begin(), raw_ports.end());
+    alsa_oports.insert(alsa_oports.end(), raw_oports.begin(), raw_oports.end());
+    xalsa->raw.xrawmidi_get_iconnections(&raw_ports);
+    xalsa->raw.xrawmidi_get_oconnections(&raw_oports);
+    alsa_connections.insert(alsa_connections.end(), raw_ports.begin(), raw_ports.end());
+    alsa_oconnections.insert(alsa_oconnections.end(), raw_oports.begin(), raw_oports.end());
+
     for(std::vector<std::string>::const_iterator i = alsa_ports.begin(); i != alsa_ports.end(); ++i) {
         Widget_t *entry = menu_add_check_entry(alsa_inputs,(*i).c_str());
         for(std::vector<std::string>::const_iterator j = alsa_connections.begin(); j != alsa_connections.end(); ++j) {
@@ -1404,6 +1522,18 @@ void XKeyBoard::alsa_connection_callback(void *w_, void* user_data) {
     Widget_t *view_port =  menu->childlist->childs[0];
     int i = (int)adj_get_value(w->adj);
     Widget_t *entry = view_port->childlist->childs[i];
+    if (strncmp(entry->label, "hw:", 3) == 0) {
+        std::string id;
+        std::istringstream buf(entry->label);
+        buf >> id;
+        if (adj_get_value(entry->adj)) {
+            if (!XKeyBoard::get_instance(w)->xalsa->raw.xrawmidi_connect(id))
+                adj_set_value(entry->adj, 0.0);
+        } else {
+            XKeyBoard::get_instance(w)->xalsa->raw.xrawmidi_disconnect(id);
+        }
+        return;
+    }
     int client = -1;
     int port = -1;
     std::istringstream buf(entry->label);
@@ -1424,6 +1554,18 @@ void XKeyBoard::alsa_oconnection_callback(void *w_, void* user_data) {
     Widget_t *view_port =  menu->childlist->childs[0];
     int i = (int)adj_get_value(w->adj);
     Widget_t *entry = view_port->childlist->childs[i];
+    if (strncmp(entry->label, "hw:", 3) == 0) {
+        std::string id;
+        std::istringstream buf(entry->label);
+        buf >> id;
+        if (adj_get_value(entry->adj)) {
+            if (!XKeyBoard::get_instance(w)->xalsa->raw.xrawmidi_oconnect(id))
+                adj_set_value(entry->adj, 0.0);
+        } else {
+            XKeyBoard::get_instance(w)->xalsa->raw.xrawmidi_odisconnect(id);
+        }
+        return;
+    }
     int client = -1;
     int port = -1;
     std::istringstream buf(entry->label);
@@ -1465,7 +1607,8 @@ void XKeyBoard::unmap_callback(void *w_, void* user_data) noexcept{
 void XKeyBoard::get_note(Widget_t *w, const int *key, const bool on_off) noexcept{
     XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
     if (on_off) {
-        xjmkb->mmessage->send_midi_cc(0x90, (*key),xjmkb->velocity, 3, false);
+        xjmkb->mmessage->send_midi_cc(0x90, (*key),
+            xjmkb->vcurves->map(velocitycurve::VEL_GUI, xjmkb->velocity), 3, false);
     } else {
         xjmkb->mmessage->send_midi_cc(0x80, (*key),xjmkb->velocity, 3, false);
     }
@@ -1531,26 +1674,31 @@ void XKeyBoard::dialog_load_response(void *w_, void* user_data) {
         float play = adj_get_value(xjmkb->play->adj);
         adj_set_value(xjmkb->play->adj,0.0);
         adj_set_value(xjmkb->record->adj,0.0);
-        if (!xjmkb->load.load_from_file(&xjmkb->xjack->rec.play[0], &xjmkb->song_bpm, *(const char**)user_data)) {
+        mamba::EventStore play_file;
+        if (!xjmkb->load.load_from_file(&play_file, &xjmkb->song_bpm, *(const char**)user_data)) {
             Widget_t *dia = open_message_dialog(xjmkb->win, ERROR_BOX, *(const char**)user_data, 
             _("Couldn't load file, is that a MIDI file?"),NULL);
             XSetTransientForHint(xjmkb->win->app->dpy, dia->widget, xjmkb->win->widget);
         } else {
             for ( int i = 0; i < 16; i++) xjmkb->looper_channel_matrix[i].store(0, std::memory_order_release);
             if (xjmkb->xsynth->synth_is_active()) {
-                for(std::vector<mamba::MidiEvent>::iterator i = xjmkb->xjack->rec.play[0].begin(); i != xjmkb->xjack->rec.play[0].end(); ++i) {
-                    if (((*i).buffer[0] & 0xf0) == 0xB0 && ((*i).buffer[1]== 32 || (*i).buffer[1]== 0)) {
-                        xjmkb->mmessage->send_midi_cc((*i).buffer[0], (*i).buffer[1], (*i).buffer[2], 3, true);
-                    } else if (((*i).buffer[0] & 0xf0) == 0xC0 ) {
-                        xjmkb->mmessage->send_midi_cc((*i).buffer[0], (*i).buffer[1], 0, 2, true);
+                for(size_t i = 0; i < play_file.size(); i++) {
+                    const uint8_t *d = play_file.get_data(i);
+                    if ((d[0] & 0xf0) == 0xB0 && (d[1]== 32 || d[1]== 0)) {
+                        xjmkb->mmessage->send_midi_cc(d[0], d[1], d[2], 3, true);
+                    } else if ((d[0] & 0xf0) == 0xC0 ) {
+                        xjmkb->mmessage->send_midi_cc(d[0], d[1], 0, 2, true);
                     }
-                    xjmkb->looper_channel_matrix[int((*i).buffer[0]&0x0f)].store(1, std::memory_order_release);
+                    xjmkb->looper_channel_matrix[int(d[0]&0x0f)].store(1, std::memory_order_release);
                 }
             }
             xjmkb->recent_file_manager(*(char**)user_data);
             std::string file(basename(*(char**)user_data));
-            for(int i = 1;i<16;i++)
-                xjmkb->xjack->rec.play[i].clear();
+            xjmkb->xjack->rec.loops.update_all([&play_file](mamba::EventStore* play) {
+                play[0] = std::move(play_file);
+                for(int i = 1;i<16;i++)
+                    play[i].clear();
+            });
             xjmkb->file_names.clear();
             xjmkb->file_names.push_back(file);
             xjmkb->filepath = dirname(*(char**)user_data);
@@ -1587,11 +1735,23 @@ void XKeyBoard::dialog_add_response(void *w_, void* user_data) {
         //float play = adj_get_value(xjmkb->play->adj);
         //adj_set_value(xjmkb->play->adj,0.0);
         adj_set_value(xjmkb->record->adj,0.0);
-        if (!xjmkb->load.add_from_file(&xjmkb->xjack->rec.play[0], &xjmkb->song_bpm, *(const char**)user_data)) {
+        // parse outside of the loop store lock, the file start at tick 0
+        mamba::EventStore play_file;
+        if (!xjmkb->load.add_from_file(&play_file, &xjmkb->song_bpm, *(const char**)user_data)) {
             Widget_t *dia = open_message_dialog(xjmkb->win, ERROR_BOX, *(const char**)user_data, 
             _("Couldn't load file, is that a MIDI file?"),NULL);
             XSetTransientForHint(xjmkb->win->app->dpy, dia->widget, xjmkb->win->widget);
         } else {
+            // append it behind the loop, as add_from_file() did in place
+            xjmkb->xjack->rec.loops.update(0, [&play_file](mamba::EventStore& play) {
+                const uint32_t offset = play.empty() ? 0 : play.back_time();
+                play.reserve(play.size() + play_file.size());
+                for (size_t i = 0; i < play_file.size(); i++) {
+                    mamba::MidiEvent ev = play_file.get(i);
+                    ev.absoluteTime += offset;
+                    play.push_back(ev);
+                }
+            });
             xjmkb->recent_file_manager(*(char**)user_data);
             std::string file(basename(*(char**)user_data));
             xjmkb->file_names.push_back(file);
@@ -1629,7 +1789,7 @@ void XKeyBoard::dialog_save_response(void *w_, void* user_data) {
         const char* fn = filename.data();
         adj_set_value(xjmkb->play->adj,0.0);
         adj_set_value(xjmkb->record->adj,0.0);
-        xjmkb->save.save_to_file(xjmkb->xjack->rec.play, fn);
+        xjmkb->save.save_to_file(xjmkb->xjack->rec.loops.get_snapshot(), xjmkb->song_bpm, fn);
     }
 }
 
@@ -1666,7 +1826,9 @@ void XKeyBoard::file_remove_callback(void *w_, void* user_data) {
     //float play = adj_get_value(xjmkb->play->adj);
     //adj_set_value(xjmkb->play->adj,0.0);
     adj_set_value(xjmkb->record->adj,0.0);
-    xjmkb->load.remove_file(&xjmkb->xjack->rec.play[0], value);
+    xjmkb->xjack->rec.loops.update(0, [xjmkb, value](mamba::EventStore& play) {
+        xjmkb->load.remove_file(&play, value);
+    });
     snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
     xjmkb->time_line->label = xjmkb->time_line->input_label;
     expose_widget(xjmkb->time_line);
@@ -1918,6 +2080,7 @@ void XKeyBoard::scala_kbm_load_response(void *w_, void* user_data) {
                 oc += _kbm.map_size;
         }
         _scale.close();
+        xjmkb->mmapper->mmapper_update();
         adj_set_value(xjmkb->midi_map->adj, 1.0);
     }
 }
@@ -1928,12 +2091,6 @@ void XKeyBoard::synth_load_response(void *w_, void* user_data) {
     std::string synth_instance = xjmkb->xjack->client_name;
     std::transform(synth_instance.begin(), synth_instance.end(), synth_instance.begin(), ::tolower);
     if(user_data !=NULL) {
-        float play = adj_get_value(xjmkb->play->adj);
-        //adj_set_value(xjmkb->play->adj,0.0);
-        if ((int)play &&  xjmkb->xsynth->synth_is_active()) {
-            xjmkb->xsynth->unload_synth();
-        }
-         
         if( access(*(const char**)user_data, F_OK ) == -1 ) {
             Widget_t *dia = open_message_dialog(xjmkb->win, ERROR_BOX, *(const char**)user_data, 
             _("Couldn't access file, sorry"),NULL);
@@ -1946,61 +2103,91 @@ void XKeyBoard::synth_load_response(void *w_, void* user_data) {
             XSetTransientForHint(xjmkb->win->app->dpy, dia->widget, xjmkb->win->widget);
             return;
         }
-        if(xjmkb->fs_instruments) {
-            combobox_delete_entrys(xjmkb->fs_instruments);
-        }
         if (!xjmkb->xsynth->synth_is_active()) {
             xjmkb->xsynth->setup(xjmkb->xjack->SampleRate, synth_instance.c_str());
             xjmkb->xsynth->init_synth();
             check_edo_mapfile(xjmkb, xjmkb->get_edo_steps());
             xjmkb->init_modulators(xjmkb);
         }
-        if (xjmkb->xsynth->load_soundfont( *(const char**)user_data)) {
+        // the current soundfont keep playing while the new one is loaded
+        const int ret = xjmkb->xsynth->load_soundfont_async( *(const char**)user_data);
+        if (ret) {
             Widget_t *dia = open_message_dialog(xjmkb->win, ERROR_BOX, *(const char**)user_data, 
-            _("Couldn't load file, is that a soundfont file?"),NULL);
+            ret < 0 ? _("Couldn't start fluidsynth, sorry") :
+            _("A soundfont is still loading, please wait"),NULL);
             XSetTransientForHint(xjmkb->win->app->dpy, dia->widget, xjmkb->win->widget);
             return;
         }
-        xjmkb->recent_sfont_manager(*(const char**)user_data);
-        xjmkb->rebuild_instrument_list();
-        xjmkb->soundfont =  *(const char**)user_data;
-        xjmkb->soundfontname =  basename(*(char**)user_data);
-        xjmkb->soundfontpath = dirname(*(char**)user_data);
+        xjmkb->loading_soundfont = *(const char**)user_data;
+        xjmkb->show_soundfont_progress();
+        xjmkb->animidi->notify();
+    }
+}
+
+void XKeyBoard::show_soundfont_progress() {
+    std::string file = loading_soundfont;
+    std::string title = _("Fluidsynth - loading ");
+    title += basename(&file[0]);
+    title += " " + std::to_string(xsynth->get_load_progress()) + "%";
+    widget_set_title(synth_ui, title.c_str());
+}
+
+// called from the animation thread with the display locked
+void XKeyBoard::soundfont_loaded() {
+    std::string synth_instance = xjack->client_name;
+    std::transform(synth_instance.begin(), synth_instance.end(), synth_instance.begin(), ::tolower);
+    std::string file = loading_soundfont;
+    if (xsynth->swap_soundfont()) {
+        Widget_t *dia = open_message_dialog(win, ERROR_BOX, file.c_str(), 
+        _("Couldn't load file, is that a soundfont file?"),NULL);
+        XSetTransientForHint(win->app->dpy, dia->widget, win->widget);
         std::string title = _("Fluidsynth - ");
-        title += xjmkb->soundfontname;
-        widget_set_title(xjmkb->synth_ui, title.c_str());
-        expose_widget(xjmkb->fs_instruments);
-        expose_widget(xjmkb->fs_soundfont);
-        const char **port_list = NULL;
-        port_list = jack_get_ports(xjmkb->xjack->client, NULL, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput);
-        if (port_list) {
-            synth_instance.append(":");
-            for (int i = 0; port_list[i] != NULL; i++) {
-                if (strstr(port_list[i], synth_instance.c_str())) {
-                    if (!jack_port_connected_to(xjmkb->xjack->out_port, port_list[i])) {
-                        const char *my_port = jack_port_name(xjmkb->xjack->out_port);
-                        jack_connect(xjmkb->xjack->client, my_port,port_list[i]);
-                    }
-                    break;
+        title += soundfontname;
+        widget_set_title(synth_ui, title.c_str());
+        return;
+    }
+    if(fs_instruments) {
+        combobox_delete_entrys(fs_instruments);
+    }
+    recent_sfont_manager(file.c_str());
+    rebuild_instrument_list();
+    soundfont = file;
+    soundfontname = basename(&file[0]);
+    soundfontpath = dirname(&file[0]);
+    std::string title = _("Fluidsynth - ");
+    title += soundfontname;
+    widget_set_title(synth_ui, title.c_str());
+    expose_widget(fs_instruments);
+    expose_widget(fs_soundfont);
+    const char **port_list = NULL;
+    port_list = jack_get_ports(xjack->client, NULL, JACK_DEFAULT_MIDI_TYPE, JackPortIsInput);
+    if (port_list) {
+        synth_instance.append(":");
+        for (int i = 0; port_list[i] != NULL; i++) {
+            if (strstr(port_list[i], synth_instance.c_str())) {
+                if (!jack_port_connected_to(xjack->out_port, port_list[i])) {
+                    const char *my_port = jack_port_name(xjack->out_port);
+                    jack_connect(xjack->client, my_port,port_list[i]);
                 }
+                break;
             }
-            jack_free(port_list);
-            port_list = NULL;
         }
-        XWindowAttributes attrs;
-        XGetWindowAttributes(xjmkb->win->app->dpy, (Window)xjmkb->synth_ui->widget, &attrs);
-        if (attrs.map_state == IsViewable) {
-            widget_show_all(xjmkb->fs_instruments);
-        }
-        for (int i = 0; i<16;i++)
-            xjmkb->mmessage->send_midi_cc(0xB0 | i, 7, xjmkb->volume[i], 3, true);
-        xjmkb->fs[0]->state = 0;
-        xjmkb->fs[1]->state = 0;
-        xjmkb->fs[2]->state = 0;
-        xjmkb->fs[3]->state = 0;
-        xjmkb->rebuild_soundfont_list();
-        xjmkb->build_sfont_menu();
+        jack_free(port_list);
+        port_list = NULL;
+    }
+    XWindowAttributes attrs;
+    XGetWindowAttributes(win->app->dpy, (Window)synth_ui->widget, &attrs);
+    if (attrs.map_state == IsViewable) {
+        widget_show_all(fs_instruments);
     }
+    for (int i = 0; i<16;i++)
+        mmessage->send_midi_cc(0xB0 | i, 7, volume[i], 3, true);
+    fs[0]->state = 0;
+    fs[1]->state = 0;
+    fs[2]->state = 0;
+    fs[3]->state = 0;
+    rebuild_soundfont_list();
+    build_sfont_menu();
 }
 
 //static
@@ -2104,9 +2291,10 @@ void XKeyBoard::channel_callback(void *w_, void* user_data) noexcept{
     MambaKeyboard *keys = (MambaKeyboard*)xjmkb->wid->parent_struct;
     if (xjmkb->xjack->play.load(std::memory_order_acquire)) {
         for (int i = 0; i<16;i++) 
-            mamba_clear_key_matrix(keys->in_key_matrix[i]);
+            mamba_clear_key_matrix(&keys->in_key_matrix[i]);
     }
     xjmkb->xjack->rec.channel = xjmkb->mmessage->channel = keys->channel = xjmkb->mchannel = (int)adj_get_value(w->adj);
+    expose_widget(xjmkb->wid);
     if(xjmkb->xsynth->synth_is_active()) {
         adj_set_value(xjmkb->w[3]->adj, xjmkb->attack[xjmkb->mchannel]);
         adj_set_value(xjmkb->w[4]->adj, xjmkb->release[xjmkb->mchannel]);
@@ -2169,7 +2357,7 @@ void XKeyBoard::bpm_callback(void *w_, void* user_data) noexcept{
     Widget_t *w = (Widget_t*)w_;
     XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
     xjmkb->mbpm = (int)adj_get_value(w->adj);
-    xjmkb->xjack->bpm_ratio = (double)xjmkb->song_bpm/(double)xjmkb->mbpm;
+    xjmkb->xjack->timebase.set_bpm(xjmkb->mbpm);
 }
 
 // static
@@ -2192,7 +2380,15 @@ void XKeyBoard::midi_cc_channel_callback(void *w_, void* user_data) noexcept{
 void XKeyBoard::velocity_callback(void *w_, void* user_data) noexcept{
     Widget_t *w = (Widget_t*)w_;
     int value = (int)adj_get_value(w->adj);
-    XKeyBoard::get_instance(w)->velocity = value; 
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    xjmkb->velocity = value; 
+    // fixed curves follow the velocity knob
+    for (int i = 0; i < velocitycurve::VEL_COUNT; i++) {
+        velocitycurve::Curve c = xjmkb->vcurves->get_curve(i);
+        if (c.type != velocitycurve::CURVE_FIXED || c.amount == value) continue;
+        c.amount = value;
+        xjmkb->vcurves->set_curve(i, c);
+    }
 }
 
 // static
@@ -2248,26 +2444,26 @@ void XKeyBoard::sustain_callback(void *w_, void* user_data) noexcept{
     xjmkb->mmessage->send_midi_cc(0xB0 | xjmkb->mchannel, 64, xjmkb->sustain[xjmkb->mchannel]*127, 3, true);
 }
 
-void XKeyBoard::find_next_beat_time(double *absoluteTime) {
-    const double beat = 60.0/(double)mbpm;
-    int beats = std::round(((*absoluteTime)/beat));
-    (*absoluteTime) = (double)beats*beat;
+void XKeyBoard::find_next_beat_time(uint32_t *absoluteTime) {
+    const uint32_t beat = mamba::TimeBase::ppqn;
+    uint32_t beats = ((*absoluteTime) + beat/2)/beat;
+    (*absoluteTime) = beats*beat;
 }
 
-void XKeyBoard::find_previus_beat_time(double *absoluteTime) {
-    const double beat = 60.0/(double)mbpm;
-    int beats = std::round((((*absoluteTime)-beat)/beat));
-    (*absoluteTime) = (double)beats*beat;
+void XKeyBoard::find_previus_beat_time(uint32_t *absoluteTime) {
+    const uint32_t beat = mamba::TimeBase::ppqn;
+    uint32_t beats = (*absoluteTime) > beat ? ((*absoluteTime) - beat/2)/beat : 0;
+    (*absoluteTime) = beats*beat;
 }
 
 inline int XKeyBoard::get_min_time_vector() noexcept {
     int v = -1;
-    double min_loop_time = xjack->get_max_loop_time();
+    uint32_t min_loop_time = xjack->get_max_loop_ticks();
+    const mamba::LoopSnapshot loops = xjack->rec.loops.get_snapshot();
     for (int j = 0; j<16;j++) {
-        if (!xjack->rec.play[j].size()) continue;
-        const mamba::MidiEvent ev = xjack->rec.play[j][3];
-        if (ev.absoluteTime < min_loop_time) {
-            min_loop_time = ev.absoluteTime;
+        if (loops.size(j) < 4) continue;
+        if (loops.get_time(j, 3) < min_loop_time) {
+            min_loop_time = loops.get_time(j, 3);
             v = j;
         }
     }
@@ -2275,8 +2471,10 @@ inline int XKeyBoard::get_min_time_vector() noexcept {
 }
 
 inline int XKeyBoard::get_min_time_event(int v) noexcept{
-    for(std::vector<mamba::MidiEvent>::iterator i = xjack->rec.play[v].begin(); i != xjack->rec.play[v].end(); ++i) {
-        if ((*i).absoluteTime > 0.0) return std::distance(xjack->rec.play[v].begin(), i);
+    const mamba::LoopSnapshot loops = xjack->rec.loops.get_snapshot();
+    const mamba::EventStore& play = loops.channel(v);
+    for(size_t i = 0; i < play.size(); i++) {
+        if (play.get_time(i) > 0) return i;
     }
     return 0;
 }
@@ -2290,18 +2488,17 @@ void XKeyBoard::clips_time(void *w_, void* user_data) noexcept{
         int v = xjmkb->get_min_time_vector();
         if (v > -1) {
             int m = xjmkb->get_min_time_event(v);
-            const mamba::MidiEvent ev = xjmkb->xjack->rec.play[v][m];
-            double absoluteTime = ev.absoluteTime; // seconds
-            const double beat = 60.0/(double)xjmkb->mbpm;
+            uint32_t absoluteTime = xjmkb->xjack->rec.loops.get_snapshot().get_time(v, m); // ticks
+            const uint32_t beat = mamba::TimeBase::ppqn;
             if ( absoluteTime >= beat) {
-
-                for (int j = 0; j < 16; j++) {
-                    for(std::vector<mamba::MidiEvent>::iterator i = xjmkb->xjack->rec.play[j].begin(); i != xjmkb->xjack->rec.play[j].end(); ++i) {
-                        if ((*i).absoluteTime && ((*i).absoluteTime == (*i).deltaTime)) {
-                            if ((*i).deltaTime) (*i).deltaTime -= beat;
-                        } else if ((*i).absoluteTime) (*i).absoluteTime -= beat;
+                xjmkb->xjack->rec.loops.update_all([beat](mamba::EventStore* play) {
+                    for (int j = 0; j < 16; j++) {
+                        for(size_t i = 0; i < play[j].size(); i++) {
+                            const uint32_t t = play[j].get_time(i);
+                            play[j].set_time(i, t - min(t, beat));
+                        }
                     }
-                }
+                });
 
                 snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
                 xjmkb->time_line->label = xjmkb->time_line->input_label;
@@ -2321,15 +2518,15 @@ void XKeyBoard::claps_time(void *w_, void* user_data) noexcept{
     if (value > 0) {
         int v = xjmkb->get_min_time_vector();
         if (v > -1) {
-            const double beat = 60.0/(double)xjmkb->mbpm;
-            for (int j = 0; j < 16; j++) {
-                for(std::vector<mamba::MidiEvent>::iterator i = xjmkb->xjack->rec.play[j].begin(); i != xjmkb->xjack->rec.play[j].end(); ++i) {
-                    if (i == xjmkb->xjack->rec.play[j].begin()+2) {
-                        if ((*i).deltaTime) (*i).deltaTime += beat;
+            const uint32_t beat = mamba::TimeBase::ppqn;
+            xjmkb->xjack->rec.loops.update_all([beat](mamba::EventStore* play) {
+                for (int j = 0; j < 16; j++) {
+                    for(size_t i = 0; i < play[j].size(); i++) {
+                        const uint32_t t = play[j].get_time(i);
+                        if (t) play[j].set_time(i, t + beat);
                     }
-                    if ((*i).absoluteTime) (*i).absoluteTime += beat;
                 }
-            }
+            });
             snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
             xjmkb->time_line->label = xjmkb->time_line->input_label;
             expose_widget(xjmkb->time_line);
@@ -2341,12 +2538,12 @@ void XKeyBoard::claps_time(void *w_, void* user_data) noexcept{
 
 inline int XKeyBoard::get_max_time_vector() noexcept {
     int v = -1;
-    double max_loop_time = 0.0;
+    uint32_t max_loop_time = 0;
+    const mamba::LoopSnapshot loops = xjack->rec.loops.get_snapshot();
     for (int j = 0; j<16;j++) {
-        if (!xjack->rec.play[j].size()) continue;
-        const mamba::MidiEvent ev = xjack->rec.play[j][xjack->rec.play[j].size()-1];
-        if (ev.absoluteTime > max_loop_time) {
-            max_loop_time = ev.absoluteTime;
+        if (!loops.size(j)) continue;
+        if (loops.back_time(j) > max_loop_time) {
+            max_loop_time = loops.back_time(j);
             v = j;
         }
     }
@@ -2361,14 +2558,18 @@ void XKeyBoard::clip_time(void *w_, void* user_data) noexcept{
     if (value > 0) {
         int v = xjmkb->get_max_time_vector();
         if (v > -1) {
-            const mamba::MidiEvent ev = xjmkb->xjack->rec.play[v][xjmkb->xjack->rec.play[v].size()-1];
-            const mamba::MidiEvent prev = xjmkb->xjack->rec.play[v][xjmkb->xjack->rec.play[v].size()-2];
-            double deltaTime = ev.deltaTime; // seconds
-            double absoluteTime = ev.absoluteTime; // seconds
-            const double beat = 60.0/(double)xjmkb->mbpm;
-            if ( absoluteTime-beat > prev.absoluteTime) {
-                mamba::MidiEvent nev = {{0x80, 0, 0}, 3, deltaTime-beat, absoluteTime-beat};
-                xjmkb->xjack->rec.play[v][xjmkb->xjack->rec.play[v].size()-1] = nev;
+            bool clipped = false;
+            xjmkb->xjack->rec.loops.update(v, [&clipped](mamba::EventStore& play) {
+                if (play.size() < 2) return;
+                uint32_t absoluteTime = play.back_time(); // ticks
+                const uint32_t beat = mamba::TimeBase::ppqn;
+                if ( absoluteTime > play.get_time(play.size()-2) + beat) {
+                    mamba::MidiEvent nev = {{0x80, 0, 0}, 3, absoluteTime-beat};
+                    play.set(play.size()-1, nev);
+                    clipped = true;
+                }
+            });
+            if (clipped) {
                 snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
                 xjmkb->time_line->label = xjmkb->time_line->input_label;
                 expose_widget(xjmkb->time_line);
@@ -2387,12 +2588,13 @@ void XKeyBoard::clap_time(void *w_, void* user_data) noexcept{
     if (value > 0) {
         int v = xjmkb->get_max_time_vector();
         if (v > -1) {
-            const mamba::MidiEvent ev = xjmkb->xjack->rec.play[v][xjmkb->xjack->rec.play[v].size()-1];
-            double deltaTime = ev.deltaTime; // seconds
-            double absoluteTime = ev.absoluteTime; // seconds
-            const double beat = 60.0/(double)xjmkb->mbpm;
-            mamba::MidiEvent nev = {{0x80, 0, 0}, 3, deltaTime+beat, absoluteTime+beat};
-            xjmkb->xjack->rec.play[v][xjmkb->xjack->rec.play[v].size()-1] = nev;
+            xjmkb->xjack->rec.loops.update(v, [](mamba::EventStore& play) {
+                if (!play.size()) return;
+                uint32_t absoluteTime = play.back_time(); // ticks
+                const uint32_t beat = mamba::TimeBase::ppqn;
+                mamba::MidiEvent nev = {{0x80, 0, 0}, 3, absoluteTime+beat};
+                play.set(play.size()-1, nev);
+            });
             snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
             xjmkb->time_line->label = xjmkb->time_line->input_label;
             expose_widget(xjmkb->time_line);
@@ -2409,6 +2611,8 @@ void XKeyBoard::record_callback(void *w_, void* user_data) {
     if (!xjmkb->xjack->play.load(std::memory_order_acquire)) return;
     int value = (int)adj_get_value(w->adj);
     xjmkb->xjack->record.store(value, std::memory_order_release);
+    // start the time line
+    xjmkb->animidi->notify();
     if (value > 0) {
         std::string tittle = xjmkb->client_name + _(" - Virtual Midi Keyboard");
         widget_set_title(xjmkb->win, tittle.c_str());
@@ -2416,34 +2620,29 @@ void XKeyBoard::record_callback(void *w_, void* user_data) {
         snprintf(xjmkb->songbpm->input_label, 31,_("File BPM: %d"),  (int) xjmkb->song_bpm);
         xjmkb->songbpm->label = xjmkb->songbpm->input_label;
         expose_widget(xjmkb->songbpm);
-        xjmkb->xjack->store1.clear();
-        xjmkb->xjack->store2.clear();
         int c = xjmkb->mchannel;
         if (xjmkb->mchannel>15) {
             xjmkb->xjack->rec.channel = xjmkb->mmessage->channel = c = 0;
         }
         xjmkb->looper_channel_matrix[c].store(1, std::memory_order_release);
         expose_widget(xjmkb->looper_control);
-        xjmkb->xjack->rec.play[c].clear();
+        xjmkb->xjack->rec.loops.clear(c);
         xjmkb->xjack->fresh_take = true;
         xjmkb->xjack->rec.start();
         xjmkb->need_save = true;
     } else if ( xjmkb->xjack->rec.is_running()) {
-        if (xjmkb->xjack->rec.st == &xjmkb->xjack->store1 && xjmkb->xjack->store2.size()) {
-            xjmkb->xjack->rec.st = &xjmkb->xjack->store2;
-        } else {
-            xjmkb->xjack->rec.st = &xjmkb->xjack->store1;
-        }
+        // give jack a few periods to hand over the last chunk
+        for (int i = 0; i < 100 && !xjmkb->xjack->capture_flushed.load(std::memory_order_acquire); i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         jack_nframes_t stop = jack_last_frame_time(xjmkb->xjack->client);
-        double deltaTime = (double)(((stop) - xjmkb->xjack->start)/(double)xjmkb->xjack->SampleRate); // seconds
-        double absoluteTime = (double)(((stop) - xjmkb->xjack->absoluteStart)/(double)xjmkb->xjack->SampleRate); // seconds
-        if(!xjmkb->xjack->get_max_loop_time() && !xjmkb->freewheel)
+        uint32_t absoluteTime = xjmkb->xjack->timebase.frames_to_ticks(stop - xjmkb->xjack->absoluteStart);
+        const uint32_t max_loop_ticks = xjmkb->xjack->get_max_loop_ticks();
+        if(!max_loop_ticks && !xjmkb->freewheel)
             xjmkb->find_next_beat_time(&absoluteTime);
-        else if (xjmkb->xjack->get_max_loop_time() && !xjmkb->freewheel)
-            absoluteTime = xjmkb->xjack->get_max_loop_time();
-        mamba::MidiEvent ev = {{0x80, 0, 0}, 3, deltaTime, absoluteTime};
-        xjmkb->xjack->rec.st->push_back(ev);
-        xjmkb->xjack->rec.stop();
+        else if (max_loop_ticks && !xjmkb->freewheel)
+            absoluteTime = max_loop_ticks;
+        mamba::MidiEvent ev = {{0x80, 0, 0}, 3, absoluteTime};
+        xjmkb->xjack->rec.finish(ev);
         xjmkb->xjack->record_finished.store(1, std::memory_order_release);
         snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
         xjmkb->time_line->label = xjmkb->time_line->input_label;
@@ -2460,12 +2659,14 @@ void XKeyBoard::play_callback(void *w_, void* user_data) noexcept{
     if (value < 1) {
         MambaKeyboard *keys = (MambaKeyboard*)xjmkb->wid->parent_struct;
         for (int i = 0; i<16;i++) 
-            mamba_clear_key_matrix(keys->in_key_matrix[i]);
+            mamba_clear_key_matrix(&keys->in_key_matrix[i]);
         xjmkb->mmessage->send_midi_cc(0xB0, 123, 0, 3, false);
         if (xjmkb->xsynth->synth_is_active()) xjmkb->xsynth->panic();
         xjmkb->xjack->first_play = true;
+        expose_widget(xjmkb->wid);
     } else {
         if (adj_get_value(xjmkb->record->adj)) xjmkb->record_callback(xjmkb->record, NULL);
+        xjmkb->animidi->notify();
     }
     snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
     xjmkb->time_line->label = xjmkb->time_line->input_label;
@@ -2481,12 +2682,14 @@ void XKeyBoard::pause_callback(void *w_, void* user_data) noexcept{
     if (value < 1) {
         MambaKeyboard *keys = (MambaKeyboard*)xjmkb->wid->parent_struct;
         for (int i = 0; i<16;i++) 
-            mamba_clear_key_matrix(keys->in_key_matrix[i]);
+            mamba_clear_key_matrix(&keys->in_key_matrix[i]);
         xjmkb->mmessage->send_midi_cc(0xB0, 123, 0, 3, false);
         if (xjmkb->xsynth->synth_is_active()) xjmkb->xsynth->panic();
+        expose_widget(xjmkb->wid);
     } else {
        xjmkb->xjack->second_play = true; 
         if (adj_get_value(xjmkb->record->adj)) xjmkb->record_callback(xjmkb->record, NULL);
+        xjmkb->animidi->notify();
     }
 }
 
@@ -2536,10 +2739,10 @@ void XKeyBoard::clear_all_loops_callback(XKeyBoard *xjmkb) noexcept{
     //adj_set_value(xjmkb->play->adj, 0.0);
     //set_play_label(xjmkb->play,NULL);
     //adj_set_value(xjmkb->record->adj, 0.0);
+    xjmkb->xjack->rec.loops.clear_all();
     for (int i = 0; i<16;i++) 
-        xjmkb->xjack->rec.play[i].clear();
-    for (int i = 0; i<16;i++) 
-        mamba_clear_key_matrix(keys->in_key_matrix[i]);
+        mamba_clear_key_matrix(&keys->in_key_matrix[i]);
+    expose_widget(xjmkb->wid);
     xjmkb->file_names.clear();
     xjmkb->build_remove_menu();
     xjmkb->load.positions.clear();
@@ -2550,7 +2753,7 @@ void XKeyBoard::clear_all_loops_callback(XKeyBoard *xjmkb) noexcept{
     xjmkb->mbpm = (int)adj_get_value(xjmkb->bpm->adj);
     snprintf(xjmkb->songbpm->input_label, 31,_("File BPM: %d"),  (int) xjmkb->song_bpm);
     xjmkb->songbpm->label = xjmkb->songbpm->input_label;
-    xjmkb->xjack->bpm_ratio = (double)xjmkb->song_bpm/(double)xjmkb->mbpm;
+    xjmkb->xjack->timebase.set_bpm(xjmkb->mbpm);
     expose_widget(xjmkb->songbpm);
     snprintf(xjmkb->time_line->input_label, 31,"%.2f sec", xjmkb->xjack->get_max_loop_time());
     xjmkb->time_line->label = xjmkb->time_line->input_label;
@@ -2573,10 +2776,11 @@ void XKeyBoard::clear_loops_callback(void *w_, void* user_data) noexcept{
             xjmkb->build_remove_menu();
             xjmkb->load.positions.clear();
         }
-        xjmkb->xjack->rec.play[xjmkb->xjack->rec.channel].clear();
+        xjmkb->xjack->rec.loops.clear(xjmkb->xjack->rec.channel);
         xjmkb->looper_channel_matrix[xjmkb->xjack->rec.channel].store(0, std::memory_order_release);
         expose_widget(xjmkb->looper_control);
-        mamba_clear_key_matrix(keys->in_key_matrix[xjmkb->xjack->rec.channel]);
+        mamba_clear_key_matrix(&keys->in_key_matrix[xjmkb->xjack->rec.channel]);
+        expose_widget(xjmkb->wid);
         xjmkb->mmessage->send_midi_cc(0xB0 | xjmkb->xjack->rec.channel, 123, 0, 3, true);
         xjmkb->need_save = true;
     }
@@ -2632,7 +2836,8 @@ void XKeyBoard::view_channels_callback(void *w_, void* user_data) noexcept{
     if (xjmkb->lchannels) {
         MambaKeyboard *keys = (MambaKeyboard*)xjmkb->wid->parent_struct;
         for (int i = 0; i<16;i++) 
-            mamba_clear_key_matrix(keys->in_key_matrix[i]);
+            mamba_clear_key_matrix(&keys->in_key_matrix[i]);
+        expose_widget(xjmkb->wid);
     }
 }
 
@@ -2640,9 +2845,59 @@ void XKeyBoard::view_channels_callback(void *w_, void* user_data) noexcept{
 void XKeyBoard::keymap_callback(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
     XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
-    if ((int)adj_get_value(w->adj) == 2)
+    const int value = (int)adj_get_value(w->adj);
+    if (value == 2) {
         open_custom_keymap(xjmkb->wid, xjmkb->win, xjmkb->keymap,
             (int)adj_get_value(xjmkb->fs_edo->adj), xjmkb->get_edo_steps(), xjmkb->multikeymap_file.c_str());
+    } else if (value == 6) {
+        Widget_t *dia = open_file_dialog(xjmkb->win, xjmkb->filepath.c_str(), ".mtx");
+        XSetTransientForHint(xjmkb->win->app->dpy, dia->widget, xjmkb->win->widget);
+        XResizeWindow(xjmkb->win->app->dpy, dia->widget, 760, 565);
+        xjmkb->win->func.dialog_callback = transform_load_response;
+    } else if (value == 7) {
+        xjmkb->mtransform->clear();
+    }
+}
+
+// static
+void XKeyBoard::velocity_curve_callback(void *w_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    int source = 0;
+    while (source < velocitycurve::VEL_COUNT && xjmkb->velocity_curve[source] != w) source++;
+    if (source >= velocitycurve::VEL_COUNT) return;
+    velocitycurve::Curve c = xjmkb->vcurves->get_curve(source);
+    switch ((int)adj_get_value(w->adj)) {
+        case(0): c.type = velocitycurve::CURVE_LINEAR; c.amount = 1.0f; break;
+        case(1): c.type = velocitycurve::CURVE_EXPONENTIAL; c.amount = 0.5f; break;
+        case(2): c.type = velocitycurve::CURVE_EXPONENTIAL; c.amount = 2.0f; break;
+        case(3): c.type = velocitycurve::CURVE_SCURVE; c.amount = 2.0f; break;
+        // fixed to the velocity knob value
+        case(4): c.type = velocitycurve::CURVE_FIXED; c.amount = xjmkb->velocity; break;
+        case(5):
+            // there is no editor yet, the points come from the config,
+            // start with a soft knee
+            c.type = velocitycurve::CURVE_POINTS;
+            if (c.points.empty()) c.points = {0, 0, 64, 80, 127, 127};
+            break;
+        default: return;
+    }
+    // the jack thread pick up the new table with the next period
+    xjmkb->vcurves->set_curve(source, c);
+}
+
+// static
+void XKeyBoard::transform_load_response(void *w_, void* user_data) {
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w_);
+    if(user_data !=NULL) {
+        std::string error;
+        // the jack thread pick up the new rule set with the next period
+        if (!xjmkb->mtransform->load(*(const char**)user_data, &error)) {
+            Widget_t *dia = open_message_dialog(xjmkb->win, ERROR_BOX, *(const char**)user_data, 
+            error.c_str(),NULL);
+            XSetTransientForHint(xjmkb->win->app->dpy, dia->widget, xjmkb->win->widget);
+        }
+    }
 }
 
 // static
@@ -3110,6 +3365,7 @@ int XKeyBoard::get_edo_steps() {
     if (selected_edo.compare("12ji") == 0) return 12;
     else if (selected_edo.compare("12edo") == 0) return 12;
     else if (selected_edo.compare("Scala") == 0) return xsynth->scala_size;
+    else if (selected_edo.find("edo") != std::string::npos) return std::stoi(selected_edo);
     return 12;
 }
 
@@ -3186,14 +3442,10 @@ void XKeyBoard::init_synth_ui(Widget_t *parent) {
     tmp->func.key_release_callback = key_release;
 
     fs_edo = add_combobox(synth_ui, _("edo"), 540, 10, 90, 30);
-    combobox_add_entry(fs_edo, "12ji");
-    /*fs_edo->flags |= NO_AUTOREPEAT | NO_PROPAGATE;
-    for (unsigned int i = 10; i < 24; i++) {
-        std::string key = std::to_string(i)+"edo";
-        combobox_add_entry(fs_edo, key.c_str());
-    }*/
-    combobox_add_entry(fs_edo, "12edo");
-    combobox_add_entry(fs_edo, "Scala");
+    // the entry index is the tuning program
+    for (const std::string& name : xsynth->tuning_names) {
+        combobox_add_entry(fs_edo, name.c_str());
+    }
     combobox_set_active_entry(fs_edo, 1);
     fs_edo->childlist->childs[0]->flags |= NO_AUTOREPEAT | NO_PROPAGATE;
     fs_edo->func.value_changed_callback = edo_callback;
@@ -3311,6 +3563,19 @@ void XKeyBoard::init_synth_ui(Widget_t *parent) {
 
 /******************* Looper Controls *****************/
 
+// the colour of a channel, as used by the keyboard
+static void set_channel_color(cairo_t *cr, int i, double alpha) {
+    double ci = ((i+1)/100.0)*12.0;
+    if (i<4)
+        cairo_set_source_rgba(cr, ci, 0.2, 0.4, alpha);
+    else if (i<8)
+        cairo_set_source_rgba(cr, 0.6, 0.2+ci-0.48, 0.4, alpha);
+    else if (i<12)
+        cairo_set_source_rgba(cr, 0.6-(ci-0.96), 0.68-(ci-1.08), 0.4, alpha);
+    else
+        cairo_set_source_rgba(cr, 0.12+(ci-1.56), 0.32, 0.4-(ci-1.44), alpha);
+}
+
 void XKeyBoard::draw_looper_ui(void *w_, void* user_data)  noexcept{
     Widget_t *w = (Widget_t*)w_;
     XWindowAttributes attrs;
@@ -3321,15 +3586,7 @@ void XKeyBoard::draw_looper_ui(void *w_, void* user_data)  noexcept{
     cairo_paint (w->crb);
     widget_set_scale(w);
     for(int i = 0;i<16;i++) {
-        double ci = ((i+1)/100.0)*12.0;
-        if (i<4)
-            cairo_set_source_rgba(w->crb, ci, 0.2, 0.4, 1.00);
-        else if (i<8)
-            cairo_set_source_rgba(w->crb, 0.6, 0.2+ci-0.48, 0.4, 1.00);
-        else if (i<12)
-            cairo_set_source_rgba(w->crb, 0.6-(ci-0.96), 0.68-(ci-1.08), 0.4, 1.00);
-        else
-            cairo_set_source_rgba(w->crb, 0.12+(ci-1.56), 0.32, 0.4-(ci-1.44), 1.00);
+        set_channel_color(w->crb, i, 1.0);
         cairo_rectangle(w->crb, 10+(i*25), 0, 25, 25);
         cairo_fill_preserve(w->crb);
         if (xjmkb->looper_channel_matrix[i].load(std::memory_order_acquire)) {
@@ -3395,6 +3652,166 @@ void XKeyBoard::init_looper_ui(Widget_t *parent) {
     }
 }
 
+/******************* DSP Statistics *****************/
+
+// static
+void XKeyBoard::dsp_stats_callback(void *w_, void* user_data) noexcept{
+    Widget_t *w = (Widget_t*)w_;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    xjmkb->show_dsp_stats_ui((int)adj_get_value(w->adj));
+    xjmkb->animidi->notify();
+}
+
+//static
+void XKeyBoard::dsp_stats_hide_callback(void *w_, void* user_data)  noexcept{
+    Widget_t *w = (Widget_t*)w_;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    adj_set_value(xjmkb->view_dsp_stats->adj, 0.0);
+}
+
+void XKeyBoard::draw_dsp_stats_ui(void *w_, void* user_data)  noexcept{
+    Widget_t *w = (Widget_t*)w_;
+    XWindowAttributes attrs;
+    XGetWindowAttributes(w->app->dpy, (Window)w->widget, &attrs);
+    if (attrs.map_state != IsViewable) return;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    set_pattern(w,&w->app->color_scheme->selected,&w->app->color_scheme->normal,BACKGROUND_);
+    cairo_paint (w->crb);
+    if (!xjmkb->xjack->client) return;
+    std::istringstream report(xjmkb->xjack->stats.report(jack_cpu_load(xjmkb->xjack->client)));
+    use_text_color_scheme(w, NORMAL_);
+    cairo_select_font_face (w->crb, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size (w->crb, 11);
+    std::string line;
+    int y = 18;
+    while (std::getline(report, line)) {
+        cairo_move_to (w->crb, 10, y);
+        cairo_show_text(w->crb, line.c_str());
+        y += 15;
+    }
+}
+
+void XKeyBoard::show_dsp_stats_ui(int present) {
+    if(present) {
+        widget_show_all(dsp_stats_ui);
+    } else {
+        widget_hide(dsp_stats_ui);
+    }
+}
+
+void XKeyBoard::init_dsp_stats_ui(Widget_t *parent) {
+    dsp_stats_ui = create_window(parent->app, DefaultRootWindow(parent->app->dpy), 0, 0, 480, 160);
+    XSelectInput(parent->app->dpy, dsp_stats_ui->widget,StructureNotifyMask|ExposureMask|KeyPressMask 
+                    |KeyReleaseMask);
+    XSetTransientForHint(parent->app->dpy, dsp_stats_ui->widget, parent->widget);
+    std::string title = _("DSP Statistics");
+    widget_set_title(dsp_stats_ui, title.c_str());
+    dsp_stats_ui->flags |= NO_AUTOREPEAT | HIDE_ON_DELETE;
+    dsp_stats_ui->func.expose_callback = draw_dsp_stats_ui;
+    dsp_stats_ui->parent = parent;
+    dsp_stats_ui->parent_struct = this;
+    dsp_stats_ui->func.key_press_callback = key_press;
+    dsp_stats_ui->func.key_release_callback = key_release;
+    dsp_stats_ui->func.unmap_notify_callback = dsp_stats_hide_callback;
+}
+
+/******************* Piano Roll *****************/
+
+// static
+void XKeyBoard::piano_roll_callback(void *w_, void* user_data) noexcept{
+    Widget_t *w = (Widget_t*)w_;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    xjmkb->show_piano_roll_ui((int)adj_get_value(w->adj));
+    xjmkb->animidi->notify();
+}
+
+//static
+void XKeyBoard::piano_roll_hide_callback(void *w_, void* user_data)  noexcept{
+    Widget_t *w = (Widget_t*)w_;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    adj_set_value(xjmkb->view_piano_roll->adj, 0.0);
+}
+
+// draw the notes of all loops, loops with more notes than pixel columns
+// are drawn per column as key range from the density index
+void XKeyBoard::draw_piano_roll_ui(void *w_, void* user_data)  noexcept{
+    Widget_t *w = (Widget_t*)w_;
+    XWindowAttributes attrs;
+    XGetWindowAttributes(w->app->dpy, (Window)w->widget, &attrs);
+    if (attrs.map_state != IsViewable) return;
+    XKeyBoard *xjmkb = XKeyBoard::get_instance(w);
+    const int width = attrs.width;
+    const int height = attrs.height;
+    set_pattern(w,&w->app->color_scheme->selected,&w->app->color_scheme->normal,BACKGROUND_);
+    cairo_paint (w->crb);
+    std::shared_ptr<const pianoroll::RollIndex> index = xjmkb->roll.get();
+    const pianoroll::Density range = index->range();
+    if (!index->length || range.low > range.high) return;
+    const double key_h = (double)height / (range.high - range.low + 1);
+    const double tick_w = (double)width / index->length;
+
+    for (int ch = 0; ch < 16; ch++) {
+        const pianoroll::ChannelRoll *roll = index->channel[ch].get();
+        if (!roll || roll->spans.empty()) continue;
+        if (roll->spans.size() <= (size_t)width) {
+            set_channel_color(w->crb, ch, 0.9);
+            for (const pianoroll::NoteSpan& s : roll->spans) {
+                const double l = (s.end - s.start) * tick_w;
+                cairo_rectangle(w->crb, s.start * tick_w, (range.high - s.key) * key_h,
+                                l > 1.0 ? l : 1.0, key_h > 2.0 ? key_h - 1.0 : 1.0);
+            }
+            cairo_fill(w->crb);
+        } else {
+            for (int x = 0; x < width; x++) {
+                const pianoroll::Density d = roll->density(
+                    (uint64_t)index->length * x / width, (uint64_t)index->length * (x + 1) / width);
+                if (!d.count) continue;
+                // more notes in a column give a stronger colour
+                set_channel_color(w->crb, ch, d.count > 7 ? 1.0 : 0.3 + d.count * 0.1);
+                cairo_rectangle(w->crb, x, (range.high - d.high) * key_h,
+                                1.0, (d.high - d.low + 1) * key_h);
+                cairo_fill(w->crb);
+            }
+        }
+    }
+
+    if (xjmkb->xjack->play.load(std::memory_order_acquire)) {
+        const uint32_t pos = xjmkb->xjack->timebase.frames_to_ticks(
+                                xjmkb->xjack->stPlay - xjmkb->xjack->stStart) % index->length;
+        use_fg_color_scheme(w, NORMAL_);
+        cairo_set_line_width(w->crb, 1.0);
+        cairo_move_to(w->crb, pos * tick_w + 0.5, 0);
+        cairo_line_to(w->crb, pos * tick_w + 0.5, height);
+        cairo_stroke(w->crb);
+    }
+}
+
+void XKeyBoard::show_piano_roll_ui(int present) {
+    if(present) {
+        widget_show_all(piano_roll_ui);
+        roll.start();
+    } else {
+        widget_hide(piano_roll_ui);
+    }
+}
+
+void XKeyBoard::init_piano_roll_ui(Widget_t *parent) {
+    piano_roll_ui = create_window(parent->app, DefaultRootWindow(parent->app->dpy), 0, 0, 700, 240);
+    XSelectInput(parent->app->dpy, piano_roll_ui->widget,StructureNotifyMask|ExposureMask|KeyPressMask 
+                    |KeyReleaseMask);
+    XSetTransientForHint(parent->app->dpy, piano_roll_ui->widget, parent->widget);
+    std::string title = _("Piano Roll");
+    widget_set_title(piano_roll_ui, title.c_str());
+    piano_roll_ui->flags |= NO_AUTOREPEAT | HIDE_ON_DELETE;
+    piano_roll_ui->func.expose_callback = draw_piano_roll_ui;
+    piano_roll_ui->parent = parent;
+    piano_roll_ui->parent_struct = this;
+    piano_roll_ui->func.key_press_callback = key_press;
+    piano_roll_ui->func.key_release_callback = key_release;
+    piano_roll_ui->func.unmap_notify_callback = piano_roll_hide_callback;
+    roll.ready = [this] () { animidi->notify(); };
+}
+
 /******************* Exit handlers ********************/
 
 void XKeyBoard::signal_handle (int sig) {
@@ -54,7 +54,9 @@
 #include "XJack.h"
 #include "XAlsa.h"
 #include "MidiMapper.h"
+#include "PianoRoll.h"
 #include "xwidgets.h"
+#include "xmkeyboard.h"
 #include "xfile-dialog.h"
 #include "xmessage-dialog.h"
 #include "XSynth.h"
@@ -83,6 +85,8 @@ private:
     xalsa::XAlsa *xalsa;
     xsynth::XSynth *xsynth;
     midimapper::MidiMapper *mmapper;
+    miditransform::MidiTransform *mtransform;
+    velocitycurve::VelocityCurves *vcurves;
     mamba::MidiSave save;
     mamba::MidiLoad load;
     mamba::MidiMessenger *mmessage;
@@ -103,12 +107,15 @@ private:
     Widget_t *filemenu;
     Widget_t *looper;
     Widget_t *looper_control;
+    Widget_t *dsp_stats_ui;
+    Widget_t *piano_roll_ui;
     Widget_t *view_channels;
     Widget_t *free_wheel;
     Widget_t *lmc;
     Widget_t *info;
     Widget_t *mapping;
     Widget_t *keymap;
+    Widget_t *velocity_curve[velocitycurve::VEL_COUNT];
     Widget_t *connection;
     Widget_t *inputs;
     Widget_t *outputs;
@@ -131,6 +138,8 @@ private:
     Widget_t *proc_box;
     Widget_t *view_menu;
     Widget_t *view_controller;
+    Widget_t *view_dsp_stats;
+    Widget_t *view_piano_roll;
     Widget_t *view_proc;
     Widget_t *key_size_menu;
     Widget_t *grab_keyboard;
@@ -164,7 +173,8 @@ private:
     int octave;
     int mchannel;
     int freewheel;
-    int run_one_more;
+    // the input keys as seen by the animation thread
+    MambaKeySet shown_key_matrix[16];
     int lchannels;
     bool need_save;
     bool pitch_scroll;
@@ -212,6 +222,8 @@ private:
     static void grab_callback(void *w_, void* user_data);
     static void through_callback(void *w_, void* user_data);
     static void midi_map_callback(void *w_, void* user_data);
+    static void transform_load_response(void *w_, void* user_data);
+    static void velocity_curve_callback(void *w_, void* user_data);
     static void synth_callback(void *w_, void* user_data);
     static void record_callback(void *w_, void* user_data);
     static void play_callback(void *w_, void* user_data) noexcept;
@@ -222,7 +234,7 @@ private:
     static void clear_loops_callback(void *w_, void* user_data) noexcept;
     static void clear_all_loops_callback(XKeyBoard *xjmkb) noexcept;
     static void view_channels_callback(void *w_, void* user_data) noexcept;
-    static void animate_midi_keyboard(void *w_);
+    static int animate_midi_keyboard(void *w_);
     static void dialog_save_response(void *w_, void* user_data);
     static void dnd_load_response(void *w_, void* user_data);
 
@@ -274,6 +286,18 @@ private:
     void show_looper_ui(int present);
     void init_looper_ui(Widget_t *parent);
 
+    static void dsp_stats_callback(void *w_, void* user_data) noexcept;
+    static void dsp_stats_hide_callback(void *w_, void* user_data)  noexcept;
+    static void draw_dsp_stats_ui(void *w_, void* user_data)  noexcept;
+    void show_dsp_stats_ui(int present);
+    void init_dsp_stats_ui(Widget_t *parent);
+
+    static void piano_roll_callback(void *w_, void* user_data) noexcept;
+    static void piano_roll_hide_callback(void *w_, void* user_data)  noexcept;
+    static void draw_piano_roll_ui(void *w_, void* user_data)  noexcept;
+    void show_piano_roll_ui(int present);
+    void init_piano_roll_ui(Widget_t *parent);
+
     Widget_t *mamba_add_keyboard_knob(Widget_t *parent, const char * label,
                                 int x, int y, int width, int height);
     Widget_t *mamba_add_keyboard_button(Widget_t *parent, const char * label,
@@ -285,8 +309,8 @@ private:
     void get_port_entrys(Widget_t *parent, jack_port_t *my_port,
                                                 JackPortFlags type);
     int remove_low_dash(char *str) noexcept;
-    void find_next_beat_time(double *absoluteTime);
-    void find_previus_beat_time(double *absoluteTime);
+    void find_next_beat_time(uint32_t *absoluteTime);
+    void find_previus_beat_time(uint32_t *absoluteTime);
     void get_alsa_port_menu();
     void nsm_show_ui();
     void nsm_hide_ui();
@@ -301,7 +325,8 @@ private:
     void build_sfont_menu();
 public:
     XKeyBoard(xjack::XJack *xjack, xalsa::XAlsa *xalsa, xsynth::XSynth *xsynth,
-        midimapper::MidiMapper *midimap,
+        midimapper::MidiMapper *midimap, miditransform::MidiTransform *mtransform,
+        velocitycurve::VelocityCurves *vcurves,
         mamba::MidiMessenger *mmessage, nsmhandler::NsmSignalHandler& nsmsig,
         signalhandler::PosixSignalHandler& xsig, animatedkeyboard::AnimatedKeyBoard * animidi);
     ~XKeyBoard();
@@ -316,6 +341,8 @@ public:
     std::string soundfont;
     std::string selected_edo;
     std::atomic<int> looper_channel_matrix[16];
+    // note index for the piano roll view of the loops
+    pianoroll::RollBuilder roll;
 
     bool has_config;
     Widget_t *win;
@@ -343,6 +370,11 @@ public:
 
     static void dialog_load_response(void *w_, void* user_data);
     static void synth_load_response(void *w_, void* user_data);
+    // show the progress of a soundfont load, swap it in once loaded
+    void show_soundfont_progress();
+    void soundfont_loaded();
+    // the soundfont file in load
+    std::string loading_soundfont;
     static void scala_load_response(void *w_, void* user_data);
     static void scala_kbm_load_response(void *w_, void* user_data);
     static void init_modulators(XKeyBoard* xjmkb);
@@ -24,70 +24,20 @@
 namespace midimapper {
 
 
-/****************************************************************
- ** class MidiMapperMessenger
- **
- ** collect all midi events from jack_midi and send to MidiMapper
- */
-
-MidiMapperMessenger::MidiMapperMessenger() {
-    channel = 0;
-    for (int i = 0; i < max_midi_cc_cnt; i++) {
-        send_cc[i] = false;
-    }
-}
-
-int MidiMapperMessenger::next(int i) const noexcept {
-    while (++i < max_midi_cc_cnt) {
-        if (send_cc[i].load(std::memory_order_acquire)) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-void MidiMapperMessenger::fill(uint8_t *event, const int i) noexcept {
-    if (size(i) == 3) {
-        event[2] =  bg_num[i]; // velocity
-    }
-    event[1] = pg_num[i];    // program value
-    event[0] = cc_num[i];    // controller+ channel
-    send_cc[i].store(false, std::memory_order_release);
-}
-
-bool MidiMapperMessenger::send_midi_cc(const uint8_t *midi_get,
-                                    const uint8_t _num) noexcept {
-    for(int i = 0; i < max_midi_cc_cnt; i++) {
-        if (send_cc[i].load(std::memory_order_acquire)) {
-            if (cc_num[i] == midi_get[0] && pg_num[i] == midi_get[1] &&
-                bg_num[i] == midi_get[2] && me_num[i] == _num)
-                return true;
-        } else if (!send_cc[i].load(std::memory_order_acquire)) {
-            cc_num[i] = midi_get[0];
-            pg_num[i] = midi_get[1];
-            bg_num[i] = midi_get[2];
-            me_num[i] = _num;
-            send_cc[i].store(true, std::memory_order_release);
-            return true;
-        }
-    }
-    return false;
-}
-
-
 /****************************************************************
  ** class MidiMapper
  **
- ** map jack midi input to jack midi output via maaping matrix
+ ** map midi input to jack midi output via mapping matrix
  */
 
 MidiMapper::MidiMapper(std::function<void(
         int _cc, int _pg, int _bgn, int _num, bool have_channel) > 
         send_to_jack_) 
     :send_to_jack(send_to_jack_),
-    mmessage(),
+    rebuild(false),
     _execute_map(false) {
     setup_default_kbm_map();
+    tables.publish(build_table(kbm_map));
 }
 
 
@@ -103,16 +53,51 @@ void MidiMapper::mmapper_set_priority(int priority) {
 
 void MidiMapper::mmapper_stop() {
     _execute_map.store(false, std::memory_order_release);
+    sig_map.notify();
     if (_thd_map.joinable()) {
         _thd_map.join();
     }
 }
 
+KbmTable *MidiMapper::build_table(const std::vector<int>& map) const {
+    KbmTable *table = new KbmTable();
+    for (int i = 0; i < 128; i++) {
+        const int note = i < (int)map.size() ? map[i] : i;
+        table->note[i] = (note >= 0 && note < 128) ? uint8_t(note) : 0xff;
+    }
+    return table;
+}
+
+const KbmTable *MidiMapper::rt_acquire() noexcept {
+    return tables.rt_acquire();
+}
+
+void MidiMapper::mmapper_update() {
+    if (!is_running()) {
+        KbmTable *table = build_table(kbm_map);
+        std::lock_guard<std::mutex> lk(m);
+        tables.publish(table);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(m);
+        pending = kbm_map;
+        rebuild = true;
+    }
+    sig_map.notify();
+}
+
 void MidiMapper::mmapper_input_notify(const uint8_t *midi_get, uint8_t num) noexcept {
-    if (is_running()) {
-        if (mmessage.send_midi_cc(midi_get, num))
-            cv_map.notify_one();
+    uint8_t note;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        note = tables.get()->note[midi_get[1] & 0x7f];
     }
+    if (note > 127) return;
+    const uint8_t status = midi_get[0] & 0xf0;
+    const uint8_t channel = midi_get[0] & 0x0f;
+    send_to_jack(midi_get[0], note, num > 2 ? midi_get[2] : 0, num, true);
+    if (set_key) set_key(channel, note, status == 0x90 && num > 2 && midi_get[2]);
 }
 
 void MidiMapper::setup_default_kbm_map() {
@@ -122,40 +107,30 @@ void MidiMapper::setup_default_kbm_map() {
     }
 }
 
-void MidiMapper::mmapper_start(std::function<void(int,int,bool)> set_key) {
+void MidiMapper::mmapper_start(std::function<void(int,int,bool)> set_key_) {
     if( _execute_map.load(std::memory_order_acquire) ) {
         mmapper_stop();
     };
+    set_key = set_key_;
     _execute_map.store(true, std::memory_order_release);
-    _thd_map = std::thread([this, set_key]() {
+    _thd_map = std::thread([this]() {
         sched_param sch;
         sch.sched_priority = prio;
         pthread_setschedparam(_thd_map.native_handle(), SCHED_FIFO, &sch);
-        uint8_t event[3] = {0};
+        std::vector<int> map;
         while (_execute_map.load(std::memory_order_acquire)) {
-            std::unique_lock<std::mutex> lk(m);
-            cv_map.wait(lk);
-            //do output
-            if (_execute_map.load(std::memory_order_acquire)) {
-                int i = mmessage.next();
-                while ( i>=0) {
-                    mmessage.fill(event, i);
-                    uint8_t channel = event[0]&0x0f;
-                    uint8_t num = event[0] & 0xf0;
-                    uint8_t note = event[1];
-                    uint8_t velocity = event[2];
-                    // do mapping here
-                    if (kbm_map[int(note)]<128) {
-                        note = uint8_t(kbm_map[int(note)]);
-                        send_to_jack(num | channel, note, velocity, 3, true);
-                        if (num == 0x90) // note pn 
-                            set_key(channel, note, true);
-                        else if (num == 0x80) // note off
-                            set_key(channel, note, false);
-                    }
-                    i = mmessage.next();
-                }
+            sig_map.wait();
+            {
+                std::lock_guard<std::mutex> lk(m);
+                // free tables the jack thread left since the last rebuild
+                tables.reclaim();
+                if (!rebuild) continue;
+                map.swap(pending);
+                rebuild = false;
             }
+            KbmTable *table = build_table(map);
+            std::lock_guard<std::mutex> lk(m);
+            tables.publish(table);
         } 
     });
 }            
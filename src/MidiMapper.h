@@ -22,9 +22,12 @@
 #include <vector>
 #include <thread>
 #include <string>
-#include <condition_variable>
+#include <mutex>
 #include <functional>
 
+#include "MidiQueue.h"
+#include "RcuSlot.h"
+
 
 #pragma once
 
@@ -34,33 +37,24 @@
 namespace midimapper {
 
 /****************************************************************
- ** class MidiMessenger
+ ** struct KbmTable
  **
- ** collect all midi events from jack_midi and send them to midi mapper
+ ** immutable note mapping applied in the jack process callback,
+ ** a value above 127 mean the key is skipped
  */
 
-class MidiMapperMessenger {
-private:
-    static const int max_midi_cc_cnt = 25;
-    std::atomic<bool> send_cc[max_midi_cc_cnt];
-    uint8_t cc_num[max_midi_cc_cnt];
-    uint8_t pg_num[max_midi_cc_cnt];
-    uint8_t bg_num[max_midi_cc_cnt];
-    uint8_t me_num[max_midi_cc_cnt];
-public:
-    MidiMapperMessenger();
-    int channel;
-    bool send_midi_cc(const uint8_t *midi_get, const uint8_t _num) noexcept;
-    int next(int i = -1) const noexcept;
-    inline uint8_t size(const int i)  const noexcept { return me_num[i]; }
-    void fill(uint8_t *midi_send, const int i) noexcept;
+struct KbmTable {
+    uint8_t note[128];
 };
 
 
 /****************************************************************
  ** class MidiMapper
  **
- ** map jack midi input to jack midi output via mapping matrix
+ ** map midi input to jack midi output via mapping matrix. The jack
+ ** thread map notes inline with the table published RCU style, the
+ ** mapper thread only rebuild the table when kbm_map changed.
+ ** Alsa input, which isn't realtime, is mapped on the calling thread.
  */
 
 class MidiMapper {
@@ -69,37 +63,46 @@ private:
     std::function<void(
         int _cc, int _pg, int _bgn, int _num, bool have_channel) >
         send_to_jack;
-    // the midi message 'queue' for jack midi input
-    MidiMapperMessenger mmessage;
-   // control the midi mapper loop
+    // show mapped notes on the keyboard
+    std::function<void(int,int,bool)> set_key;
+    // guard the tables and the pending map
+    std::mutex m;
+    rcuslot::RcuSlot<KbmTable> tables;
+    // the map waiting for the mapper thread
+    std::vector<int> pending;
+    bool rebuild;
+   // control the table rebuild loop
     std::atomic<bool> _execute_map;
-    // wait for notify in the midi mapper loop
-    std::condition_variable cv_map;
-    // thread running the midi mapper loop
+    // wait for a rebuild request
+    midiqueue::QueueSignal sig_map;
+    // thread running the table rebuild loop
     std::thread _thd_map;
-    // the mutex for the lock in the midi mapper loop
-    std::mutex m;
-    // stop the threads for mapper midi handling
+    // stop the thread for mapper table rebuilds
     void mmapper_stop();
     // priority for the mapper thread
     int prio;
+    KbmTable *build_table(const std::vector<int>& map) const;
 
 public:
     MidiMapper(std::function<void(
         int _cc, int _pg, int _bgn, int _num, bool have_channel)>
         send_to_jack);
     ~MidiMapper();
-    // start the threads for mapper midi handling
+    // start the thread for mapper table rebuilds
     void mmapper_start(std::function<void(int,int,bool)> set_key);
-    // push mdi message from jack into 'queue' and inform output thread that work is to do
+    // map a note message from a non realtime thread and send it to jack
     void mmapper_input_notify(const uint8_t *midi_get, uint8_t num) noexcept;
+    // jack thread only, the table stay valid until the next call
+    const KbmTable *rt_acquire() noexcept;
+    // publish kbm_map to the jack thread, call it after kbm_map changed
+    void mmapper_update();
     // set the priority for the I/O thread
     void mmapper_set_priority(int priority);
     // check if the mapper is running
     bool is_running() const noexcept;
     // setup the kbm map
     void setup_default_kbm_map();
-    // the vector holding the map file
+    // the vector holding the map file, edited from the GUI thread
     std::vector<int> kbm_map;
 
 };
@@ -0,0 +1,166 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <semaphore.h>
+
+#pragma once
+
+#ifndef MIDIQUEUE_H
+#define MIDIQUEUE_H
+
+
+namespace midiqueue {
+
+/****************************************************************
+ ** struct QueueEvent
+ **
+ ** a midi message of up to max_size bytes, time is a jack frame
+ ** time, 0 means as soon as possible
+ */
+
+template <std::size_t max_size>
+struct QueueEvent {
+    uint32_t time;
+    uint8_t size;
+    uint8_t data[max_size];
+};
+
+
+/****************************************************************
+ ** class MidiQueue
+ **
+ ** bounded lock free multi producer/single consumer ring. Every slot
+ ** carry a sequence number, producers claim a slot with a CAS on the
+ ** write position and publish it by bumping the slot sequence, so the
+ ** GUI, the alsa thread and the mapper could push concurrently while
+ ** the consumer never wait. When the ring is full the event is
+ ** dropped and counted. Events are never merged, repeated notes stay.
+ */
+
+template <uint32_t capacity, std::size_t max_size = 3>
+class MidiQueue {
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0,
+                    "capacity must be a power of two");
+public:
+    typedef QueueEvent<max_size> Event;
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;
+        Event ev;
+    };
+    Slot slots[capacity];
+    alignas(64) std::atomic<uint32_t> write_pos;
+    alignas(64) uint32_t read_pos;
+    std::atomic<uint32_t> overflows;
+
+public:
+    MidiQueue() : write_pos(0), read_pos(0), overflows(0) {
+        for (uint32_t i = 0; i < capacity; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // called from any producer thread, never block
+    bool push(const uint8_t *data, const uint8_t size, const uint32_t time = 0) noexcept {
+        if (size == 0 || size > max_size) {
+            overflows.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint32_t pos = write_pos.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &slots[pos & (capacity - 1)];
+            const int32_t diff = int32_t(slot->seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = write_pos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->ev.time = time;
+        slot->ev.size = size;
+        memcpy(slot->ev.data, data, size);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // called from the consumer thread only, the event stay valid until pop()
+    const Event *front() const noexcept {
+        const Slot& slot = slots[read_pos & (capacity - 1)];
+        if (slot.seq.load(std::memory_order_acquire) != read_pos + 1) return nullptr;
+        return &slot.ev;
+    }
+
+    // called from the consumer thread only, release the front event
+    void pop() noexcept {
+        slots[read_pos & (capacity - 1)].seq.store(read_pos + capacity, std::memory_order_release);
+        read_pos++;
+    }
+
+    // called from the consumer thread only
+    bool pop(Event *ev) noexcept {
+        const Event *e = front();
+        if (!e) return false;
+        (*ev) = (*e);
+        pop();
+        return true;
+    }
+
+    inline uint32_t get_overflows() const noexcept {
+        return overflows.load(std::memory_order_relaxed);
+    }
+};
+
+
+/****************************************************************
+ ** class QueueSignal
+ **
+ ** wake up the consumer thread of a MidiQueue. notify() is a plain
+ ** sem_post(), which neither lock nor allocate, so it is safe to call
+ ** from the jack process callback.
+ */
+
+class QueueSignal {
+private:
+    sem_t sem;
+
+public:
+    QueueSignal() { sem_init(&sem, 0, 0); }
+    ~QueueSignal() { sem_destroy(&sem); }
+
+    inline void notify() noexcept { sem_post(&sem); }
+
+    void wait() noexcept {
+        while (sem_wait(&sem) == -1 && errno == EINTR);
+    }
+};
+
+} // namespace midiqueue
+
+#endif //MIDIQUEUE_H
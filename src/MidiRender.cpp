@@ -0,0 +1,191 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "MidiRender.h"
+#include <cstring>
+
+namespace midirender {
+
+
+/****************************************************************
+ ** class WavWriter
+ **
+ ** write interleaved stereo 32 bit float samples to a wav file
+ */
+
+WavWriter::WavWriter()
+    : fp(NULL),
+    samplerate(0),
+    frames(0) {
+}
+
+WavWriter::~WavWriter() {
+    close();
+}
+
+static void put_u32(FILE *fp, uint32_t v) {
+    const uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    fwrite(b, 1, 4, fp);
+}
+
+static void put_u16(FILE *fp, uint16_t v) {
+    const uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    fwrite(b, 1, 2, fp);
+}
+
+// IEEE float format, the fact chunk is required for non PCM data
+void WavWriter::write_header() {
+    const uint32_t data_size = frames * 2 * sizeof(float);
+    fwrite("RIFF", 1, 4, fp);
+    put_u32(fp, 4 + 26 + 12 + 8 + data_size);
+    fwrite("WAVE", 1, 4, fp);
+    fwrite("fmt ", 1, 4, fp);
+    put_u32(fp, 18);
+    put_u16(fp, 3);
+    put_u16(fp, 2);
+    put_u32(fp, samplerate);
+    put_u32(fp, samplerate * 2 * sizeof(float));
+    put_u16(fp, 2 * sizeof(float));
+    put_u16(fp, 32);
+    put_u16(fp, 0);
+    fwrite("fact", 1, 4, fp);
+    put_u32(fp, 4);
+    put_u32(fp, frames);
+    fwrite("data", 1, 4, fp);
+    put_u32(fp, data_size);
+}
+
+bool WavWriter::open(const char *path, unsigned int samplerate_) {
+    close();
+    fp = fopen(path, "wb");
+    if (!fp) return false;
+    samplerate = samplerate_;
+    frames = 0;
+    write_header();
+    return !ferror(fp);
+}
+
+bool WavWriter::write(const float *left, const float *right, int n) {
+    if (!fp) return false;
+    float buf[2 * 256];
+    for (int done = 0; done < n;) {
+        const int c = n - done < 256 ? n - done : 256;
+        for (int i = 0; i < c; i++) {
+            buf[2*i] = left[done + i];
+            buf[2*i+1] = right[done + i];
+        }
+        // wav data is little endian, as is every host we build for
+        if (fwrite(buf, sizeof(float), 2 * c, fp) != (size_t)(2 * c)) return false;
+        done += c;
+    }
+    frames += n;
+    return true;
+}
+
+// patch the sizes into the header
+bool WavWriter::close() {
+    if (!fp) return true;
+    bool ok = !ferror(fp);
+    if (ok && fseek(fp, 0, SEEK_SET) == 0) write_header();
+    else ok = false;
+    ok = fclose(fp) == 0 && ok;
+    fp = NULL;
+    return ok;
+}
+
+
+/****************************************************************
+ ** class MidiRender
+ **
+ ** render loops offline through a XSynth
+ */
+
+MidiRender::MidiRender(xsynth::XSynth *xsynth_)
+    : xsynth(xsynth_) {
+}
+
+bool MidiRender::render_frames(WavWriter& wav, uint64_t frames) {
+    while (frames) {
+        const int n = frames < (uint64_t)block ? (int)frames : block;
+        if (xsynth->render(left, right, n) != 0) return false;
+        if (!wav.write(left, right, n)) return false;
+        frames -= n;
+    }
+    return true;
+}
+
+bool MidiRender::render(const mamba::LoopSnapshot& loops, int bpm, unsigned int samplerate,
+                            int repeats, double tail, const char *path) {
+    if (!xsynth->synth_is_active()) return false;
+    mamba::TimeBase timebase;
+    timebase.set_samplerate(samplerate);
+    timebase.set_bpm(bpm);
+
+    // all channels repeat with the length of the longest loop
+    uint32_t max_ticks = 0;
+    for (int j = 0; j < 16; j++) {
+        if (loops.size(j) && loops.back_time(j) > max_ticks) max_ticks = loops.back_time(j);
+    }
+    const uint64_t loop_frames = timebase.ticks_to_frames(max_ticks);
+
+    WavWriter wav;
+    if (!wav.open(path, samplerate)) {
+        fprintf(stderr, "render: couldn't open '%s'\n", path);
+        return false;
+    }
+    uint64_t pos = 0;
+    for (int r = 0; r < repeats; r++) {
+        const uint64_t start = r * loop_frames;
+        size_t next[16] = {0};
+        for (;;) {
+            // the channel holding the earliest pending event
+            int ch = -1;
+            uint32_t t = 0;
+            for (int j = 0; j < 16; j++) {
+                if (next[j] >= loops.size(j)) continue;
+                if (ch < 0 || loops.get_time(j, next[j]) < t) {
+                    ch = j;
+                    t = loops.get_time(j, next[j]);
+                }
+            }
+            if (ch < 0) break;
+            const uint64_t due = start + timebase.ticks_to_frames(t);
+            if (due > pos) {
+                if (!render_frames(wav, due - pos)) return false;
+                pos = due;
+            }
+            xsynth->synth_send_event(loops.channel(ch).get_data(next[ch]));
+            next[ch]++;
+        }
+        if (start + loop_frames > pos) {
+            if (!render_frames(wav, start + loop_frames - pos)) return false;
+            pos = start + loop_frames;
+        }
+    }
+    // let the voices ring out
+    for (int i = 0; i < 16; i++) {
+        const uint8_t off[3] = {(uint8_t)(0xB0 | i), 123, 0};
+        xsynth->synth_send_event(off);
+    }
+    if (!render_frames(wav, (uint64_t)(tail * samplerate))) return false;
+    return wav.close();
+}
+
+} // namespace midirender
@@ -0,0 +1,81 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <cstdint>
+#include <cstdio>
+
+#include "Mamba.h"
+#include "XSynth.h"
+
+#pragma once
+
+#ifndef MIDIRENDER_H
+#define MIDIRENDER_H
+
+namespace midirender {
+
+
+/****************************************************************
+ ** class WavWriter
+ **
+ ** write interleaved stereo 32 bit float samples to a wav file
+ */
+
+class WavWriter {
+private:
+    FILE *fp;
+    unsigned int samplerate;
+    uint32_t frames;
+    void write_header();
+
+public:
+    WavWriter();
+    ~WavWriter();
+    bool open(const char *path, unsigned int samplerate);
+    bool write(const float *left, const float *right, int n);
+    bool close();
+};
+
+
+/****************************************************************
+ ** class MidiRender
+ **
+ ** render loops offline through a XSynth set up with setup_offline(),
+ ** events are placed sample accurate, as fast as the synth can run
+ */
+
+class MidiRender {
+private:
+    xsynth::XSynth *xsynth;
+    static const int block = 64;
+    float left[block];
+    float right[block];
+    bool render_frames(WavWriter& wav, uint64_t frames);
+
+public:
+    MidiRender(xsynth::XSynth *xsynth);
+    // render the loops repeats times plus tail seconds for the release
+    bool render(const mamba::LoopSnapshot& loops, int bpm, unsigned int samplerate,
+                    int repeats, double tail, const char *path);
+};
+
+} // namespace midirender
+
+#endif //MIDIRENDER_H
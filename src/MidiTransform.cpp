@@ -0,0 +1,242 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+#include "MidiTransform.h"
+
+namespace miditransform {
+
+
+/****************************************************************
+ ** class MidiTransform
+ **
+ ** compile rule files to lookup tables for the midi input
+ */
+
+MidiTransform::MidiTransform()
+    : tables(nullptr) {
+}
+
+// parse a channel, '*' mean all of them
+static bool parse_channel(const std::string& s, int *lo, int *hi) {
+    if (s == "*") {
+        *lo = 0;
+        *hi = 15;
+        return true;
+    }
+    char *end = nullptr;
+    const long c = strtol(s.c_str(), &end, 10);
+    if (*end || c < 1 || c > 16) return false;
+    *lo = *hi = c - 1;
+    return true;
+}
+
+// parse a number or a range like 0-59
+static bool parse_range(const std::string& s, int *lo, int *hi) {
+    // strtol take a sign, blanks or no digits at all
+    if (!isdigit((unsigned char)s[0])) return false;
+    char *end = nullptr;
+    *lo = strtol(s.c_str(), &end, 10);
+    *hi = *lo;
+    if (*end == '-') {
+        if (!isdigit((unsigned char)end[1])) return false;
+        *hi = strtol(end + 1, &end, 10);
+    }
+    return !*end && *lo >= 0 && *hi <= 127 && *lo <= *hi;
+}
+
+static bool fail(std::string *error, const std::string& why) {
+    *error = why;
+    return false;
+}
+
+static bool parse_arrow(std::istringstream& buf) {
+    std::string arrow;
+    buf >> arrow;
+    return arrow == ">" || arrow == "->";
+}
+
+bool MidiTransform::compile_line(TransformTable *table, const std::string& line,
+                bool *sources, bool (*dropped)[8], std::string *error) const {
+    std::istringstream buf(line);
+    std::string key;
+    if (!(buf >> key) || key[0] == '#') return true;
+    if (key == "source") {
+        std::string s;
+        buf >> s;
+        for (int i = 0; i < SRC_COUNT; i++) sources[i] = s == "all";
+        if (s == "jack") sources[SRC_JACK] = true;
+        else if (s == "alsa") sources[SRC_ALSA] = true;
+        else if (s == "raw") sources[SRC_RAW] = true;
+        else if (s != "all") return fail(error, "unknown source " + s);
+    } else if (key == "drop") {
+        std::string what;
+        buf >> what;
+        std::vector<int> system;
+        std::vector<int> voice;
+        if (what == "clock") system = {0x8};
+        else if (what == "sense") system = {0xe};
+        else if (what == "transport") system = {0xa, 0xb, 0xc};
+        else if (what == "sysex") system = {0x0, 0x7};
+        else if (what == "aftertouch") voice = {0x2, 0x5};
+        else if (what == "program") voice = {0x4};
+        else if (what == "pitchbend") voice = {0x6};
+        else return fail(error, "unknown message type " + what);
+        // voice messages are dropped after all rules, a later
+        // note or layer rule must not bring poly aftertouch back
+        for (int s = 0; s < SRC_COUNT; s++) {
+            if (!sources[s]) continue;
+            for (auto i : system) table->system[s][i] = false;
+            for (auto i : voice) dropped[s][i] = true;
+        }
+    } else if (key == "channel") {
+        std::string from;
+        int lo, hi, to, unused;
+        buf >> from;
+        if (!parse_channel(from, &lo, &hi) || !parse_arrow(buf))
+            return fail(error, "expect: channel N > M");
+        buf >> from;
+        if (!parse_channel(from, &to, &unused) || from == "*")
+            return fail(error, "expect: channel N > M");
+        for (int s = 0; s < SRC_COUNT; s++) {
+            if (!sources[s]) continue;
+            for (int i = 0; i < 8; i++)
+                for (int c = lo; c <= hi; c++)
+                    for (auto& e : table->voice[s][i][c])
+                        for (int o = 0; o < e.count; o++)
+                            e.out[o].status = (e.out[o].status & 0xf0) | to;
+        }
+    } else if (key == "cc") {
+        std::string ch;
+        int lo, hi, from, to;
+        buf >> ch >> from;
+        if (!parse_channel(ch, &lo, &hi) || !parse_arrow(buf) || !(buf >> to) ||
+                from < 0 || from > 127 || to < 0 || to > 127)
+            return fail(error, "expect: cc CHANNEL N > M");
+        for (int s = 0; s < SRC_COUNT; s++) {
+            if (!sources[s]) continue;
+            for (int c = lo; c <= hi; c++) {
+                Entry& e = table->voice[s][0x3][c][from];
+                for (int o = 0; o < e.count; o++) e.out[o].data1 = to;
+            }
+        }
+    } else if (key == "note" || key == "layer") {
+        std::string ch, range, dest;
+        int lo, hi, first, last, to, unused;
+        int transpose = 0;
+        buf >> ch >> range;
+        if (!parse_channel(ch, &lo, &hi) || !parse_range(range, &first, &last) ||
+                !parse_arrow(buf) || !(buf >> dest) ||
+                !parse_channel(dest, &to, &unused) || dest == "*")
+            return fail(error, "expect: " + key + " CHANNEL LOW-HIGH > CHANNEL [TRANSPOSE]");
+        buf >> transpose;
+        const bool layer = key == "layer";
+        for (int s = 0; s < SRC_COUNT; s++) {
+            if (!sources[s]) continue;
+            // note off, note on and poly aftertouch follow the keys
+            for (int i = 0; i < 3; i++) {
+                for (int c = lo; c <= hi; c++) {
+                    for (int k = first; k <= last; k++) {
+                        Entry& e = table->voice[s][i][c][k];
+                        if (!layer) e.count = 0;
+                        const int note = k + transpose;
+                        if (note < 0 || note > 127 || e.count >= max_out) continue;
+                        e.out[e.count].status = ((i + 8) << 4) | to;
+                        e.out[e.count].data1 = note;
+                        e.count++;
+                    }
+                }
+            }
+        }
+    } else {
+        return fail(error, "unknown rule " + key);
+    }
+    return true;
+}
+
+bool MidiTransform::load(const std::string& file_, std::string *error) {
+    std::ifstream infile(file_);
+    if (!infile.is_open()) {
+        *error = "couldn't open " + file_;
+        return false;
+    }
+    TransformTable *table = new TransformTable();
+    // start from the identity
+    for (int s = 0; s < SRC_COUNT; s++) {
+        for (int i = 0; i < 8; i++) {
+            for (int c = 0; c < 16; c++) {
+                for (int d = 0; d < 128; d++) {
+                    Entry& e = table->voice[s][i][c][d];
+                    e.count = 1;
+                    e.out[0].status = ((i + 8) << 4) | c;
+                    e.out[0].data1 = d;
+                }
+            }
+        }
+        for (int i = 0; i < 16; i++) table->system[s][i] = true;
+    }
+    bool sources[SRC_COUNT] = {true, true, true};
+    bool dropped[SRC_COUNT][8] = {};
+    std::string line;
+    int n = 0;
+    while (std::getline(infile, line)) {
+        n++;
+        if (!compile_line(table, line, sources, dropped, error)) {
+            *error = "line " + std::to_string(n) + ": " + *error;
+            delete table;
+            return false;
+        }
+    }
+    for (int s = 0; s < SRC_COUNT; s++) {
+        for (int i = 0; i < 8; i++) {
+            if (!dropped[s][i]) continue;
+            for (int c = 0; c < 16; c++)
+                for (int d = 0; d < 128; d++) table->voice[s][i][c][d].count = 0;
+        }
+    }
+    std::lock_guard<std::mutex> lk(m);
+    tables.publish(table);
+    file = file_;
+    return true;
+}
+
+void MidiTransform::clear() {
+    std::lock_guard<std::mutex> lk(m);
+    tables.publish(nullptr);
+    file.clear();
+}
+
+const TransformTable *MidiTransform::rt_acquire() noexcept {
+    return tables.rt_acquire();
+}
+
+int MidiTransform::transform(int source, const uint8_t *in, uint8_t num,
+                                            uint8_t (*out)[3]) noexcept {
+    std::lock_guard<std::mutex> lk(m);
+    const TransformTable *table = tables.get();
+    if (table) return table->apply(source, in, num, out);
+    for (int j = 0; j < num; j++) out[0][j] = in[j];
+    return 1;
+}
+
+} // namespace miditransform
@@ -0,0 +1,139 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+#include "RcuSlot.h"
+
+
+#pragma once
+
+#ifndef MIDITRANSFORM_H
+#define MIDITRANSFORM_H
+
+namespace miditransform {
+
+// the inputs a rule set could address
+typedef enum {
+    SRC_JACK = 0,
+    SRC_ALSA,
+    SRC_RAW,
+    SRC_COUNT
+} Source;
+
+// most messages a single input event could turn into (split + layers)
+static const int max_out = 4;
+
+
+/****************************************************************
+ ** struct TransformTable
+ **
+ ** compiled rule set, one entry per source, status, channel and
+ ** first data byte, so each event need a single indexed load.
+ ** Immutable once published.
+ */
+
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+} Output;
+
+typedef struct {
+    uint8_t count;
+    Output out[max_out];
+} Entry;
+
+struct TransformTable {
+    Entry voice[SRC_COUNT][8][16][128];
+    // pass system messages, indexed by the low nibble
+    bool system[SRC_COUNT][16];
+
+    // long messages (sysex) are never transformed, only passed or dropped
+    inline bool pass_long(int source, const uint8_t *in) const noexcept {
+        return system[source][in[0] & 0x0f];
+    }
+
+    // write the transformed messages to out, return how many
+    inline int apply(int source, const uint8_t *in, uint8_t num,
+                                uint8_t (*out)[3]) const noexcept {
+        if (in[0] >= 0xf0) {
+            if (!system[source][in[0] & 0x0f]) return 0;
+            for (int j = 0; j < num; j++) out[0][j] = in[j];
+            return 1;
+        }
+        const Entry& e = voice[source][(in[0] >> 4) & 0x07][in[0] & 0x0f][num > 1 ? in[1] & 0x7f : 0];
+        for (int i = 0; i < e.count; i++) {
+            out[i][0] = e.out[i].status;
+            out[i][1] = e.out[i].data1;
+            out[i][2] = num > 2 ? in[2] : 0;
+        }
+        return e.count;
+    }
+};
+
+
+/****************************************************************
+ ** class MidiTransform
+ **
+ ** load a rule file and publish it, compiled, RCU style to the
+ ** jack thread. Rules apply in file order, channels count from 1,
+ ** '*' stand for all channels:
+ **
+ **   source all|jack|alsa|raw     rules below apply to this input
+ **   drop clock|sense|transport|sysex|aftertouch|program|pitchbend
+ **   channel 1 > 2                move channel 1 to channel 2
+ **   cc 1 7 > 11                  renumber cc 7 on channel 1 to 11
+ **   note 1 0-59 > 2 -12          split keys 0-59 to channel 2, an octave down
+ **   layer 1 60-127 > 3 +12       add a copy of keys 60-127 on channel 3
+ **
+ ** SysEx only reach the jack input, alsa and raw don't forward it.
+ ** Without a loaded rule set (nullptr) events pass untouched.
+ */
+
+class MidiTransform {
+private:
+    // guard the tables
+    std::mutex m;
+    rcuslot::RcuSlot<TransformTable> tables;
+    bool compile_line(TransformTable *table, const std::string& line,
+                bool *sources, bool (*dropped)[8], std::string *error) const;
+
+public:
+    MidiTransform();
+    // parse and compile a rule file and swap it in, on error the
+    // active rule set stay and error hold the reason
+    bool load(const std::string& file, std::string *error);
+    // let all events pass untouched
+    void clear();
+    // jack thread only, the table stay valid until the next call
+    const TransformTable *rt_acquire() noexcept;
+    // transform a message from a non realtime thread
+    int transform(int source, const uint8_t *in, uint8_t num, uint8_t (*out)[3]) noexcept;
+    // the loaded rule file, empty when bypassed
+    std::string file;
+};
+
+} // namespace miditransform
+
+#endif //MIDITRANSFORM_H_
@@ -0,0 +1,210 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <algorithm>
+
+#include "PianoRoll.h"
+
+namespace pianoroll {
+
+static inline void merge(Density *d, const Density& b) noexcept {
+    if (!b.count) return;
+    if (b.low < d->low) d->low = b.low;
+    if (b.high > d->high) d->high = b.high;
+    if (b.count > d->count) d->count = b.count;
+}
+
+
+/****************************************************************
+ ** class ChannelRoll
+ **
+ ** note spans and density pyramid of a loop channel
+ */
+
+void ChannelRoll::build(std::shared_ptr<const mamba::EventStore> loop) {
+    source = loop;
+    spans.clear();
+    levels.clear();
+    if (!loop || loop->empty()) return;
+    const uint32_t length = loop->back_time();
+
+    // pair note on/off, a retriggered note end the sounding one
+    uint32_t on[128];
+    uint8_t velocity[128];
+    std::fill(on, on + 128, UINT32_MAX);
+    spans.reserve(loop->size() / 2);
+    for (size_t i = 0; i < loop->size(); i++) {
+        const uint8_t *d = loop->get_data(i);
+        const uint8_t status = d[0] & 0xf0;
+        if (status != 0x90 && status != 0x80) continue;
+        const uint8_t key = d[1] & 0x7f;
+        const uint32_t time = loop->get_time(i);
+        if (on[key] != UINT32_MAX) {
+            spans.push_back({on[key], time, key, velocity[key]});
+            on[key] = UINT32_MAX;
+        }
+        if (status == 0x90 && d[2]) {
+            on[key] = time;
+            velocity[key] = d[2];
+        }
+    }
+    // notes still on at the loop end
+    for (int key = 0; key < 128; key++) {
+        if (on[key] != UINT32_MAX) spans.push_back({on[key], length, (uint8_t)key, velocity[key]});
+    }
+    std::stable_sort(spans.begin(), spans.end(),
+        [] (const NoteSpan& a, const NoteSpan& b) { return a.start < b.start; });
+
+    const Density empty = {127, 0, 0};
+    levels.emplace_back(length / bucket_ticks + 1, empty);
+    std::vector<Density>& base = levels.back();
+    for (const NoteSpan& s : spans) {
+        const uint32_t last = (s.end > s.start ? s.end - 1 : s.start) / bucket_ticks;
+        for (uint32_t b = s.start / bucket_ticks; b <= last && b < base.size(); b++) {
+            Density& d = base[b];
+            if (s.key < d.low) d.low = s.key;
+            if (s.key > d.high) d.high = s.key;
+            if (d.count < UINT16_MAX) d.count++;
+        }
+    }
+    while (levels.back().size() > 1) {
+        const std::vector<Density>& below = levels.back();
+        std::vector<Density> level((below.size() + 1) / 2, empty);
+        for (size_t b = 0; b < below.size(); b++) merge(&level[b / 2], below[b]);
+        levels.push_back(std::move(level));
+    }
+}
+
+Density ChannelRoll::density(uint32_t start, uint32_t end) const noexcept {
+    Density d = {127, 0, 0};
+    if (levels.empty() || end <= start) return d;
+    // the coarsest level with buckets not wider than the span
+    const uint32_t width = (end - start) / bucket_ticks;
+    size_t level = 0;
+    while (level + 1 < levels.size() && (uint64_t(2) << level) <= width) level++;
+    const uint64_t ticks = uint64_t(bucket_ticks) << level;
+    const std::vector<Density>& buckets = levels[level];
+    for (size_t b = start / ticks; b <= (end - 1) / ticks && b < buckets.size(); b++)
+        merge(&d, buckets[b]);
+    return d;
+}
+
+
+/****************************************************************
+ ** class RollIndex
+ **
+ ** note index of all loop channels
+ */
+
+Density RollIndex::range() const noexcept {
+    Density d = {127, 0, 0};
+    for (int ch = 0; ch < 16; ch++) {
+        if (channel[ch] && !channel[ch]->levels.empty())
+            merge(&d, channel[ch]->levels.back()[0]);
+    }
+    return d;
+}
+
+
+/****************************************************************
+ ** class RollBuilder
+ **
+ ** build note indexes off the GUI thread
+ */
+
+RollBuilder::RollBuilder()
+    : _execute(false),
+    pending(false),
+    current(std::make_shared<const RollIndex>()),
+    changed(false) {
+}
+
+RollBuilder::~RollBuilder() {
+    stop();
+}
+
+void RollBuilder::start() {
+    if (_execute.load(std::memory_order_acquire)) return;
+    _execute.store(true, std::memory_order_release);
+    _thd = std::thread([this]() { run(); });
+}
+
+void RollBuilder::stop() {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        _execute.store(false, std::memory_order_release);
+    }
+    cv.notify_one();
+    if (_thd.joinable()) _thd.join();
+}
+
+void RollBuilder::update(const mamba::LoopSnapshot& snap) {
+    std::lock_guard<std::mutex> lk(m);
+    bool differ = false;
+    for (int ch = 0; ch < 16 && !differ; ch++) {
+        const std::shared_ptr<const mamba::EventStore> *last;
+        if (pending) last = &request.loop[ch];
+        else last = current->channel[ch] ? &current->channel[ch]->source : nullptr;
+        differ = last ? snap.loop[ch] != *last : snap.loop[ch] != nullptr;
+    }
+    if (!differ) return;
+    request = snap;
+    pending = true;
+    cv.notify_one();
+}
+
+std::shared_ptr<const RollIndex> RollBuilder::get() {
+    std::lock_guard<std::mutex> lk(m);
+    return current;
+}
+
+void RollBuilder::run() {
+    std::unique_lock<std::mutex> lk(m);
+    while (true) {
+        cv.wait(lk, [this] { return pending || !_execute.load(std::memory_order_acquire); });
+        if (!_execute.load(std::memory_order_acquire)) break;
+        pending = false;
+        const mamba::LoopSnapshot snap = request;
+        const std::shared_ptr<const RollIndex> last = current;
+        lk.unlock();
+
+        std::shared_ptr<RollIndex> index = std::make_shared<RollIndex>();
+        for (int ch = 0; ch < 16; ch++) {
+            if (!snap.size(ch)) continue;
+            if (snap.back_time(ch) > index->length) index->length = snap.back_time(ch);
+            if (last->channel[ch] && last->channel[ch]->source == snap.loop[ch]) {
+                index->channel[ch] = last->channel[ch];
+            } else {
+                std::shared_ptr<ChannelRoll> roll = std::make_shared<ChannelRoll>();
+                roll->build(snap.loop[ch]);
+                index->channel[ch] = roll;
+            }
+        }
+
+        lk.lock();
+        current = index;
+        changed.store(true, std::memory_order_release);
+        lk.unlock();
+        if (ready) ready();
+        lk.lock();
+    }
+}
+
+} // namespace pianoroll
@@ -0,0 +1,146 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+#include "Mamba.h"
+
+
+#pragma once
+
+#ifndef PIANOROLL_H
+#define PIANOROLL_H
+
+namespace pianoroll {
+
+
+/****************************************************************
+ ** struct NoteSpan
+ **
+ ** a note from note on to note off, times are in TimeBase ticks
+ */
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint8_t key;
+    uint8_t velocity;
+} NoteSpan;
+
+
+/****************************************************************
+ ** struct Density
+ **
+ ** the key range and the number of notes sounding within a time span
+ */
+
+typedef struct {
+    uint8_t low;
+    uint8_t high;
+    uint16_t count;
+} Density;
+
+
+/****************************************************************
+ ** class ChannelRoll
+ **
+ ** the notes of a loop channel sorted by start time, and a level of
+ ** detail pyramid of the key range and note density. Level 0 split
+ ** the loop into bucket_ticks wide buckets, each further level merge
+ ** two buckets of the level below, so any time span could be
+ ** summarized by at most 3 buckets.
+ */
+
+class ChannelRoll {
+public:
+    static constexpr uint32_t bucket_ticks = mamba::TimeBase::ppqn / 16;
+    // the loop this was build from, keep it alive for the pointer compare
+    std::shared_ptr<const mamba::EventStore> source;
+    std::vector<NoteSpan> spans;
+    std::vector<std::vector<Density> > levels;
+    void build(std::shared_ptr<const mamba::EventStore> loop);
+    // summarize the notes sounding in [start, end)
+    Density density(uint32_t start, uint32_t end) const noexcept;
+};
+
+
+/****************************************************************
+ ** class RollIndex
+ **
+ ** immutable note index of all 16 loop channels, unchanged channels
+ ** are shared between indexes
+ */
+
+class RollIndex {
+public:
+    std::shared_ptr<const ChannelRoll> channel[16];
+    // ticks until the last event of the longest loop
+    uint32_t length;
+    RollIndex() : length(0) {}
+    // key range of all channels
+    Density range() const noexcept;
+};
+
+
+/****************************************************************
+ ** class RollBuilder
+ **
+ ** build the note index for a loop snapshot in a extra thread,
+ ** only channels which changed since the last build are indexed
+ */
+
+class RollBuilder {
+private:
+    std::atomic<bool> _execute;
+    std::thread _thd;
+    std::mutex m;
+    std::condition_variable cv;
+    bool pending;
+    mamba::LoopSnapshot request;
+    std::shared_ptr<const RollIndex> current;
+    std::atomic<bool> changed;
+    void run();
+
+public:
+    RollBuilder();
+    ~RollBuilder();
+    // called from the build thread when a new index is ready
+    std::function<void() > ready;
+    void start();
+    void stop();
+    // queue a build when the snapshot differ from the current index
+    void update(const mamba::LoopSnapshot& snap);
+    std::shared_ptr<const RollIndex> get();
+    // true once after a new index was published
+    bool take_changed() noexcept {
+        return changed.exchange(false, std::memory_order_acq_rel);
+    }
+};
+
+} // namespace pianoroll
+
+#endif //PIANOROLL_H
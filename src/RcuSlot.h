@@ -0,0 +1,102 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+
+#pragma once
+
+#ifndef RCUSLOT_H
+#define RCUSLOT_H
+
+
+namespace rcuslot {
+
+/****************************************************************
+ ** class RcuSlot
+ **
+ ** hold a immutable object for the jack thread, RCU style. Writers
+ ** swap in a new object with publish(), the jack thread pick up the
+ ** current one wait free with rt_acquire(). Replaced objects are
+ ** deleted by the writers once the jack thread moved on, so it never
+ ** free memory. Writers must serialize with a mutex of their own.
+ */
+
+template <class T>
+class RcuSlot {
+private:
+    std::atomic<T*> current;
+    std::atomic<T*> rt_in_use;
+    std::vector<T*> retired;
+
+public:
+    explicit RcuSlot(T *object = nullptr)
+        : current(object), rt_in_use(nullptr) {}
+
+    ~RcuSlot() {
+        for (auto object : retired) delete object;
+        delete current.load(std::memory_order_acquire);
+    }
+
+    RcuSlot(const RcuSlot&) = delete;
+    RcuSlot& operator=(const RcuSlot&) = delete;
+
+    // jack thread only, the object stay valid until the next call
+    const T *rt_acquire() noexcept {
+        T *object = current.load(std::memory_order_seq_cst);
+        // announce the object, then check it wasn't replaced meanwhile,
+        // a writer seeing the old announcement will not delete the new one
+        while (true) {
+            rt_in_use.store(object, std::memory_order_seq_cst);
+            T *check = current.load(std::memory_order_seq_cst);
+            if (check == object) return object;
+            object = check;
+        }
+    }
+
+    // writers, the current object, could be null
+    const T *get() const noexcept {
+        return current.load(std::memory_order_acquire);
+    }
+
+    // writers, take over object and retire the replaced one
+    void publish(T *object) {
+        T *old = current.exchange(object, std::memory_order_seq_cst);
+        if (old) retired.push_back(old);
+        reclaim();
+    }
+
+    // writers, free the objects the jack thread isn't using anymore
+    void reclaim() {
+        const T *used = rt_in_use.load(std::memory_order_seq_cst);
+        for (auto i = retired.begin(); i != retired.end();) {
+            if ((*i) != used) {
+                delete (*i);
+                i = retired.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+};
+
+} // namespace rcuslot
+
+#endif //RCUSLOT_H
@@ -0,0 +1,137 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+
+#include "VelocityCurve.h"
+
+namespace velocitycurve {
+
+
+/****************************************************************
+ ** class VelocityCurves
+ **
+ ** velocity curves per note source
+ */
+
+VelocityCurves::VelocityCurves() {
+    for (int s = 0; s < VEL_COUNT; s++) curves[s] = {CURVE_LINEAR, 1.0f, {}};
+    tables.publish(build_table());
+}
+
+// interpolate the user points, flat beyond the first and last one
+static float points_value(const std::vector<int>& points, int v) {
+    std::vector<std::pair<int,int> > p;
+    for (size_t i = 0; i + 1 < points.size(); i += 2) p.push_back({points[i], points[i+1]});
+    if (p.empty()) return v;
+    std::sort(p.begin(), p.end());
+    if (v <= p.front().first) return p.front().second;
+    for (size_t i = 1; i < p.size(); i++) {
+        if (v > p[i].first) continue;
+        const float span = p[i].first - p[i-1].first;
+        if (span <= 0) return p[i].second;
+        return p[i-1].second + (p[i].second - p[i-1].second) * (v - p[i-1].first) / span;
+    }
+    return p.back().second;
+}
+
+static float curve_value(const Curve& c, int v) {
+    const float x = v / 127.0f;
+    switch (c.type) {
+        case CURVE_EXPONENTIAL:
+            return 127.0f * powf(x, c.amount > 0.0f ? c.amount : 1.0f);
+        case CURVE_SCURVE:
+        {
+            const float a = c.amount > 0.0f ? c.amount : 2.0f;
+            const float y = x < 0.5f ? 0.5f * powf(2.0f * x, a) : 1.0f - 0.5f * powf(2.0f * (1.0f - x), a);
+            return 127.0f * y;
+        }
+        case CURVE_FIXED:
+            return c.amount;
+        case CURVE_POINTS:
+            return points_value(c.points, v);
+        default:
+            return v;
+    }
+}
+
+VelocityTable *VelocityCurves::build_table() const {
+    VelocityTable *table = new VelocityTable();
+    for (int s = 0; s < VEL_COUNT; s++) {
+        table->lut[s][0] = 0;
+        for (int v = 1; v < 128; v++) {
+            const int out = (int)lrintf(curve_value(curves[s], v));
+            // a note on must stay a note on
+            table->lut[s][v] = out < 1 ? 1 : out > 127 ? 127 : out;
+        }
+    }
+    return table;
+}
+
+const VelocityTable *VelocityCurves::rt_acquire() noexcept {
+    return tables.rt_acquire();
+}
+
+void VelocityCurves::set_curve(int source, const Curve& curve) {
+    if (source < 0 || source >= VEL_COUNT) return;
+    std::lock_guard<std::mutex> lk(m);
+    curves[source] = curve;
+    tables.publish(build_table());
+}
+
+Curve VelocityCurves::get_curve(int source) {
+    std::lock_guard<std::mutex> lk(m);
+    return curves[source];
+}
+
+uint8_t VelocityCurves::map(int source, uint8_t velocity) noexcept {
+    std::lock_guard<std::mutex> lk(m);
+    return tables.get()->lut[source][velocity & 0x7f];
+}
+
+void VelocityCurves::apply(int source, uint8_t *msg, uint8_t num) noexcept {
+    std::lock_guard<std::mutex> lk(m);
+    tables.get()->apply(source, msg, num);
+}
+
+// "source type amount [x y ...]"
+std::string VelocityCurves::to_string(int source) {
+    const Curve c = get_curve(source);
+    std::ostringstream out;
+    out << source << " " << c.type << " " << c.amount;
+    for (auto p : c.points) out << " " << p;
+    return out.str();
+}
+
+bool VelocityCurves::from_string(const std::string& value) {
+    std::istringstream buf(value);
+    int source;
+    Curve c;
+    if (!(buf >> source >> c.type >> c.amount)) return false;
+    if (c.type < CURVE_LINEAR || c.type > CURVE_POINTS) return false;
+    int p;
+    while (buf >> p) c.points.push_back(p);
+    set_curve(source, c);
+    return true;
+}
+
+} // namespace velocitycurve
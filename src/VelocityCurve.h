@@ -0,0 +1,123 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <cstdint>
+
+#include "RcuSlot.h"
+
+
+#pragma once
+
+#ifndef VELOCITYCURVE_H
+#define VELOCITYCURVE_H
+
+namespace velocitycurve {
+
+// the note sources with a own curve
+typedef enum {
+    VEL_GUI = 0,
+    VEL_JACK,
+    VEL_ALSA,
+    VEL_MAPPER,
+    VEL_COUNT
+} Source;
+
+typedef enum {
+    CURVE_LINEAR = 0,
+    CURVE_EXPONENTIAL,
+    CURVE_SCURVE,
+    CURVE_FIXED,
+    CURVE_POINTS
+} CurveType;
+
+
+/****************************************************************
+ ** struct Curve
+ **
+ ** a velocity curve setting, amount is the exponent for the
+ ** exponential curve, the steepness of the S-curve, or the fixed
+ ** velocity. points hold x y pairs for the user curve.
+ */
+
+struct Curve {
+    int type;
+    float amount;
+    std::vector<int> points;
+};
+
+
+/****************************************************************
+ ** struct VelocityTable
+ **
+ ** compiled curves, immutable once published
+ */
+
+struct VelocityTable {
+    uint8_t lut[VEL_COUNT][128];
+
+    // map the velocity of a note on message in place
+    inline void apply(int source, uint8_t *msg, uint8_t num) const noexcept {
+        if (num > 2 && (msg[0] & 0xf0) == 0x90 && msg[2])
+            msg[2] = lut[source][msg[2] & 0x7f];
+    }
+};
+
+
+/****************************************************************
+ ** class VelocityCurves
+ **
+ ** hold the curve per source and publish them, compiled to lookup
+ ** tables, RCU style to the jack thread. The GUI keyboard and the
+ ** alsa input aren't realtime, they map on there own thread with
+ ** map() and apply(). Note on velocities never map to 0, note offs
+ ** pass untouched.
+ */
+
+class VelocityCurves {
+private:
+    // guard the curves and the tables
+    std::mutex m;
+    Curve curves[VEL_COUNT];
+    rcuslot::RcuSlot<VelocityTable> tables;
+    VelocityTable *build_table() const;
+
+public:
+    VelocityCurves();
+    // swap in a new curve for source
+    void set_curve(int source, const Curve& curve);
+    Curve get_curve(int source);
+    // jack thread only, the table stay valid until the next call
+    const VelocityTable *rt_acquire() noexcept;
+    // map a velocity from a non realtime thread
+    uint8_t map(int source, uint8_t velocity) noexcept;
+    // map the velocity of a note on message from a non realtime thread
+    void apply(int source, uint8_t *msg, uint8_t num) noexcept;
+    // the curve of source as config value, and back
+    std::string to_string(int source);
+    bool from_string(const std::string& value);
+};
+
+} // namespace velocitycurve
+
+#endif //VELOCITYCURVE_H_
@@ -24,56 +24,6 @@
 namespace xalsa {
 
 
-/****************************************************************
- ** class XAlsaMidiMessenger
- **
- ** collect all midi events from jack_midi and send to alsa midi out buffer
- */
-
-XAlsaMidiMessenger::XAlsaMidiMessenger() {
-    channel = 0;
-    for (int i = 0; i < max_midi_cc_cnt; i++) {
-        send_cc[i] = false;
-    }
-}
-
-int XAlsaMidiMessenger::next(int i) const noexcept {
-    while (++i < max_midi_cc_cnt) {
-        if (send_cc[i].load(std::memory_order_acquire)) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-void XAlsaMidiMessenger::fill(uint8_t *event, const int i) noexcept {
-    if (size(i) == 3) {
-        event[2] =  bg_num[i]; // velocity
-    }
-    event[1] = pg_num[i];    // program value
-    event[0] = cc_num[i];    // controller+ channel
-    send_cc[i].store(false, std::memory_order_release);
-}
-
-bool XAlsaMidiMessenger::send_midi_cc(const uint8_t *midi_get,
-                                    const uint8_t _num) noexcept {
-    for(int i = 0; i < max_midi_cc_cnt; i++) {
-        if (send_cc[i].load(std::memory_order_acquire)) {
-            if (cc_num[i] == midi_get[0] && pg_num[i] == midi_get[1] &&
-                bg_num[i] == midi_get[2] && me_num[i] == _num)
-                return true;
-        } else if (!send_cc[i].load(std::memory_order_acquire)) {
-            cc_num[i] = midi_get[0];
-            pg_num[i] = midi_get[1];
-            bg_num[i] = midi_get[2];
-            me_num[i] = _num;
-            send_cc[i].store(true, std::memory_order_release);
-            return true;
-        }
-    }
-    return false;
-}
-
 /****************************************************************
  ** class XAlsa
  **
@@ -81,18 +31,21 @@ bool XAlsaMidiMessenger::send_midi_cc(const uint8_t *midi_get,
  ** forward jack midi to alsa midi
  */
 
-XAlsa::XAlsa(std::function<void(
-        int _cc, int _pg, int _bgn, int _num, bool have_channel) > 
-        send_to_jack_,
+XAlsa::XAlsa(std::function<void(const uint8_t*, uint8_t, uint32_t) > send_to_jack_,
         std::function<void(const uint8_t*,uint8_t) > send_to_midimapper_) 
     :send_to_jack(send_to_jack_),
     send_to_midimapper(send_to_midimapper_),
-    xamessage(),
     _execute(false),
-    _execute_out(false) {
+    _execute_out(false),
+    raw([this] (const uint8_t* m, uint8_t n) {
+        xalsa_forward(m, n, frame_time ? frame_time() : 0, miditransform::SRC_RAW);}) {
     sequencer = -1;
     in_port = -1;
     out_port = -1;
+    queue = -1;
+    batch_real = 0;
+    batch_frame = 0;
+    samplerate = 0;
     mmap = 0;
     prio = 10;
 }
@@ -105,6 +58,8 @@ XAlsa::~XAlsa() {
         snd_seq_delete_simple_port(seq_handle, in_port);
     if (out_port < 0)
         snd_seq_delete_simple_port(seq_handle, out_port);
+    if (queue >= 0)
+        snd_seq_free_queue(seq_handle, queue);
     if (sequencer == 0)
         snd_seq_close(seq_handle);
 }
@@ -122,12 +77,20 @@ int XAlsa::xalsa_init(const char *client_name, const char *input, const char *ou
     if (in_port < 0) {
         snd_seq_close(seq_handle);
         sequencer = -1;
+        return sequencer;
+    }
+    // a running real time queue, output is scheduled on it ahead of time
+    queue = snd_seq_alloc_named_queue(seq_handle, client_name);
+    if (queue >= 0) {
+        snd_seq_start_queue(seq_handle, queue, NULL);
+        snd_seq_drain_output(seq_handle);
     }
     return sequencer;
 }
 
 void XAlsa::xalsa_set_priority(int priority) {
     prio = priority/2;
+    raw.xrawmidi_set_priority(priority);
 }
 
 void XAlsa::xalsa_get_ports(std::vector<std::string> *iports, std::vector<std::string> *oports) {
@@ -252,26 +215,70 @@ void XAlsa::xalsa_odisconnect(int client, int port) {
     snd_seq_disconnect_to(seq_handle, out_port, client, port);
 }
 
+void XAlsa::xalsa_loopback(bool connect) {
+    if (sequencer < 0) return;
+    if (connect) snd_seq_connect_from(seq_handle, in_port, snd_seq_client_id(seq_handle), out_port);
+    else snd_seq_disconnect_from(seq_handle, in_port, snd_seq_client_id(seq_handle), out_port);
+}
+
 void XAlsa::xalsa_stop() {
     _execute.store(false, std::memory_order_release);
     if (_thd.joinable()) {
         _thd.join();
     }
     _execute_out.store(false, std::memory_order_release);
+    sig_out.notify();
     if (_thd_out.joinable()) {
         _thd_out.join();
     }
+    raw.xrawmidi_stop();
 }
 
-void XAlsa::xalsa_start(std::function<void(int,int,bool)> set_key) {
-    xalsa_start_input(set_key);
+void XAlsa::xalsa_start(std::function<void(int,int,bool)> set_key_) {
+    set_key = set_key_;
+    xalsa_start_input();
     xalsa_start_output();
+    raw.xrawmidi_start();
 }
 
-void XAlsa::xalsa_output_notify(const uint8_t *midi_get, uint8_t num) noexcept {
+void XAlsa::xalsa_output_notify(const uint8_t *midi_get, uint8_t num, uint32_t time) noexcept {
     if (is_running()) {
-        if (xamessage.send_midi_cc(midi_get, num))
-            cv_out.notify_one();
+        if (xamessage.push(midi_get, num, time))
+            sig_out.notify();
+    }
+    // rawmidi can't schedule, it goes out now
+    raw.xrawmidi_output_notify(midi_get, num);
+}
+
+// jack hand over the frame time the event is played on the jack port, so
+// the kernel could deliver it at the same moment. Events without time, or
+// which are already late, are send direct.
+void XAlsa::xalsa_schedule(snd_seq_event_t *ev, uint32_t time) {
+    const int32_t frames = (int32_t)(time - batch_frame);
+    if (!time || queue < 0 || !samplerate || frames <= 0) {
+        snd_seq_ev_set_direct(ev);
+        return;
+    }
+    const int64_t real = batch_real + (int64_t)frames * 1000000000LL / samplerate;
+    snd_seq_real_time_t rt;
+    rt.tv_sec = real / 1000000000LL;
+    rt.tv_nsec = real % 1000000000LL;
+    snd_seq_ev_schedule_real(ev, queue, 0, &rt);
+}
+
+// put a event into the sequencer output buffer, the handle is blocking,
+// so alsa drain a full buffer itself
+void XAlsa::xalsa_output(snd_seq_event_t *ev) {
+    if (snd_seq_event_output(seq_handle, ev) < 0) {
+        snd_seq_drop_output(seq_handle);
+    }
+}
+
+// flush the sequencer output buffer once per batch, on error drop it,
+// so a vanished subscriber can't wedge the thread
+void XAlsa::xalsa_drain() {
+    if (snd_seq_drain_output(seq_handle) < 0) {
+        snd_seq_drop_output(seq_handle);
     }
 }
 
@@ -285,20 +292,27 @@ void XAlsa::xalsa_start_output() {
         sch.sched_priority = prio;
         pthread_setschedparam(_thd_out.native_handle(), SCHED_FIFO, &sch);
         snd_seq_event_t ev;
-        uint8_t event[3] = {0};
+        midiqueue::MidiQueue<256>::Event qev;
+        const uint8_t *event = qev.data;
+        snd_seq_queue_status_t *status;
+        snd_seq_queue_status_malloc(&status);
         while (_execute_out.load(std::memory_order_acquire)) {
-            std::unique_lock<std::mutex> lk(m);
-            cv_out.wait(lk);
+            sig_out.wait();
             //do output
             if (_execute_out.load(std::memory_order_acquire)) {
-                int i = xamessage.next();
-                while ( i>=0) {
-                    xamessage.fill(event, i);
+                // map jack frame time to queue time once per batch
+                if (queue >= 0 && frame_time) {
+                    batch_frame = frame_time();
+                    snd_seq_get_queue_status(seq_handle, queue, status);
+                    const snd_seq_real_time_t *rt = snd_seq_queue_status_get_real_time(status);
+                    batch_real = (int64_t)rt->tv_sec * 1000000000LL + rt->tv_nsec;
+                }
+                while (xamessage.pop(&qev)) {
                     uint8_t channel = event[0]&0x0f;
                     uint8_t num = event[0] & 0xf0;
                     snd_seq_ev_clear(&ev);
                     snd_seq_ev_set_subs(&ev);
-                    snd_seq_ev_set_direct(&ev);
+                    xalsa_schedule(&ev, qev.time);
 
                     if (num == 0x90) {
                         snd_seq_ev_set_noteon(&ev, channel, event[1], event[2]);
@@ -310,10 +324,9 @@ void XAlsa::xalsa_start_output() {
                             for(int i = 0; i<16;i++) {
                                 snd_seq_ev_clear(&ev);
                                 snd_seq_ev_set_subs(&ev);
-                                snd_seq_ev_set_direct(&ev);
+                                xalsa_schedule(&ev, qev.time);
                                 snd_seq_ev_set_controller(&ev, i, event[1], event[2]);
-                                snd_seq_event_output(seq_handle, &ev);
-                                snd_seq_drain_output(seq_handle);
+                                xalsa_output(&ev);
                             }
                         } else {
                             snd_seq_ev_set_controller(&ev, channel, event[1], event[2]);
@@ -324,67 +337,109 @@ void XAlsa::xalsa_start_output() {
                         snd_seq_ev_set_pitchbend(&ev, channel, ((event[2] <<7 | event[1]) -8192));
                     }
 
-                    // send now
-                    snd_seq_event_output(seq_handle, &ev);
-                    snd_seq_drain_output(seq_handle);
-                    i = xamessage.next();
+                    // queue into the sequencer output buffer
+                    xalsa_output(&ev);
                 }
+                // send the whole batch at once
+                xalsa_drain();
             }
         } 
+        snd_seq_queue_status_free(status);
     });
 }            
 
-void XAlsa::xalsa_start_input(std::function<void(int,int,bool)> set_key) {
+// run a received message through the transform rules
+void XAlsa::xalsa_forward(const uint8_t *event, uint8_t num, uint32_t time, int source) {
+    if (!transform) {
+        xalsa_route(event, num, time);
+        return;
+    }
+    uint8_t out[miditransform::max_out][3];
+    const int count = transform(source, event, num, out);
+    for (int i = 0; i < count; i++) xalsa_route(out[i], num, time);
+}
+
+// forward a message to jack, or notes to the midimapper when it's active
+void XAlsa::xalsa_route(const uint8_t *event_, uint8_t num, uint32_t time) {
+    uint8_t event[3] = {event_[0], num > 1 ? event_[1] : uint8_t(0), num > 2 ? event_[2] : uint8_t(0)};
+    const uint8_t status = event[0] & 0xf0;
+    const uint8_t channel = event[0] & 0x0f;
+    if (status == 0x90 || status == 0x80) {
+        if (mmap) {
+            if (velocity) velocity(velocitycurve::VEL_MAPPER, event, num);
+            // the mapper expect velocity 0 as note off
+            const uint8_t note[3] = {uint8_t((status == 0x90 && event[2] ? 0x90 : 0x80) | channel),
+                                     event[1], event[2]};
+            send_to_midimapper(note, 3);
+            return;
+        }
+        if (velocity) velocity(velocitycurve::VEL_ALSA, event, num);
+        send_to_jack(event, num, time);
+        set_key(channel, event[1], status == 0x90 && event[2]);
+        return;
+    }
+    send_to_jack(event, num, time);
+}
+
+// convert a received sequencer event to midi
+void XAlsa::xalsa_input(const snd_seq_event_t *ev) {
+    // stamp on receipt, so jack could place it at the right frame
+    const uint32_t time = frame_time ? frame_time() : 0;
+    uint8_t event[3] = {0};
+    if (ev->type == SND_SEQ_EVENT_NOTEON) {
+        event[0] = 0x90 | ev->data.control.channel;
+        event[1] = ev->data.note.note;
+        event[2] = ev->data.note.velocity;
+        xalsa_forward(event, 3, time, miditransform::SRC_ALSA);
+    } else if (ev->type == SND_SEQ_EVENT_NOTEOFF) {
+        event[0] = 0x80 | ev->data.control.channel;
+        event[1] = ev->data.note.note;
+        event[2] = ev->data.note.velocity;
+        xalsa_forward(event, 3, time, miditransform::SRC_ALSA);
+    } else if(ev->type == SND_SEQ_EVENT_CONTROLLER) {
+        event[0] = 0xB0 | ev->data.control.channel;
+        event[1] = ev->data.control.param;
+        event[2] = ev->data.control.value;
+        xalsa_forward(event, 3, time, miditransform::SRC_ALSA);
+    } else if(ev->type == SND_SEQ_EVENT_PGMCHANGE) {
+        event[0] = 0xC0 | ev->data.control.channel;
+        event[1] = ev->data.control.value;
+        xalsa_forward(event, 2, time, miditransform::SRC_ALSA);
+    } else if(ev->type == SND_SEQ_EVENT_PITCHBEND) {
+        unsigned int change = (unsigned int)(ev->data.control.value + 8192);
+        event[0] = 0xE0 | ev->data.control.channel;
+        event[1] = change & 0x7f;  // Low 7 bits
+        event[2] = (change >> 7) & 0x7f;  // High 7 bits
+        xalsa_forward(event, 3, time, miditransform::SRC_ALSA);
+    }
+}
+
+void XAlsa::xalsa_start_input() {
     if( _execute.load(std::memory_order_acquire) ) {
         xalsa_stop();
     };
     _execute.store(true, std::memory_order_release);
-    _thd = std::thread([this, set_key]() {
+    _thd = std::thread([this]() {
         sched_param sch;
         sch.sched_priority = prio;
         pthread_setschedparam(_thd.native_handle(), SCHED_FIFO, &sch);
-        uint8_t event[3] = {0};
+        if (sequencer < 0) {
+            _execute.store(false, std::memory_order_release);
+            return;
+        }
+        const int nfds = snd_seq_poll_descriptors_count(seq_handle, POLLIN);
+        std::vector<pollfd> pfds(nfds);
+        snd_seq_poll_descriptors(seq_handle, pfds.data(), nfds, POLLIN);
         while (_execute.load(std::memory_order_acquire)) {
-            if (sequencer < 0) {
-                _execute.store(false, std::memory_order_release);
-                continue;
-            }
-            snd_seq_event_t *ev = NULL;
-            snd_seq_event_input(seq_handle, &ev);
-            if (ev->type == SND_SEQ_EVENT_NOTEON) {
-                if (mmap) {
-                    event[0] = ev->data.note.velocity ? 0x90 | ev->data.control.channel : 0x80 | ev->data.control.channel;
-                    event[1] = ev->data.note.note;
-                    event[2] = ev->data.note.velocity;
-                    send_to_midimapper(event, 3);
-                } else {
-                    send_to_jack(0x90 | ev->data.control.channel, ev->data.note.note,ev->data.note.velocity, 3, true);
-                    if (ev->data.note.velocity)
-                        set_key(ev->data.control.channel, ev->data.note.note, true);
-                    else
-                        set_key(ev->data.control.channel, ev->data.note.note, false);
-                }
-            } else if (ev->type == SND_SEQ_EVENT_NOTEOFF) {
-                if (mmap) {
-                    event[0] = 0x80 | ev->data.control.channel;
-                    event[1] = ev->data.note.note;
-                    event[2] = ev->data.note.velocity;
-                    send_to_midimapper(event, 3);
-                } else {
-                    send_to_jack(0x80 | ev->data.control.channel, ev->data.note.note,ev->data.note.velocity, 3, true);
-                    set_key(ev->data.control.channel, ev->data.note.note, false);
-                }
-            } else if(ev->type == SND_SEQ_EVENT_CONTROLLER) {
-                send_to_jack(0xB0 | ev->data.control.channel, ev->data.control.param, ev->data.control.value, 3, true);
-            } else if(ev->type == SND_SEQ_EVENT_PGMCHANGE) {
-                send_to_jack( 0xC0| ev->data.control.channel, ev->data.control.value, 0, 2, true);
-            } else if(ev->type == SND_SEQ_EVENT_PITCHBEND) {
-                unsigned int change = (unsigned int)(ev->data.control.value);
-                unsigned int low = change & 0x7f;  // Low 7 bits
-                unsigned int high = (change >> 7) & 0x7f;  // High 7 bits
-                send_to_jack(0xE0| ev->data.control.channel,  low, high, 3, true);
-            }
-            snd_seq_free_event(ev);
+            // time out now and then to see if we should stop
+            if (poll(pfds.data(), nfds, 100) <= 0) continue;
+            // read all events which arrived together in one go
+            do {
+                snd_seq_event_t *ev = NULL;
+                if (snd_seq_event_input(seq_handle, &ev) < 0 || !ev) break;
+                xalsa_input(ev);
+                snd_seq_free_event(ev);
+            } while (snd_seq_event_input_pending(seq_handle, 0) > 0);
         } 
     });
 }
@@ -25,8 +25,15 @@
 #include <condition_variable>
 #include <functional>
 
+#include <poll.h>
+
 #include <alsa/asoundlib.h>
 
+#include "MidiQueue.h"
+#include "XRawMidi.h"
+#include "MidiTransform.h"
+#include "VelocityCurve.h"
+
 
 #pragma once
 
@@ -36,29 +43,6 @@
 namespace xalsa {
 
 
-/****************************************************************
- ** class MidiMessenger
- **
- ** collect all midi events from jack_midi and send to alsa midi out buffer
- */
-
-class XAlsaMidiMessenger {
-private:
-    static const int max_midi_cc_cnt = 25;
-    std::atomic<bool> send_cc[max_midi_cc_cnt];
-    uint8_t cc_num[max_midi_cc_cnt];
-    uint8_t pg_num[max_midi_cc_cnt];
-    uint8_t bg_num[max_midi_cc_cnt];
-    uint8_t me_num[max_midi_cc_cnt];
-public:
-    XAlsaMidiMessenger();
-    int channel;
-    bool send_midi_cc(const uint8_t *midi_get, const uint8_t _num) noexcept;
-    int next(int i = -1) const noexcept;
-    inline uint8_t size(const int i)  const noexcept { return me_num[i]; }
-    void fill(uint8_t *midi_send, const int i) noexcept;
-};
-
 /****************************************************************
  ** class XAlsa
  **
@@ -68,14 +52,12 @@ public:
 
 class XAlsa {
 private:
-    // send midi message to the 'queue' for jack midi output
-    std::function<void(
-        int _cc, int _pg, int _bgn, int _num, bool have_channel) >
-        send_to_jack;
+    // send midi message with its jack frame time to the 'queue' for jack midi output
+    std::function<void(const uint8_t*, uint8_t, uint32_t) > send_to_jack;
     // send midi message to the 'queue' for the midi mapper
     std::function<void(const uint8_t*,uint8_t) > send_to_midimapper;
     // the midi message 'queue' for alsa midi output
-    XAlsaMidiMessenger xamessage;
+    midiqueue::MidiQueue<256> xamessage;
     // the sequencer
     snd_seq_t *seq_handle;
     // ident if sequencer starts successfully
@@ -84,6 +66,11 @@ private:
     int in_port;
     // output port number
     int out_port;
+    // sequencer queue used to schedule the output
+    int queue;
+    // queue real time and jack frame time at the start of the current output batch
+    int64_t batch_real;
+    uint32_t batch_frame;
     // control the midi input loop
     std::atomic<bool> _execute;
     // thread running the midi input loop
@@ -91,22 +78,33 @@ private:
     // control the midi output loop
     std::atomic<bool> _execute_out;
     // wait for notify in the midi output loop
-    std::condition_variable cv_out;
+    midiqueue::QueueSignal sig_out;
     // thread running the midi output loop
     std::thread _thd_out;
-    // the mutex for the lock in the midi output loop
-    std::mutex m;
     // start the thread for midi input handling
-    void xalsa_start_input(std::function<void(int,int,bool)> set_key);
+    void xalsa_start_input();
+    // show incoming notes on the keyboard
+    std::function<void(int,int,bool)> set_key;
+    // forward a received midi message from source
+    void xalsa_forward(const uint8_t *event, uint8_t num, uint32_t time, int source);
+    // send a transformed message to jack or the midimapper
+    void xalsa_route(const uint8_t *event, uint8_t num, uint32_t time);
+    // forward a received sequencer event
+    void xalsa_input(const snd_seq_event_t *ev);
     // start the port for midi output handling
     void xalsa_start_output();
+    // schedule a event on the queue at jack frame time, or send it direct
+    void xalsa_schedule(snd_seq_event_t *ev, uint32_t time);
+    // put a event into the sequencer output buffer
+    void xalsa_output(snd_seq_event_t *ev);
+    // write the sequencer output buffer to the subscribers
+    void xalsa_drain();
     // priority for the i/o threads
     int prio;
 
 public:
-    XAlsa(std::function<void(
-        int _cc, int _pg, int _bgn, int _num, bool have_channel)>
-        send_to_jack, std::function<void(const uint8_t*,uint8_t) > send_to_midimapper);
+    XAlsa(std::function<void(const uint8_t*, uint8_t, uint32_t) > send_to_jack,
+        std::function<void(const uint8_t*,uint8_t) > send_to_midimapper);
     ~XAlsa();
     // get all available ports for alsa midi in/output
     void xalsa_get_ports(std::vector<std::string> *ports,
@@ -123,18 +121,33 @@ public:
     void xalsa_oconnect(int client, int port);
     // disconnect the output port from 'port'
     void xalsa_odisconnect(int client, int port);
+    // connect the own output port to the input port
+    void xalsa_loopback(bool connect);
     // init the sequencer and create ports
     int  xalsa_init(const char *client_name, const char *input, const char *output);
     // start the threads for alsa midi handling
     void xalsa_start(std::function<void(int,int,bool)> set_key);
     // stop the threads for alsa midi handling
     void xalsa_stop();
-    // push mdi message from jack into 'queue' and inform output thread that work is to do
-    void xalsa_output_notify(const uint8_t *midi_get, uint8_t num) noexcept;
+    // push mdi message from jack into 'queue' and inform output thread that work is to do,
+    // time is the jack frame time the message should be played, 0 means now
+    void xalsa_output_notify(const uint8_t *midi_get, uint8_t num, uint32_t time = 0) noexcept;
+    // events dropped because the output 'queue' was full
+    uint32_t get_overflows() const noexcept { return xamessage.get_overflows(); }
     // set the priority for the I/O threads
     void xalsa_set_priority(int priority);
     // set to 1 to use midimapper
     int mmap;
+    // the jack frame time used to stamp incoming events, set before xalsa_start()
+    std::function<uint32_t() > frame_time;
+    // apply the midi transform rules, set before xalsa_start()
+    std::function<int(int, const uint8_t*, uint8_t, uint8_t (*)[3]) > transform;
+    // apply the velocity curve of a source to a note on, set before xalsa_start()
+    std::function<void(int, uint8_t*, uint8_t) > velocity;
+    // the jack sample rate, used to convert frames to queue time
+    unsigned int samplerate;
+    // direct rawmidi I/O for hardware ports
+    xrawmidi::XRawMidi raw;
     // check if the sequencer is running
     bool is_running() const noexcept;
 };
@@ -85,20 +85,27 @@ bool MidiClockToBpm::time_to_bpm(double time, unsigned int* bpm_) {
  */
 
 XJack::XJack(mamba::MidiMessenger *mmessage_,
-        std::function<void(const uint8_t*,uint8_t) >  send_to_alsa_,
+        std::function<void(const uint8_t*,uint8_t,uint32_t) >  send_to_alsa_,
         std::function<void(int)>  set_alsa_priority_,
-        std::function<void(const uint8_t*,uint8_t) >  send_to_midimapper_,
-        std::function<void(int)>  set_midimapper_priority_)
+        std::function<const midimapper::KbmTable*() >  acquire_kbm_table_,
+        std::function<void(int)>  set_midimapper_priority_,
+        std::function<const miditransform::TransformTable*() >  acquire_transform_,
+        std::function<const velocitycurve::VelocityTable*() >  acquire_velocity_,
+        std::function<void() >  wake_ui_)
     : sigc::trackable(),
      mmessage(mmessage_),
      mp(),
      send_to_alsa(send_to_alsa_),
      set_alsa_priority(set_alsa_priority_),
-     send_to_midimapper(send_to_midimapper_),
+     acquire_kbm_table(acquire_kbm_table_),
      set_midimapper_priority(set_midimapper_priority_),
+     acquire_transform(acquire_transform_),
+     acquire_velocity(acquire_velocity_),
+     wake_ui(wake_ui_),
      event_count(0),
+     alsa_frame(0),
+     ui_changed(false),
      stop(0),
-     deltaTime(0),
      client(NULL),
      rec() {
         transport_state_changed.store(false, std::memory_order_release);
@@ -110,36 +117,40 @@ XJack::XJack(mamba::MidiMessenger *mmessage_,
         record_finished.store(0, std::memory_order_release);
         record.store(0, std::memory_order_release);
         play.store(0, std::memory_order_release);
-        start = 0;
         NotOn = 0;
         absoluteStart = 0;
-        absoluteRecordTime = 0.0;
-        absoluteRecordStart = 0.0;
+        absoluteTime = 0;
+        absoluteRecordTime = 0;
+        absoluteRecordStart = 0;
         pos = 0;
         bank = 0;
         program = 0;
         freewheel = 0;
         view_channels = 0;
-        max_loop_time = 0;
-        playPosTime = 0.0;
+        max_loop_ticks = 0;
+        playPosTime = 0;
         fresh_take = true;
         first_play = true;
         second_play = false;
         midi_through = 1;
-        store1.reserve(256);
-        store2.reserve(256);
-        st = &store1;
-        rec.st = &store1;
+        capturing = false;
+        capture_flushed.store(true, std::memory_order_release);
         client_name = "Mamba";
-        bpm_ratio = 1.0;
+        timebase_generation = timebase.get_generation();
         stPlay = 0;
         stStart = 0;
         rcStart = 0;
         priority = -1;
+        note_overflows = 0;
         midi_map = 0;
         for ( int i = 0; i < 16; i++) posPlay[i] = 0;
         for ( int i = 0; i < 16; i++) startPlay[i] = 0;
-        for ( int i = 0; i < 16; i++) stopPlay[i] = 0;
+        for ( int i = 0; i < 16; i++) loopStart[i] = 0;
+        scheduled_count = 0;
+        loops = rec.loops.rt_acquire();
+        curves = acquire_velocity();
+        tap = nullptr;
+        probe.store(nullptr, std::memory_order_release);
         for ( int i = 0; i < 16; i++) channel_matrix[i].store(0, std::memory_order_release);
 }
 
@@ -170,6 +181,7 @@ int XJack::init_jack() {
         return 0;
     }
     client_name = jack_get_client_name(client);
+    stats.set_period(jack_get_buffer_size(client), jack_get_sample_rate(client));
     if (!jack_is_realtime(client)) {
         fprintf (stderr, "jack isn't running with realtime priority\n");
     } else {
@@ -185,40 +197,32 @@ int XJack::init_jack() {
 
 // record MIDI events 
 inline void XJack::record_midi(unsigned char* midi_send, unsigned int n, int i) noexcept {
+    // sysex can't be stored in the loop
+    if (!mamba::EventStore::message_size(midi_send[0])) return;
+    const dspstats::Stage stage = stats.enter(dspstats::RECORD);
     stop = jack_last_frame_time(client)+n;
-    deltaTime = (double)(((stop) - start)/(double)SampleRate); // seconds
-    absoluteTime = (double)(((stop) - absoluteStart)/(double)SampleRate); // seconds
-    absoluteRecordTime = (double)(((stop) - absoluteRecordStart)/(double)SampleRate); // seconds
-    start = jack_last_frame_time(client)+n;
+    absoluteTime = timebase.frames_to_ticks(stop - absoluteStart);
+    absoluteRecordTime = timebase.frames_to_ticks(stop - absoluteRecordStart);
     if (((midi_send[0] & 0xf0) == 0x90) && midi_send[2] > 0) NotOn++;
     else if (((midi_send[0] & 0xf0) == 0x90) && midi_send[2] == 0) NotOn--;
     else if ((midi_send[0] & 0xf0) == 0x80) NotOn--;
-    if (absoluteRecordTime >= max_loop_time && !NotOn && (get_max_time_loop() > -1)) {
-        record_off.store(true, std::memory_order_release);
+    if (!freewheel && absoluteRecordTime >= max_loop_ticks && !NotOn && (get_max_time_loop() > -1)) {
+        raise_flag(record_off);
     }
     unsigned char d = i > 2 ? midi_send[2] : 0;
-    const mamba::MidiEvent ev = {{midi_send[0], midi_send[1], d}, i, deltaTime, absoluteTime};
-    st->push_back(ev);
-    if (store1.size() >= 256) {
-        st = &store2;
-        rec.st = &store1;
-        rec.cv.notify_one();
-    } else if (store2.size() >= 256) {
-        st = &store1;
-        rec.st = &store2;
-        rec.cv.notify_one();
-    }
+    const mamba::MidiEvent ev = {{midi_send[0], midi_send[1], d}, i, absoluteTime};
+    if (rec.capture.push(ev)) rec.sig.notify();
+    stats.enter(stage);
 }
 
 // get the master loop
 inline int XJack::get_max_time_loop() noexcept {
     int v = -1;
-     max_loop_time = 0.0;
+    max_loop_ticks = 0;
     for (int j = 0; j<16;j++) {
-        if (!rec.play[j].size()) continue;
-        const mamba::MidiEvent ev = rec.play[j][rec.play[j].size()-1];
-        if (ev.absoluteTime > max_loop_time) {
-            max_loop_time = ev.absoluteTime;
+        if (!loops->size(j)) continue;
+        if (loops->back_time(j) > max_loop_ticks) {
+            max_loop_ticks = loops->back_time(j);
             v = j;
         }
     }
@@ -227,115 +231,216 @@ inline int XJack::get_max_time_loop() noexcept {
 
 // sync fresh recorded vector to play position
 inline int XJack::find_pos_for_playtime() noexcept {
-    int pos = 0;
-    for(std::vector<mamba::MidiEvent>::const_iterator i = rec.play[mmessage->channel].begin();
-                                    i != rec.play[mmessage->channel].end(); ++i) {
-        if ((*i).absoluteTime >= playPosTime) return pos;
-        pos++;
+    return loops->channel(mmessage->channel).find_time(playPosTime);
+}
+
+// set a flag for the GUI, wake it only when the flag wasn't already set
+inline void XJack::raise_flag(std::atomic<bool>& flag) noexcept {
+    if (!flag.exchange(true, std::memory_order_acq_rel)) ui_changed = true;
+}
+
+// pass a note event to the GUI
+inline void XJack::push_note(uint8_t channel, uint8_t key, bool on) noexcept {
+    note_events.push(channel, key, on);
+    ui_changed = true;
+}
+
+// insert a loop event into the period schedule, keep it sorted by frame offset
+inline void XJack::schedule_event(jack_nframes_t offset, const mamba::MidiEvent& ev,
+                    bool through, const jack_midi_data_t *data, size_t size) noexcept {
+    unsigned int j = scheduled_count;
+    while (j > 0 && scheduled[j-1].offset > offset) {
+        scheduled[j] = scheduled[j-1];
+        j--;
     }
-    return pos;
+    scheduled[j].offset = offset;
+    scheduled[j].ev = ev;
+    scheduled[j].through = through;
+    scheduled[j].data = data;
+    scheduled[j].size = size;
+    scheduled_count++;
 }
 
-// play all MIDI loops
-inline void XJack::play_midi(void *buf, unsigned int n) {
+// collect all loop events due in [cycle_start, cycle_start+nframes) from all channels
+inline void XJack::schedule_loops(jack_nframes_t nframes) noexcept {
+    const jack_nframes_t cycle_start = jack_last_frame_time(client);
+    const jack_nframes_t cycle_end = cycle_start + nframes;
     if (first_play) {
         first_play = false;
-        get_max_time_loop();
-        pos = 0;
         for (int i = 0; i < 16; i++) posPlay[i] = 0;
-        for (int i = 0; i < 16; i++) startPlay[i] = jack_last_frame_time(client)+n;
-        start = jack_last_frame_time(client)+n;
-        absoluteStart = jack_last_frame_time(client)+n;
-        stStart = jack_last_frame_time(client)+n;
+        for (int i = 0; i < 16; i++) startPlay[i] = cycle_start;
+        for (int i = 0; i < 16; i++) loopStart[i] = cycle_start;
+        absoluteStart = cycle_start;
+        stStart = cycle_start;
     } else if (second_play) {
         second_play = false;
-        stStart = jack_last_frame_time(client)+n - (stPlay - stStart);
+        stStart = cycle_start - (stPlay - stStart);
     }
-
-    for ( int i = 0; i < 16; i++) {
-        stPlay = jack_last_frame_time(client)+n;
-        if (!rec.play[i].size()) continue;
-        if (record.load(std::memory_order_acquire) && i == mmessage->channel) continue;
-        stopPlay[i] = jack_last_frame_time(client)+n;
-        if (posPlay[i] >= rec.play[i].size()) {
-            
-            // this will sync all loops to the first recorded one
-            if (!freewheel) {
-                int ml = get_max_time_loop();
-                if (i != ml) continue;
-                for (int i = 0; i < 16; i++) posPlay[i] = 0;
-                for (int i = 0; i < 16; i++) startPlay[i] = jack_last_frame_time(client)+n;
-                start = jack_last_frame_time(client)+n;
-                absoluteStart = jack_last_frame_time(client)+n;
-                stStart = jack_last_frame_time(client)+n;
-            } else {
-                posPlay[i] = 0;
-                startPlay[i] = jack_last_frame_time(client)+n;
-            }
+    stPlay = cycle_end;
+
+    // on tempo change move the loop start, so that the loops continue
+    // from the last played event with the new tempo
+    const uint32_t generation = timebase.get_generation();
+    if (generation != timebase_generation) {
+        timebase_generation = generation;
+        for (int i = 0; i < 16; i++) {
+            if (!posPlay[i] || posPlay[i] > loops->size(i)) continue;
+            loopStart[i] = startPlay[i] -
+                timebase.ticks_to_frames(loops->get_time(i, posPlay[i]-1));
         }
-        deltaTime = (double)(((stopPlay[i]) - startPlay[i])/(double)SampleRate); // seconds
-        const mamba::MidiEvent ev = rec.play[i][posPlay[i]];
-        if (deltaTime >= ev.deltaTime * bpm_ratio) {
-            playPosTime = ev.absoluteTime;
-            // check if channel is muted
-            if (!channel_matrix[int(ev.buffer[0]&0x0f)].load(std::memory_order_acquire) ||
-                                                        ((ev.buffer[0] & 0xf0) == 0x80 )) {
-                unsigned char* midi_send = jack_midi_event_reserve(buf, n, ev.num);
-                if (midi_send) {
-                    midi_send[0] = ev.buffer[0];
-                    midi_send[1] = ev.buffer[1];
-                    if(ev.num > 2)
-                        midi_send[2] = ev.buffer[2];
-                    bool ch = true;
-                    if (mmessage->channel < 16 && view_channels) {
-                        if ((mmessage->channel) != (int(ev.buffer[0]&0x0f))) {
-                            ch = false;
-                        }
-                    }
-                    send_to_alsa(midi_send, ev.num);
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-result"
-                    if ((ev.buffer[0] & 0xf0) == 0x90 && ch) {   // Note On
-                        if (ev.buffer[2] > 0) // velocity 0 treaded as Note Off
-                            std::async(std::launch::async, trigger_get_midi_in, (int(ev.buffer[0]&0x0f)), ev.buffer[1], true);
-                        else 
-                            std::async(std::launch::async, trigger_get_midi_in, (int(ev.buffer[0]&0x0f)), ev.buffer[1], false);
-                    } else if ((ev.buffer[0] & 0xf0) == 0x80 && ch) {   // Note Off
-                        std::async(std::launch::async, trigger_get_midi_in, (int(ev.buffer[0]&0x0f)), ev.buffer[1], false);
+    }
+
+    // this will sync all loops to the first recorded one
+    const int ml = get_max_time_loop();
+    jack_nframes_t last_restart = cycle_start;
+    bool have_restart = false;
+    bool restart = true;
+    while (restart) {
+        restart = false;
+        for (int i = 0; i < 16; i++) {
+            if (!loops->size(i)) continue;
+            if (record.load(std::memory_order_acquire) && i == mmessage->channel) continue;
+            while (scheduled_count < max_scheduled) {
+                if (posPlay[i] >= loops->size(i)) {
+                    if (!freewheel) {
+                        if (i != ml) break;
+                        // a loop without length can't restart in the same period twice
+                        if (have_restart && (int32_t)(startPlay[i] - last_restart) <= 0) break;
+                        last_restart = startPlay[i];
+                        have_restart = true;
+                        for (int j = 0; j < 16; j++) posPlay[j] = 0;
+                        for (int j = 0; j < 16; j++) startPlay[j] = last_restart;
+                        for (int j = 0; j < 16; j++) loopStart[j] = last_restart;
+                        absoluteStart = last_restart;
+                        stStart = last_restart;
+                        // rescan all channels from the restart point
+                        restart = true;
+                        break;
+                    } else {
+                        loopStart[i] = startPlay[i];
+                        posPlay[i] = 0;
                     }
-#pragma GCC diagnostic pop
                 }
+                // the absolute loop time avoids accumulating rounding errors
+                const jack_nframes_t due = loopStart[i] + timebase.ticks_to_frames(loops->get_time(i, posPlay[i]));
+                if ((int32_t)(due - cycle_end) >= 0) break;
+                const mamba::MidiEvent ev = loops->at(i, posPlay[i]);
+                // late events go out at the start of the period
+                const jack_nframes_t offset = (int32_t)(due - cycle_start) > 0 ? due - cycle_start : 0;
+                schedule_event(offset, ev);
+                playPosTime = ev.absoluteTime;
+                startPlay[i] = due;
+                posPlay[i]++;
             }
-            startPlay[i] = jack_last_frame_time(client)+n;
-            posPlay[i]++;
-            return;
+            if (restart) break;
         }
     }
 }
 
+// pass a event from the midi input to the output
+inline void XJack::pass_midi(void *buf, jack_nframes_t offset, const mamba::MidiEvent& ev) {
+    unsigned char* midi_send = jack_midi_event_reserve(buf, offset, ev.num);
+    if (!midi_send) return;
+    memcpy(midi_send, ev.buffer, ev.num);
+    if (record.load(std::memory_order_acquire))
+        record_midi(midi_send, offset, ev.num);
+    send_to_alsa(midi_send, ev.num, alsa_frame + offset);
+}
+
+// pass a sysex or other long message from the midi input to the output,
+// it isn't mapped or recorded
+inline void XJack::pass_long(void *buf, jack_nframes_t offset,
+                            const jack_midi_data_t *data, size_t size) {
+    unsigned char* midi_send = jack_midi_event_reserve(buf, offset, size);
+    if (midi_send) memcpy(midi_send, data, size);
+}
+
+// play a MIDI loop event
+inline void XJack::play_midi(void *buf, jack_nframes_t offset, const mamba::MidiEvent& ev) {
+    // check if channel is muted
+    if (channel_matrix[int(ev.buffer[0]&0x0f)].load(std::memory_order_acquire) &&
+                                                ((ev.buffer[0] & 0xf0) != 0x80 )) return;
+    unsigned char* midi_send = jack_midi_event_reserve(buf, offset, ev.num);
+    if (midi_send) {
+        midi_send[0] = ev.buffer[0];
+        midi_send[1] = ev.buffer[1];
+        if(ev.num > 2)
+            midi_send[2] = ev.buffer[2];
+        bool ch = true;
+        if (mmessage->channel < 16 && view_channels) {
+            if ((mmessage->channel) != (int(ev.buffer[0]&0x0f))) {
+                ch = false;
+            }
+        }
+        send_to_alsa(midi_send, ev.num, alsa_frame + offset);
+        if ((ev.buffer[0] & 0xf0) == 0x90 && ch) {   // Note On
+            // velocity 0 treaded as Note Off
+            push_note(ev.buffer[0]&0x0f, ev.buffer[1], ev.buffer[2] > 0);
+        } else if ((ev.buffer[0] & 0xf0) == 0x80 && ch) {   // Note Off
+            push_note(ev.buffer[0]&0x0f, ev.buffer[1], false);
+        }
+    }
+}
+
+// frame offset for a event from the messenger. Stamped events are played
+// exactly one period after they were queued, which gives a constant latency
+// instead of jitter up to a full period. Unstamped events go out now.
+inline jack_nframes_t XJack::message_offset(const mamba::MidiMessenger::Event *e,
+                jack_nframes_t cycle_start, jack_nframes_t nframes) const noexcept {
+    if (!e->time) return 0;
+    const int32_t offset = (int32_t)(e->time + nframes - cycle_start);
+    return offset > 0 ? offset : 0;
+}
+
+// write the front event of the messenger to the jack midi out buffer,
+// when the buffer is full it stay queued for the next cycle
+inline const mamba::MidiMessenger::Event *XJack::send_message(void *buf,
+                unsigned int n, const mamba::MidiMessenger::Event *e) {
+    unsigned char* midi_send = jack_midi_event_reserve(buf, n, e->size);
+    if (!midi_send) return nullptr;
+    memcpy(midi_send, e->data, e->size);
+    // a returning probe must not loop through alsa again
+    if (!tap || !latencybench::ProbeTap::is_probe(midi_send))
+        send_to_alsa(midi_send, e->size, alsa_frame + n);
+    if (record.load(std::memory_order_acquire)) record_midi(midi_send, n, e->size);
+    mmessage->pop();
+    return mmessage->front();
+}
+
 // jack process callback for the midi output
 inline void XJack::process_midi_out(void *buf, jack_nframes_t nframes) {
-    int i = mmessage->next();
-    for (unsigned int n = event_count; n < nframes; n++) {
-        if (i >= 0) {
-            unsigned char* midi_send = jack_midi_event_reserve(buf, n, mmessage->size(i));
-            if (midi_send) {
-                mmessage->fill(midi_send, i);
-                send_to_alsa(midi_send, mmessage->size(i));
-                if (record.load(std::memory_order_acquire)) record_midi(midi_send, n, mmessage->size(i));
-            }
-            i = mmessage->next(i);
-        } else if (play.load(std::memory_order_acquire)) {
-            play_midi(buf, n);
+    if (play.load(std::memory_order_acquire)) schedule_loops(nframes);
+    const jack_nframes_t cycle_start = jack_last_frame_time(client);
+    const mamba::MidiMessenger::Event *e = mmessage->front();
+    // jack wants the events in time order
+    jack_nframes_t n = 0;
+    for (unsigned int s = 0; s < scheduled_count; s++) {
+        // events from the messenger go first when they are due
+        while (e) {
+            const jack_nframes_t offset = message_offset(e, cycle_start, nframes);
+            if (offset > scheduled[s].offset) break;
+            if (offset > n) n = offset;
+            e = send_message(buf, n, e);
         }
+        if (scheduled[s].data) pass_long(buf, scheduled[s].offset, scheduled[s].data, scheduled[s].size);
+        else if (scheduled[s].through) pass_midi(buf, scheduled[s].offset, scheduled[s].ev);
+        else play_midi(buf, scheduled[s].offset, scheduled[s].ev);
+        if (scheduled[s].offset > n) n = scheduled[s].offset;
     }
+    while (e) {
+        const jack_nframes_t offset = message_offset(e, cycle_start, nframes);
+        // not yet due, keep it for the next period
+        if (offset >= nframes) break;
+        if (offset > n) n = offset;
+        e = send_message(buf, n, e);
+    }
+    if (tap) tap->emit(buf, nframes, jack_last_frame_time(client));
     if (record.load(std::memory_order_acquire)) {
         stop = jack_last_frame_time(client);
-        deltaTime = (double)(((stop) - start)/(double)SampleRate); // seconds
-        absoluteTime = (double)(((stop) - absoluteStart)/(double)SampleRate); // seconds
-        absoluteRecordTime = (double)(((stop) - absoluteRecordStart)/(double)SampleRate); // seconds
-        if (absoluteRecordTime >= max_loop_time && !NotOn && (get_max_time_loop() > -1)) {
-            record_off.store(true, std::memory_order_release);
+        absoluteTime = timebase.frames_to_ticks(stop - absoluteStart);
+        absoluteRecordTime = timebase.frames_to_ticks(stop - absoluteRecordStart);
+        if (!freewheel && absoluteRecordTime >= max_loop_ticks && !NotOn && (get_max_time_loop() > -1)) {
+            raise_flag(record_off);
         }
     }
 
@@ -343,8 +448,15 @@ inline void XJack::process_midi_out(void *buf, jack_nframes_t nframes) {
 
 // jack process callback for the midi input
 inline void XJack::process_midi_in(void* buf, void* out_buf) {
+    if (capturing && !record.load(std::memory_order_acquire)) {
+        // hand the partial chunk over when the take ends
+        capturing = false;
+        rec.capture.flush();
+        capture_flushed.store(true, std::memory_order_release);
+    }
     if (record.load(std::memory_order_acquire) && fresh_take) {
-        start = jack_last_frame_time(client);
+        capture_flushed.store(false, std::memory_order_release);
+        capturing = true;
         absoluteStart = jack_last_frame_time(client);
         absoluteRecordStart = jack_last_frame_time(client);
         rcStart = jack_last_frame_time(client);
@@ -352,14 +464,13 @@ inline void XJack::process_midi_in(void* buf, void* out_buf) {
         NotOn = 0;
         int b = 0xB0 | mmessage->channel;
         int p = 0xC0 | mmessage->channel;
-        const mamba::MidiEvent evb = {{(unsigned char)b, 32, (unsigned char)bank}, 3, 0, 0};
-        st->push_back(evb);
-        const mamba::MidiEvent evp = {{(unsigned char)p, (unsigned char)program, 0}, 2, 0, 0};
-        st->push_back(evp);
+        const mamba::MidiEvent evb = {{(unsigned char)b, 32, (unsigned char)bank}, 3, 0};
+        rec.capture.push(evb);
+        const mamba::MidiEvent evp = {{(unsigned char)p, (unsigned char)program, 0}, 2, 0};
+        rec.capture.push(evp);
 
         if (!freewheel && play && (get_max_time_loop() > -1)) {
-            start = startPlay[mmessage->channel];
-            absoluteStart = startPlay[mmessage->channel];
+            absoluteStart = loopStart[mmessage->channel];
         }
     } else if (record_finished.load(std::memory_order_acquire) && !freewheel && (get_max_time_loop() > -1)) {
         record_finished.store(0, std::memory_order_release);
@@ -372,56 +483,104 @@ inline void XJack::process_midi_in(void* buf, void* out_buf) {
         stStart = jack_last_frame_time(client);
     }
     jack_midi_event_t in_event;
+    scheduled_count = 0;
+    const midimapper::KbmTable *kbm = midi_map ? acquire_kbm_table() : nullptr;
+    const miditransform::TransformTable *xf = acquire_transform();
+    curves = acquire_velocity();
     event_count = jack_midi_get_event_count(buf);
     unsigned int i;
     for (i = 0; i < event_count; i++) {
         jack_midi_event_get(&in_event, buf, i);
-        // only mapping note on/off messages
-        if (midi_map && (((in_event.buffer[0] & 0xf0) == 0x90) ||
-                        ((in_event.buffer[0] & 0xf0) == 0x80))) {
-            // record and send_to_also happen now in process_midi_out
-            send_to_midimapper(in_event.buffer, in_event.size);
-        } else {
-            if (midi_through) {
-                unsigned char* midi_send = jack_midi_event_reserve(out_buf, i, in_event.size);
-                midi_send[0] = in_event.buffer[0];
-                midi_send[1] = in_event.buffer[1]; // implement mapping
-                if (in_event.size>2) 
-                    midi_send[2] = in_event.buffer[2];
-                if (record.load(std::memory_order_acquire))
-                    record_midi(midi_send, i, in_event.size);
-                send_to_alsa(midi_send, in_event.size);
-            }
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-result"
-            if ((in_event.buffer[0] & 0xf0) == 0x90) {   // Note On
-                std::async(std::launch::async, trigger_get_midi_in, (int(in_event.buffer[0]&0x0f)), in_event.buffer[1], true);
-            } else if ((in_event.buffer[0] & 0xf0) == 0x80) {   // Note Off
-                std::async(std::launch::async, trigger_get_midi_in, (int(in_event.buffer[0]&0x0f)), in_event.buffer[1], false);
-            } else if ((in_event.buffer[0] ) == 0xf8) {   // midi beat clock
-                clock_gettime(CLOCK_MONOTONIC, &ts1);
-                double time0 = (ts1.tv_sec*1000000000.0)+(ts1.tv_nsec)+
-                        (1000000000.0/(double)(SampleRate/(double)in_event.time));
-                if (mp.time_to_bpm(time0, &bpm)) {
-                    bpm_changed.store(true, std::memory_order_release);
-                    bpm_set.store((int)bpm, std::memory_order_release);
-                }
+        if (tap && latencybench::ProbeTap::is_probe(in_event.buffer)) {
+            const latencybench::Route route = tap->arrived(jack_last_frame_time(client) + in_event.time, in_event.buffer);
+            if (route == latencybench::TO_ALSA) send_to_alsa(in_event.buffer, in_event.size, 0);
+            if (route != latencybench::PASS) continue;
+        }
+        if (in_event.size > 3) {
+            if (xf && !xf->pass_long(miditransform::SRC_JACK, in_event.buffer)) continue;
+            // the input buffer stay valid until the end of the period
+            if (midi_through && scheduled_count < max_scheduled)
+                schedule_event(in_event.time, mamba::MidiEvent(), true, in_event.buffer, in_event.size);
+            continue;
+        }
+        if (!xf) {
+            route_input(kbm, in_event.time, in_event.buffer, in_event.size);
+            continue;
+        }
+        // split, layer or drop by the compiled rule set
+        uint8_t out[miditransform::max_out][3];
+        const int count = xf->apply(miditransform::SRC_JACK, in_event.buffer, in_event.size, out);
+        for (int j = 0; j < count; j++)
+            route_input(kbm, in_event.time, out[j], in_event.size);
+    }
+}
+
+// map, pass through and show one input message
+inline void XJack::route_input(const midimapper::KbmTable *kbm, jack_nframes_t time,
+                                    const uint8_t *buffer, uint8_t size) {
+    mamba::MidiEvent ev;
+    memcpy(ev.buffer, buffer, size);
+    ev.num = size;
+    ev.absoluteTime = 0;
+    // only mapping note on/off messages, in place at the input frame
+    if (kbm && (((buffer[0] & 0xf0) == 0x90) ||
+                    ((buffer[0] & 0xf0) == 0x80))) {
+        const uint8_t key = kbm->note[buffer[1] & 0x7f];
+        if (key > 127) return;
+        ev.buffer[1] = key;
+        if (curves) curves->apply(velocitycurve::VEL_MAPPER, ev.buffer, size);
+        if (scheduled_count < max_scheduled) schedule_event(time, ev, true);
+        push_note(ev.buffer[0]&0x0f, key, (ev.buffer[0] & 0xf0) == 0x90 && ev.buffer[2]);
+    } else {
+        if (curves) curves->apply(velocitycurve::VEL_JACK, ev.buffer, size);
+        // written in process_midi_out, in time order with the loop events
+        if (midi_through && scheduled_count < max_scheduled)
+            schedule_event(time, ev, true);
+        if ((buffer[0] & 0xf0) == 0x90) {   // Note On
+            push_note(buffer[0]&0x0f, buffer[1], true);
+        } else if ((buffer[0] & 0xf0) == 0x80) {   // Note Off
+            push_note(buffer[0]&0x0f, buffer[1], false);
+        } else if ((buffer[0] ) == 0xf8) {   // midi beat clock
+            clock_gettime(CLOCK_MONOTONIC, &ts1);
+            double time0 = (ts1.tv_sec*1000000000.0)+(ts1.tv_nsec)+
+                    (1000000000.0/(double)(SampleRate/(double)time));
+            if (mp.time_to_bpm(time0, &bpm)) {
+                bpm_set.store((int)bpm, std::memory_order_release);
+                raise_flag(bpm_changed);
             }
-#pragma GCC diagnostic pop
         }
     }
 }
 
-float XJack::get_max_loop_time() noexcept {
-    max_loop_time = 0.0;
+uint32_t XJack::get_max_loop_ticks() noexcept {
+    uint32_t max_ticks = 0;
+    const mamba::LoopSnapshot snapshot = rec.loops.get_snapshot();
     for (int j = 0; j<16;j++) {
-        if (!rec.play[j].size()) continue;
-        const mamba::MidiEvent ev = rec.play[j][rec.play[j].size()-1];
-        if (ev.absoluteTime > max_loop_time) {
-            max_loop_time = ev.absoluteTime;
+        if (!snapshot.size(j)) continue;
+        if (snapshot.back_time(j) > max_ticks) {
+            max_ticks = snapshot.back_time(j);
         }
     }
-    return max_loop_time;
+    return max_ticks;
+}
+
+// loop length in seconds at the current tempo
+float XJack::get_max_loop_time() noexcept {
+    return timebase.ticks_to_seconds(get_max_loop_ticks());
+}
+
+// pass the note events collected in the process callback to the GUI,
+// called from a non realtime thread
+void XJack::process_note_events() {
+    mamba::NoteEvent ev;
+    while (note_events.pop(&ev)) {
+        trigger_get_midi_in(int(ev.channel), int(ev.key), ev.on);
+    }
+    const uint32_t overflows = note_events.get_overflows();
+    if (overflows != note_overflows) {
+        fprintf(stderr, "Note event queue overflow, %u events lost\n", overflows - note_overflows);
+        note_overflows = overflows;
+    }
 }
 
 // static
@@ -432,6 +591,8 @@ void XJack::jack_shutdown (void *arg) {
 
 // static
 int XJack::jack_xrun_callback(void *arg) {
+    XJack *xjack = (XJack*)arg;
+    xjack->stats.xrun();
     fprintf (stderr, "Xrun \r");
     return 0;
 }
@@ -441,12 +602,16 @@ int XJack::jack_srate_callback(jack_nframes_t samplerate, void* arg) {
     XJack *xjack = (XJack*)arg;
     xjack->SampleRate = samplerate;
     xjack->srms = xjack->SampleRate/1000;
+    xjack->timebase.set_samplerate(samplerate);
+    xjack->stats.set_period(jack_get_buffer_size(xjack->client), samplerate);
     fprintf (stderr, "Samplerate %iHz \n", samplerate);
     return 0;
 }
 
 // static
 int XJack::jack_buffersize_callback(jack_nframes_t nframes, void* arg) {
+    XJack *xjack = (XJack*)arg;
+    xjack->stats.set_period(nframes, xjack->SampleRate);
     fprintf (stderr, "Buffersize is %i samples \n", nframes);
     return 0;
 }
@@ -454,21 +619,34 @@ int XJack::jack_buffersize_callback(jack_nframes_t nframes, void* arg) {
 // static
 int XJack::jack_process(jack_nframes_t nframes, void *arg) {
     XJack *xjack = (XJack*)arg;
+    xjack->stats.begin_cycle(dspstats::TRANSPORT);
+    xjack->tap = xjack->probe.load(std::memory_order_acquire);
     if (xjack->transport_state != jack_transport_query (xjack->client, &xjack->current)) {
         xjack->transport_state = jack_transport_query (xjack->client, &xjack->current);
-        xjack->transport_state_changed.store(true, std::memory_order_release);
         xjack->transport_set.store((int)xjack->transport_state, std::memory_order_release);
+        xjack->raise_flag(xjack->transport_state_changed);
     }
     if (xjack->current.valid && xjack->current.beats_per_minute != (double)xjack->bpm) {
         xjack->bpm = (unsigned int)xjack->current.beats_per_minute;
-        xjack->bpm_changed.store(true, std::memory_order_release);
         xjack->bpm_set.store((int)xjack->bpm, std::memory_order_release);
+        xjack->raise_flag(xjack->bpm_changed);
     } 
     void *in = jack_port_get_buffer (xjack->in_port, nframes);
     void *out = jack_port_get_buffer (xjack->out_port, nframes);
     jack_midi_clear_buffer(out);
+    // alsa output is scheduled to leave together with the jack output
+    xjack->alsa_frame = jack_last_frame_time(xjack->client) + nframes;
+    xjack->stats.enter(dspstats::MIDI_IN);
+    xjack->loops = xjack->rec.loops.rt_acquire();
     xjack->process_midi_in(in, out);
+    xjack->stats.enter(dspstats::MIDI_OUT);
     xjack->process_midi_out(out,nframes);
+    // the GUI sleep until there is something new to show
+    if (xjack->ui_changed) {
+        xjack->ui_changed = false;
+        xjack->wake_ui();
+    }
+    xjack->stats.end_cycle(xjack->event_count, jack_midi_get_event_count(out));
     return 0;
 }
 
@@ -19,13 +19,17 @@
  */
 
 #include <sigc++/sigc++.h>
-#include <future>
 #include <functional>
 
 #include <jack/jack.h>
 #include <jack/midiport.h>
 
 #include "Mamba.h"
+#include "MidiMapper.h"
+#include "MidiTransform.h"
+#include "VelocityCurve.h"
+#include "DspStats.h"
+#include "LatencyBench.h"
 
 
 #pragma once
@@ -62,6 +66,24 @@ public:
 };
 
 
+/****************************************************************
+ ** struct ScheduledEvent
+ **
+ ** a loop or midi input event due in the current jack period
+ */
+
+typedef struct {
+    jack_nframes_t offset;
+    mamba::MidiEvent ev;
+    // passed through (or mapped) from the midi input
+    bool through;
+    // a passed through sysex or other long message, points into the
+    // jack input buffer
+    const jack_midi_data_t *data;
+    size_t size;
+} ScheduledEvent;
+
+
 /****************************************************************
  ** class XJack
  **
@@ -74,32 +96,68 @@ class XJack : public sigc::trackable {
 private:
     mamba::MidiMessenger *mmessage;
     MidiClockToBpm mp;
-    std::function<void(const uint8_t*,uint8_t) > send_to_alsa;
+    std::function<void(const uint8_t*,uint8_t,uint32_t) > send_to_alsa;
     std::function<void(int)> set_alsa_priority;
-    std::function<void(const uint8_t*,uint8_t) > send_to_midimapper;
+    std::function<const midimapper::KbmTable*() > acquire_kbm_table;
     std::function<void(int)> set_midimapper_priority;
+    std::function<const miditransform::TransformTable*() > acquire_transform;
+    std::function<const velocitycurve::VelocityTable*() > acquire_velocity;
+    // wake the GUI animation thread
+    std::function<void() > wake_ui;
     timespec ts1;
     jack_nframes_t event_count;
+    // frame time at which offset 0 of this period leave the jack graph
+    jack_nframes_t alsa_frame;
+    // a GUI flag was raised or a note queued in this period
+    bool ui_changed;
     jack_nframes_t stop;
-    jack_nframes_t stopPlay[16];
     jack_nframes_t startPlay[16];
+    jack_nframes_t loopStart[16];
     jack_nframes_t absoluteRecordStart;
-    double deltaTime;
-    double absoluteTime;
-    double absoluteRecordTime;
-    double playPosTime;
+    // ticks
+    uint32_t absoluteTime;
+    uint32_t absoluteRecordTime;
+    uint32_t playPosTime;
+    uint32_t max_loop_ticks;
+    uint32_t timebase_generation;
     jack_position_t current;
     jack_transport_state_t transport_state;
     unsigned int pos;
     unsigned int posPlay[16];
     int NotOn;
     int priority;
+    uint32_t note_overflows;
+    static const unsigned int max_scheduled = 512;
+    ScheduledEvent scheduled[max_scheduled];
+    unsigned int scheduled_count;
+    mamba::NoteEventQueue note_events;
+    // loop snapshot used in the current jack period
+    const mamba::LoopSnapshot *loops;
+    // velocity curves used in the current jack period, nullptr leave velocities untouched
+    const velocitycurve::VelocityTable *curves;
+    // latency probe used in the current jack period
+    latencybench::ProbeTap *tap;
 
     inline int find_pos_for_playtime() noexcept;
     inline int get_max_time_loop() noexcept;
+    inline void raise_flag(std::atomic<bool>& flag) noexcept;
+    inline void push_note(uint8_t channel, uint8_t key, bool on) noexcept;
     inline void record_midi(unsigned char* midi_send, unsigned int n, int i) noexcept;
-    inline void play_midi(void *buf, unsigned int n);
+    inline void schedule_event(jack_nframes_t offset, const mamba::MidiEvent& ev,
+                bool through = false, const jack_midi_data_t *data = nullptr,
+                size_t size = 0) noexcept;
+    inline void pass_midi(void *buf, jack_nframes_t offset, const mamba::MidiEvent& ev);
+    inline void pass_long(void *buf, jack_nframes_t offset,
+                            const jack_midi_data_t *data, size_t size);
+    inline void schedule_loops(jack_nframes_t nframes) noexcept;
+    inline void play_midi(void *buf, jack_nframes_t offset, const mamba::MidiEvent& ev);
+    inline jack_nframes_t message_offset(const mamba::MidiMessenger::Event *e,
+                jack_nframes_t cycle_start, jack_nframes_t nframes) const noexcept;
+    inline const mamba::MidiMessenger::Event *send_message(void *buf,
+                unsigned int n, const mamba::MidiMessenger::Event *e);
     inline void process_midi_out(void *buf, jack_nframes_t nframes);
+    inline void route_input(const midimapper::KbmTable *kbm, jack_nframes_t time,
+                                    const uint8_t *buffer, uint8_t size);
     inline void process_midi_in(void* buf, void* out_buf);
     static void jack_shutdown (void *arg);
     static int jack_xrun_callback(void *arg);
@@ -109,10 +167,13 @@ private:
 
 public:
     XJack(mamba::MidiMessenger *mmessage,
-        std::function<void(const uint8_t*,uint8_t) > send_to_alsa,
+        std::function<void(const uint8_t*,uint8_t,uint32_t) > send_to_alsa,
         std::function<void(int)> set_alsa_priority,
-        std::function<void(const uint8_t*,uint8_t) > send_to_midimapper,
-        std::function<void(int)> set_midimapper_priority);
+        std::function<const midimapper::KbmTable*() > acquire_kbm_table,
+        std::function<void(int)> set_midimapper_priority,
+        std::function<const miditransform::TransformTable*() > acquire_transform,
+        std::function<const velocitycurve::VelocityTable*() > acquire_velocity,
+        std::function<void() > wake_ui);
     ~XJack();
     std::atomic<bool> transport_state_changed;
     std::atomic<int> transport_set;
@@ -129,14 +190,13 @@ public:
     jack_nframes_t stPlay;
     jack_nframes_t stStart;
     jack_nframes_t rcStart;
-    jack_nframes_t start;
     jack_nframes_t absoluteStart;
     std::string client_name;
     int init_jack();
     mamba::MidiRecord rec;
-    std::vector<mamba::MidiEvent> store1;
-    std::vector<mamba::MidiEvent> store2;
-    std::vector<mamba::MidiEvent> *st;
+    dspstats::DspStats stats;
+    std::atomic<latencybench::ProbeTap*> probe;
+    std::atomic<bool> capture_flushed;
 
     int bank;
     int program;
@@ -144,16 +204,18 @@ public:
     int view_channels;
     int midi_through;
     bool fresh_take;
+    bool capturing;
     bool first_play;
     bool second_play;
     unsigned int SampleRate;
     double srms;
-    double bpm_ratio;
+    mamba::TimeBase timebase;
     unsigned int bpm;
-    float max_loop_time;
     int midi_map;
 
+    uint32_t get_max_loop_ticks() noexcept;
     float get_max_loop_time() noexcept;
+    void process_note_events();
     sigc::signal<void > trigger_quit_by_jack;
     sigc::signal<void >& signal_trigger_quit_by_jack() { return trigger_quit_by_jack; }
 
@@ -0,0 +1,345 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "XRawMidi.h"
+
+namespace xrawmidi {
+
+
+/****************************************************************
+ ** class MidiParser
+ **
+ ** assemble midi messages from a raw byte stream
+ */
+
+MidiParser::MidiParser() {
+    reset();
+}
+
+void MidiParser::reset() noexcept {
+    message[0] = 0;
+    expected = 0;
+    received = 0;
+    sysex = false;
+}
+
+uint8_t MidiParser::parse(const uint8_t byte, uint8_t *msg) noexcept {
+    // real time messages could appear everywhere, even inside sysex
+    if (byte >= 0xF8) {
+        msg[0] = byte;
+        return 1;
+    }
+    if (byte & 0x80) {
+        received = 0;
+        sysex = (byte == 0xF0);
+        switch (byte & 0xF0) {
+            case 0xC0:
+            case 0xD0:
+                message[0] = byte;
+                expected = 1;
+                return 0;
+            case 0xF0:
+                break;
+            default:
+                message[0] = byte;
+                expected = 2;
+                return 0;
+        }
+        // system common messages cancel the running status
+        message[0] = 0;
+        if (byte == 0xF1 || byte == 0xF3) {
+            message[0] = byte;
+            expected = 1;
+        } else if (byte == 0xF2) {
+            message[0] = byte;
+            expected = 2;
+        } else if (byte == 0xF6) {
+            msg[0] = byte;
+            return 1;
+        }
+        return 0;
+    }
+    // data byte, without status it belong to sysex or is garbage
+    if (sysex || !message[0]) return 0;
+    message[++received] = byte;
+    if (received < expected) return 0;
+    const uint8_t size = received + 1;
+    msg[0] = message[0];
+    msg[1] = message[1];
+    if (size > 2) msg[2] = message[2];
+    received = 0;
+    if (message[0] >= 0xF0) message[0] = 0;
+    return size;
+}
+
+
+/****************************************************************
+ ** class XRawMidi
+ **
+ ** direct non blocking I/O on alsa rawmidi devices
+ */
+
+XRawMidi::XRawMidi(std::function<void(const uint8_t*, uint8_t) > receive_)
+    : receive(receive_),
+    generation(0),
+    output_count(0),
+    _execute(false) {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    prio = 10;
+}
+
+XRawMidi::~XRawMidi() {
+    xrawmidi_stop();
+    std::lock_guard<std::mutex> lk(m);
+    inputs.clear();
+    outputs.clear();
+    if (wake_fd >= 0) close(wake_fd);
+}
+
+void XRawMidi::xrawmidi_set_priority(int priority) {
+    prio = priority/2;
+}
+
+// list all subdevices of one device for the given stream
+static void get_subdevices(snd_ctl_t *ctl, snd_rawmidi_info_t *info, int card,
+                        int device, int stream, std::vector<std::string> *ports) {
+    snd_rawmidi_info_set_device(info, device);
+    snd_rawmidi_info_set_stream(info, stream);
+    snd_rawmidi_info_set_subdevice(info, 0);
+    if (snd_ctl_rawmidi_info(ctl, info) < 0) return;
+    const unsigned int count = snd_rawmidi_info_get_subdevices_count(info);
+    for (unsigned int sub = 0; sub < count; sub++) {
+        snd_rawmidi_info_set_subdevice(info, sub);
+        if (snd_ctl_rawmidi_info(ctl, info) < 0) continue;
+        const char *name = snd_rawmidi_info_get_subdevice_name(info);
+        if (!name || !name[0]) name = snd_rawmidi_info_get_name(info);
+        char port[256];
+        snprintf(port, 256, "hw:%d,%d,%u %s", card, device, sub, name);
+        ports->push_back(std::string(port));
+    }
+}
+
+void XRawMidi::xrawmidi_get_ports(std::vector<std::string> *iports,
+                                std::vector<std::string> *oports) {
+    iports->clear();
+    oports->clear();
+    snd_rawmidi_info_t *info;
+    snd_rawmidi_info_malloc(&info);
+    int card = -1;
+    while (snd_card_next(&card) >= 0 && card >= 0) {
+        char name[32];
+        snprintf(name, 32, "hw:%d", card);
+        snd_ctl_t *ctl;
+        if (snd_ctl_open(&ctl, name, 0) < 0) continue;
+        int device = -1;
+        while (snd_ctl_rawmidi_next_device(ctl, &device) >= 0 && device >= 0) {
+            get_subdevices(ctl, info, card, device, SND_RAWMIDI_STREAM_INPUT, iports);
+            get_subdevices(ctl, info, card, device, SND_RAWMIDI_STREAM_OUTPUT, oports);
+        }
+        snd_ctl_close(ctl);
+    }
+    snd_rawmidi_info_free(info);
+}
+
+void XRawMidi::xrawmidi_get_iconnections(std::vector<std::string> *ports) {
+    ports->clear();
+    std::lock_guard<std::mutex> lk(m);
+    for (auto dev : inputs) ports->push_back(dev->id);
+}
+
+void XRawMidi::xrawmidi_get_oconnections(std::vector<std::string> *ports) {
+    ports->clear();
+    std::lock_guard<std::mutex> lk(m);
+    for (auto dev : outputs) ports->push_back(dev->id);
+}
+
+XRawMidi::DevicePtr XRawMidi::open_device(const std::string& id, bool input) {
+    snd_rawmidi_t *handle = NULL;
+    if (snd_rawmidi_open(input ? &handle : NULL, input ? NULL : &handle,
+                                    id.c_str(), SND_RAWMIDI_NONBLOCK) < 0) return nullptr;
+    DevicePtr dev = std::make_shared<Device>();
+    dev->id = id;
+    dev->handle = handle;
+    return dev;
+}
+
+// the mutex must be held
+void XRawMidi::close_device(std::vector<DevicePtr> *devices, const std::string& id) {
+    for (auto it = devices->begin(); it != devices->end(); ++it) {
+        if ((*it)->id != id) continue;
+        devices->erase(it);
+        generation.fetch_add(1, std::memory_order_release);
+        return;
+    }
+}
+
+bool XRawMidi::xrawmidi_connect(const std::string& id) {
+    DevicePtr dev = open_device(id, true);
+    if (!dev) return false;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        inputs.push_back(dev);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    wake();
+    return true;
+}
+
+void XRawMidi::xrawmidi_disconnect(const std::string& id) {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        close_device(&inputs, id);
+    }
+    wake();
+}
+
+bool XRawMidi::xrawmidi_oconnect(const std::string& id) {
+    DevicePtr dev = open_device(id, false);
+    if (!dev) return false;
+    std::lock_guard<std::mutex> lk(m);
+    outputs.push_back(dev);
+    output_count.store(outputs.size(), std::memory_order_release);
+    return true;
+}
+
+void XRawMidi::xrawmidi_odisconnect(const std::string& id) {
+    std::lock_guard<std::mutex> lk(m);
+    close_device(&outputs, id);
+    output_count.store(outputs.size(), std::memory_order_release);
+}
+
+void XRawMidi::wake() noexcept {
+    const uint64_t one = 1;
+    ssize_t ret = write(wake_fd, &one, sizeof(one));
+    (void)ret;
+}
+
+void XRawMidi::xrawmidi_output_notify(const uint8_t *midi_get, uint8_t num) noexcept {
+    if (!output_count.load(std::memory_order_acquire)) return;
+    if (rmessage.push(midi_get, num)) wake();
+}
+
+// read all pending bytes and hand complete messages over
+void XRawMidi::read_device(Device *dev) {
+    uint8_t buf[256];
+    uint8_t msg[3];
+    ssize_t n;
+    while ((n = snd_rawmidi_read(dev->handle, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            const uint8_t size = dev->parser.parse(buf[i], msg);
+            if (size) receive(msg, size);
+        }
+    }
+}
+
+// write a message to the outputs, a full device buffer fall back to a
+// blocking write, so it's called without the mutex held
+void XRawMidi::write_devices(const std::vector<DevicePtr>& devices,
+                                    const uint8_t *data, uint8_t size) {
+    for (auto& dev : devices) {
+        if (snd_rawmidi_write(dev->handle, data, size) == -EAGAIN) {
+            snd_rawmidi_nonblock(dev->handle, 0);
+            snd_rawmidi_write(dev->handle, data, size);
+            snd_rawmidi_nonblock(dev->handle, 1);
+        }
+    }
+}
+
+void XRawMidi::xrawmidi_stop() {
+    _execute.store(false, std::memory_order_release);
+    wake();
+    if (_thd.joinable()) {
+        _thd.join();
+    }
+}
+
+void XRawMidi::xrawmidi_start() {
+    if( _execute.load(std::memory_order_acquire) ) {
+        xrawmidi_stop();
+    };
+    if (wake_fd < 0) return;
+    _execute.store(true, std::memory_order_release);
+    _thd = std::thread([this]() {
+        sched_param sch;
+        sch.sched_priority = prio;
+        pthread_setschedparam(_thd.native_handle(), SCHED_FIFO, &sch);
+        std::vector<pollfd> pfds;
+        // first poll descriptor and count for each input
+        std::vector<std::pair<unsigned int, unsigned int> > ranges;
+        uint32_t gen = generation.load(std::memory_order_acquire) - 1;
+        midiqueue::MidiQueue<256>::Event qev;
+        std::vector<DevicePtr> outs;
+        while (_execute.load(std::memory_order_acquire)) {
+            if (gen != generation.load(std::memory_order_acquire)) {
+                // the open devices changed, collect the poll descriptors again
+                std::lock_guard<std::mutex> lk(m);
+                gen = generation.load(std::memory_order_acquire);
+                pfds.resize(1);
+                pfds[0].fd = wake_fd;
+                pfds[0].events = POLLIN;
+                ranges.clear();
+                for (auto dev : inputs) {
+                    const int count = snd_rawmidi_poll_descriptors_count(dev->handle);
+                    const unsigned int first = pfds.size();
+                    pfds.resize(first + count);
+                    snd_rawmidi_poll_descriptors(dev->handle, &pfds[first], count);
+                    ranges.push_back(std::make_pair(first, (unsigned int)count));
+                }
+            }
+            if (poll(pfds.data(), pfds.size(), 100) <= 0) continue;
+            if (pfds[0].revents & POLLIN) {
+                uint64_t value;
+                ssize_t ret = read(wake_fd, &value, sizeof(value));
+                (void)ret;
+            }
+            if (rmessage.front()) {
+                // a stalled device must not block connect/disconnect
+                {
+                    std::lock_guard<std::mutex> lk(m);
+                    outs = outputs;
+                }
+                while (rmessage.pop(&qev)) write_devices(outs, qev.data, qev.size);
+                outs.clear();
+            }
+            std::lock_guard<std::mutex> lk(m);
+            // a device closed meanwhile, its descriptors are stale
+            if (gen != generation.load(std::memory_order_acquire)) continue;
+            std::vector<std::string> lost;
+            for (unsigned int i = 0; i < inputs.size(); i++) {
+                unsigned short revents = 0;
+                snd_rawmidi_poll_descriptors_revents(inputs[i]->handle,
+                            &pfds[ranges[i].first], ranges[i].second, &revents);
+                if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                    // unplugged
+                    lost.push_back(inputs[i]->id);
+                } else if (revents & POLLIN) {
+                    read_device(inputs[i].get());
+                }
+            }
+            for (auto id : lost) close_device(&inputs, id);
+        }
+    });
+}
+
+} // namespace xrawmidi
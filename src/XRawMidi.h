@@ -0,0 +1,140 @@
+/*
+ *                           0BSD 
+ * 
+ *                    BSD Zero Clause License
+ * 
+ *  Copyright (c) 2020 Hermann Meyer
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <string>
+#include <mutex>
+#include <functional>
+#include <memory>
+
+#include <poll.h>
+
+#include <alsa/asoundlib.h>
+
+#include "MidiQueue.h"
+
+
+#pragma once
+
+#ifndef XRAWMIDI_H
+#define XRAWMIDI_H
+
+namespace xrawmidi {
+
+
+/****************************************************************
+ ** class MidiParser
+ **
+ ** assemble midi messages from a raw byte stream, handle running
+ ** status and real time bytes in between, sysex is skipped
+ */
+
+class MidiParser {
+private:
+    uint8_t message[3];
+    uint8_t expected;
+    uint8_t received;
+    bool sysex;
+
+public:
+    MidiParser();
+    // feed one byte, return the size of a complete message in msg or 0
+    uint8_t parse(const uint8_t byte, uint8_t *msg) noexcept;
+    void reset() noexcept;
+};
+
+
+/****************************************************************
+ ** class XRawMidi
+ **
+ ** direct non blocking I/O on alsa rawmidi hw:X,Y,Z devices, bypass
+ ** the sequencer for the lowest latency from hardware controllers.
+ ** A single thread poll all open inputs and a eventfd, which the
+ ** jack thread signal when output is queued.
+ */
+
+class XRawMidi {
+private:
+    // the handle is closed with the last reference, the poll thread
+    // keep the outputs alive while it write to them without the mutex
+    struct Device {
+        std::string id;
+        snd_rawmidi_t *handle;
+        MidiParser parser;
+        ~Device() { snd_rawmidi_close(handle); }
+    };
+    typedef std::shared_ptr<Device> DevicePtr;
+
+    // send a received midi message to the owner
+    std::function<void(const uint8_t*, uint8_t) > receive;
+    // open devices, guarded by m
+    std::vector<DevicePtr> inputs;
+    std::vector<DevicePtr> outputs;
+    std::mutex m;
+    // bumped whenever a device is opened or closed
+    std::atomic<uint32_t> generation;
+    std::atomic<int> output_count;
+    // the midi message 'queue' for rawmidi output
+    midiqueue::MidiQueue<256> rmessage;
+    // wake up the poll loop
+    int wake_fd;
+    // control the poll loop
+    std::atomic<bool> _execute;
+    // thread running the poll loop
+    std::thread _thd;
+    // priority for the I/O thread
+    int prio;
+    DevicePtr open_device(const std::string& id, bool input);
+    void close_device(std::vector<DevicePtr> *devices, const std::string& id);
+    void read_device(Device *dev);
+    void write_devices(const std::vector<DevicePtr>& devices, const uint8_t *data, uint8_t size);
+    void wake() noexcept;
+
+public:
+    XRawMidi(std::function<void(const uint8_t*, uint8_t) > receive);
+    ~XRawMidi();
+    // get all rawmidi devices as "hw:card,device,subdevice name"
+    void xrawmidi_get_ports(std::vector<std::string> *iports,
+                            std::vector<std::string> *oports);
+    // get the ids of all open devices
+    void xrawmidi_get_iconnections(std::vector<std::string> *ports);
+    void xrawmidi_get_oconnections(std::vector<std::string> *ports);
+    // open/close a input device
+    bool xrawmidi_connect(const std::string& id);
+    void xrawmidi_disconnect(const std::string& id);
+    // open/close a output device
+    bool xrawmidi_oconnect(const std::string& id);
+    void xrawmidi_odisconnect(const std::string& id);
+    // start/stop the poll loop
+    void xrawmidi_start();
+    void xrawmidi_stop();
+    // push a midi message into the output 'queue', safe from the jack thread
+    void xrawmidi_output_notify(const uint8_t *midi_get, uint8_t num) noexcept;
+    // set the priority for the I/O thread
+    void xrawmidi_set_priority(int priority);
+    // events dropped because the output 'queue' was full
+    uint32_t get_overflows() const noexcept { return rmessage.get_overflows(); }
+};
+
+} // namespace xrawmidi
+
+#endif //XRAWMIDI_H
@@ -34,14 +34,174 @@ namespace xsynth {
 #define USE_FLUID_API 1
 #endif
 
+/****************************************************************
+ ** class TuningBank
+ **
+ ** compile and upload key tunings in the background
+ */
+
+TuningBank::TuningBank()
+    : _execute(false) {
+}
+
+TuningBank::~TuningBank() {
+    stop();
+}
+
+void TuningBank::add(int program, Tuning&& tuning) {
+    std::lock_guard<std::mutex> lk(m);
+    auto it = bank.find(program);
+    if (it != bank.end()) {
+        // nothing to do when the same tuning is set again
+        if (it->second.name == tuning.name && it->second.step == tuning.step &&
+                it->second.ratios == tuning.ratios) return;
+        tuning.version = it->second.version + 1;
+    }
+    bank[program] = std::move(tuning);
+    cv.notify_one();
+}
+
+void TuningBank::add_equal(int program, const std::string& name, double step) {
+    add(program, {name, step, {}, 0, false, false, {}});
+}
+
+void TuningBank::add_scale(int program, const std::string& name, const std::vector<double>& ratios) {
+    if (ratios.empty()) return;
+    add(program, {name, 0.0, ratios, 0, false, false, {}});
+}
+
+void TuningBank::compile(const Tuning& tuning, double *cents) {
+    if (tuning.ratios.empty()) {
+        double val = 0.0;
+        for (unsigned int i = 0; i < 128; i++) {
+            cents[i] = val;
+            val += tuning.step;
+        }
+        return;
+    }
+    const size_t size = tuning.ratios.size();
+    double oc = 1.0;
+    for (unsigned int i = 0; i < 128; i++) {
+        cents[i] = 1200.0 * std::log2(tuning.ratios[i % size] * oc);
+        if (i % size == size-1) {
+            oc *=2;
+        }
+    }
+}
+
+void TuningBank::start() {
+    std::lock_guard<std::mutex> lk(m);
+    // a new synth instance need all tunings
+    for (auto& t : bank) t.second.uploaded = false;
+    if (_execute) return;
+    _execute = true;
+    _thd = std::thread([this]() { run(); });
+}
+
+void TuningBank::stop() {
+    {
+        std::lock_guard<std::mutex> lk(m);
+        _execute = false;
+    }
+    cv.notify_one();
+    if (_thd.joinable()) _thd.join();
+    cv_done.notify_all();
+}
+
+void TuningBank::wait() {
+    std::unique_lock<std::mutex> lk(m);
+    cv_done.wait(lk, [this] {
+        if (!_execute) return true;
+        for (const auto& t : bank) if (!t.second.uploaded) return false;
+        return true;
+    });
+}
+
+void TuningBank::run() {
+    std::unique_lock<std::mutex> lk(m);
+    while (true) {
+        auto next = bank.end();
+        cv.wait(lk, [this, &next] {
+            if (!_execute) return true;
+            for (next = bank.begin(); next != bank.end(); ++next)
+                if (!next->second.uploaded) return true;
+            return false;
+        });
+        if (!_execute) break;
+        const int program = next->first;
+        Tuning tuning = next->second;
+        lk.unlock();
+
+        if (!tuning.compiled) compile(tuning, tuning.cents);
+        if (upload) upload(program, tuning.name.c_str(), tuning.cents);
+
+        lk.lock();
+        // when the tuning was replaced meanwhile, the new one is still pending
+        Tuning& t = bank[program];
+        if (t.version == tuning.version) {
+            if (!t.compiled) std::copy(tuning.cents, tuning.cents + 128, t.cents);
+            t.compiled = true;
+            t.uploaded = true;
+        }
+        cv_done.notify_all();
+    }
+}
+
+
 /****************************************************************
  ** class XSynth
  **
  ** create a fluidsynth instance and load sondfont
  */
 
-XSynth::XSynth() : cents{} {
+// count the bytes read by the soundfont loader, for the progress report
+static std::atomic<long long> sf_bytes_read(0);
+static std::atomic<long long> sf_file_size(0);
+
+#if FLUIDSYNTH_VERSION_MAJOR > 2 || (FLUIDSYNTH_VERSION_MAJOR == 2 && FLUIDSYNTH_VERSION_MINOR > 1)
+typedef fluid_long_long_t sf_count_t;
+typedef fluid_long_long_t sf_offset_t;
+#else
+typedef int sf_count_t;
+typedef long sf_offset_t;
+#endif
+
+#if FLUIDSYNTH_VERSION_MAJOR > 1
+static void *sf_open(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (f && !fseek(f, 0, SEEK_END)) {
+        sf_file_size.store(ftell(f), std::memory_order_release);
+        rewind(f);
+    }
+    return f;
+}
+
+static int sf_read(void *buf, sf_count_t count, void *handle) {
+    const size_t n = fread(buf, 1, count, (FILE*)handle);
+    sf_bytes_read.fetch_add(n, std::memory_order_relaxed);
+    return n == (size_t)count ? FLUID_OK : FLUID_FAILED;
+}
+
+static int sf_seek(void *handle, sf_offset_t offset, int origin) {
+    return fseek((FILE*)handle, offset, origin) == 0 ? FLUID_OK : FLUID_FAILED;
+}
+
+static sf_offset_t sf_tell(void *handle) {
+    return ftell((FILE*)handle);
+}
+
+static int sf_close(void *handle) {
+    return fclose((FILE*)handle) == 0 ? FLUID_OK : FLUID_FAILED;
+}
+#endif
+
+XSynth::XSynth() {
     sf_id = -1;
+    offline = false;
+    loader_settings = NULL;
+    loader = NULL;
+    loaded_sfont = NULL;
+    sf_state.store(SF_IDLE, std::memory_order_release);
     adriver = NULL;
     mdriver = NULL;
     synth = NULL;
@@ -68,11 +228,18 @@ XSynth::XSynth() : cents{} {
     volume_level = 0.2;
     scala_size = 0;
     init_tuning_maps();
+    tunings.upload = [this] (int program, const char *name, const double *cents) {
+        fluid_synth_activate_key_tuning(synth, 0, program, name, cents, 1);
+    };
+    setup_key_tunnings();
 };
 
 XSynth::~XSynth() {
     delete_envelope();
     unload_synth();
+    // the loaded soundfonts were read with the file callbacks of the loader
+    if (loader) delete_fluid_synth(loader);
+    if (loader_settings) delete_fluid_settings(loader_settings);
     tuning_map.clear();
     channel_tuning_map.clear();
     scala_ratios.clear();
@@ -93,60 +260,40 @@ void XSynth::setup(unsigned int SampleRate, const char *instance_name) {
     fluid_settings_setstr(settings, "midi.jack.id", instance_name);
 }
 
-void XSynth::setup_scala_tuning() {
-    double val = 0.0;
-    double oc = 1.0;
-    for (unsigned int i = 0; i < 128; i++) {
-        val = 1200.0 * std::log2(scala_ratios[i % scala_size] * oc);
-        cents[i] = val;
-        if (i % scala_size == scala_size-1) {
-            oc *=2;
-        }
-    }
-    fluid_synth_activate_key_tuning(synth, 0, 2, "scala", cents, 1);
-}
-
-void XSynth::just_intonation() {
-    double steps [12] = {1.0, 1.06667, 1.125, 1.2, 1.25, 1.33333, 1.40625, 1.5, 1.6, 1.66667, 1.75, 1.875};
-    double val = 0.0;
-    double oc = 1.0;
-    for (unsigned int i = 0; i < 128; i++) {
-        val = 1200.0 * std::log2(steps[i % 12] * oc);
-        cents[i] = val;
-        if (i % 12 == 11) {
-            oc *=2;
-        }
-    }
+// no audio and midi driver, the synth is pulled with render()
+void XSynth::setup_offline(unsigned int SampleRate) {
+    offline = true;
+    settings = new_fluid_settings();
+    fluid_settings_setnum(settings, "synth.sample-rate", SampleRate);
 }
 
-void XSynth::create_tuning_scala(double cent) {
-    double val = 0.0;
-    for (unsigned int i = 0; i < 128; i++) {
-        cents[i] = val;
-        val += cent;
-    }
+// the scale is compiled in the background, channels using it are
+// retuned when it's uploaded
+void XSynth::setup_scala_tuning() {
+    if (!scala_size || scala_ratios.size() < scala_size) return;
+    tunings.add_scale(2, "scala", std::vector<double>(scala_ratios.begin(),
+                                        scala_ratios.begin() + scala_size));
 }
 
 void XSynth::init_tuning_maps() {
+    tuning_names = {"12ji", "12edo", "Scala"};
     for (unsigned int i = 10; i < 24; i++) {
         std::string key = std::to_string(i)+"edo";
         double step = (100.0/double(i))*12.0;
         tuning_map.emplace(key,step);
+        if (i != 12) tuning_names.push_back(key);
     }
 }
 
+// queue the build in tunings, they get uploaded with the synth start
 void XSynth::setup_key_tunnings() {
-    just_intonation();
-    int i = 0;
-    fluid_synth_activate_key_tuning(synth, 0, i, "ji", cents, 1);
-    i = 1;
-    create_tuning_scala(100.0);
-    fluid_synth_activate_key_tuning(synth, 0, i, "12edo", cents, 1);
-   /* for (const auto& [key, steps] : tuning_map) {
-        create_tuning_scala(steps);
-        fluid_synth_activate_key_tuning(synth, 0, i, key.c_str(), cents, 1);
-        i++;
-    }*/
+    const std::vector<double> ji = {1.0, 1.06667, 1.125, 1.2, 1.25, 1.33333,
+                                    1.40625, 1.5, 1.6, 1.66667, 1.75, 1.875};
+    tunings.add_scale(0, "ji", ji);
+    tunings.add_equal(1, "12edo", 100.0);
+    for (unsigned int i = 3; i < tuning_names.size(); i++) {
+        tunings.add_equal(i, tuning_names[i], tuning_map[tuning_names[i]]);
+    }
 }
 
 void XSynth::activate_tuning_for_channel(int channel, int set) {
@@ -302,12 +449,16 @@ void XSynth::reset_modulators() {
 
 void XSynth::init_synth() {
     synth = new_fluid_synth(settings);
-    adriver = new_fluid_audio_driver(settings, synth);
-    mdriver = new_fluid_midi_driver(settings, fluid_synth_handle_midi_event, synth);
+    if (!offline) {
+        adriver = new_fluid_audio_driver(settings, synth);
+        mdriver = new_fluid_midi_driver(settings, fluid_synth_handle_midi_event, synth);
+    }
     volume_level = fluid_synth_get_gain(synth);
-    setup_key_tunnings();
     if (scala_size) setup_scala_tuning();
+    tunings.start();
     setup_tunnings_for_channelemap();
+    // a offline render start at once
+    if (offline) tunings.wait();
     setup_envelope();
     reset_modulators();
 }
@@ -317,6 +468,28 @@ int XSynth::synth_send_cc(int channel, int num, int value) {
     return fluid_synth_cc(synth, channel, num, value);
 }
 
+int XSynth::synth_send_event(const uint8_t *midi) {
+    if (!synth) return -1;
+    const int channel = midi[0] & 0x0f;
+    switch (midi[0] & 0xf0) {
+        case 0x80: return fluid_synth_noteoff(synth, channel, midi[1]);
+        case 0x90: return midi[2] ? fluid_synth_noteon(synth, channel, midi[1], midi[2]) :
+                                    fluid_synth_noteoff(synth, channel, midi[1]);
+        case 0xA0: return fluid_synth_key_pressure(synth, channel, midi[1], midi[2]);
+        case 0xB0: return fluid_synth_cc(synth, channel, midi[1], midi[2]);
+        case 0xC0: return fluid_synth_program_change(synth, channel, midi[1]);
+        case 0xD0: return fluid_synth_channel_pressure(synth, channel, midi[1]);
+        case 0xE0: return fluid_synth_pitch_bend(synth, channel, (midi[2] << 7) | midi[1]);
+        default: return -1;
+    }
+}
+
+// pull stereo audio from a offline synth
+int XSynth::render(float *left, float *right, int frames) {
+    if (!synth) return -1;
+    return fluid_synth_write_float(synth, frames, left, 0, 1, right, 0, 1);
+}
+
 int XSynth::load_soundfont(const char *path) {
     if (sf_id != -1) fluid_synth_sfunload(synth, sf_id, 0);
     sf_id = fluid_synth_sfload(synth, path, 1);
@@ -329,6 +502,98 @@ int XSynth::load_soundfont(const char *path) {
     return 0;
 }
 
+void XSynth::init_loader() {
+    if (loader) return;
+    loader_settings = new_fluid_settings();
+    loader = new_fluid_synth(loader_settings);
+#if FLUIDSYNTH_VERSION_MAJOR > 1
+    fluid_sfloader_t *sfloader = new_fluid_defsfloader(loader_settings);
+    fluid_sfloader_set_callbacks(sfloader, sf_open, sf_read, sf_seek, sf_tell, sf_close);
+    fluid_synth_add_sfloader(loader, sfloader);
+#endif
+}
+
+int XSynth::load_soundfont_async(const char *path) {
+    if (!synth) return -1;
+    if (get_soundfont_state() == SF_LOADING) return 1;
+    // a loaded soundfont which was never swapped in
+    swap_soundfont();
+    init_loader();
+    sf_bytes_read.store(0, std::memory_order_release);
+    sf_file_size.store(0, std::memory_order_release);
+    sf_state.store(SF_LOADING, std::memory_order_release);
+    sf_thd = std::thread([this] (std::string file) {
+        const int id = fluid_synth_sfload(loader, file.c_str(), 0);
+        fluid_sfont_t *sfont = id == -1 ? NULL : fluid_synth_get_sfont_by_id(loader, id);
+        // take it out of the loader, it is moved to the playing synth
+        if (sfont) fluid_synth_remove_sfont(loader, sfont);
+        loaded_sfont = sfont;
+        sf_state.store(sfont ? SF_LOADED : SF_FAILED, std::memory_order_release);
+        if (soundfont_loaded) soundfont_loaded();
+    }, std::string(path));
+    return 0;
+}
+
+int XSynth::get_load_progress() const noexcept {
+    const int state = get_soundfont_state();
+    if (state == SF_IDLE || state == SF_LOADED) return 100;
+    const long long size = sf_file_size.load(std::memory_order_acquire);
+    if (!size) return 0;
+    const long long p = sf_bytes_read.load(std::memory_order_relaxed) * 100 / size;
+    return p > 99 ? 99 : (int)p;
+}
+
+// bank and program the channel play now
+bool XSynth::get_channel_program(int channel, int *bank, int *program) {
+    fluid_preset_t *preset = fluid_synth_get_channel_preset(synth, channel);
+    if (!preset) return false;
+#if FLUIDSYNTH_VERSION_MAJOR < 2
+    *bank = preset->get_banknum(preset);
+    *program = preset->get_num(preset);
+#else
+    *bank = fluid_preset_get_banknum(preset);
+    *program = fluid_preset_get_num(preset);
+#endif
+    return true;
+}
+
+// the new soundfont is added to the stack of the playing synth, the
+// channels switch to it with the next period. Notes of the old one end
+// with there release phase, it's freed once no voice use it.
+int XSynth::swap_soundfont() {
+    const int state = get_soundfont_state();
+    if (state == SF_IDLE || state == SF_LOADING) return 1;
+    if (sf_thd.joinable()) sf_thd.join();
+    sf_state.store(SF_IDLE, std::memory_order_release);
+    if (state == SF_FAILED) return 1;
+    fluid_sfont_t *sfont = loaded_sfont;
+    loaded_sfont = NULL;
+    // the instruments the channels play now
+    int bank[16];
+    int program[16];
+    bool have_program[16];
+    for (int i = 0; i < 16; i++) have_program[i] = get_channel_program(i, &bank[i], &program[i]);
+    const int old_id = sf_id;
+    sf_id = fluid_synth_add_sfont(synth, sfont);
+    if (sf_id == FLUID_FAILED) {
+        sf_id = old_id;
+        return 1;
+    }
+    for (int i = 0; i < 16; i++) fluid_synth_cc(synth, i, 123, 0);
+    print_soundfont();
+    // keep them when the new soundfont have them, else the defaults stay
+    for (int i = 0; i < 16; i++) {
+        if (!have_program[i]) continue;
+        if (fluid_synth_program_select(synth, i, sf_id, bank[i], program[i]) != FLUID_OK) continue;
+        const int instrument = get_instrument_for_channel(i);
+        if (instrument >= 0) channel_instrument[i] = instrument;
+    }
+    if (old_id != -1) fluid_synth_sfunload(synth, old_id, 0);
+    if (reverb_on) set_reverb_on(reverb_on);
+    if (chorus_on) set_chorus_on(chorus_on);
+    return 0;
+}
+
 void XSynth::print_soundfont() {
     instruments.clear();
     fluid_sfont_t * sfont = fluid_synth_get_sfont_by_id(synth, sf_id);
@@ -495,6 +760,16 @@ void XSynth::unload_synth() {
         delete_fluid_audio_driver(adriver);
         adriver = NULL;
     }
+    tunings.stop();
+    // the soundfont would be moved to a deleted synth
+    if (sf_thd.joinable()) sf_thd.join();
+    if (sf_state.load(std::memory_order_acquire) == SF_LOADED && loaded_sfont) {
+        // give it back to the loader to free it
+        const int id = fluid_synth_add_sfont(loader, loaded_sfont);
+        if (id != FLUID_FAILED) fluid_synth_sfunload(loader, id, 0);
+    }
+    loaded_sfont = NULL;
+    sf_state.store(SF_IDLE, std::memory_order_release);
     if (synth) {
         for(int i = 0; i < 16; i++) {
             fluid_synth_deactivate_tuning(synth, i, 1);
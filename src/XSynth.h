@@ -19,10 +19,16 @@
  */
 
 #include <fluidsynth.h>
+#include <cstdint>
 #include <map>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #pragma once
 
@@ -33,6 +39,58 @@
 namespace xsynth {
 
 
+/****************************************************************
+ ** class TuningBank
+ **
+ ** compile key tunings to cents tables in a extra thread and upload
+ ** them as tuning programs. Compiled tables are kept, so a new synth
+ ** instance only need the upload. Switching the tuning of a channel
+ ** is then only a program change.
+ */
+
+class TuningBank {
+private:
+    typedef struct {
+        std::string name;
+        // cents per step for equal temperaments
+        double step;
+        // the ratios of one octave for scales
+        std::vector<double> ratios;
+        // changes whenever the tuning is replaced
+        uint32_t version;
+        bool compiled;
+        bool uploaded;
+        double cents[128];
+    } Tuning;
+
+    std::map<int, Tuning> bank;
+    std::mutex m;
+    std::condition_variable cv;
+    std::condition_variable cv_done;
+    bool _execute;
+    std::thread _thd;
+    void add(int program, Tuning&& tuning);
+    static void compile(const Tuning& tuning, double *cents);
+    void run();
+
+public:
+    TuningBank();
+    ~TuningBank();
+    // upload a compiled tuning, called from the tuning thread
+    std::function<void(int, const char*, const double*) > upload;
+    // queue a equal temperament with step cents per key
+    void add_equal(int program, const std::string& name, double step);
+    // queue a scale given by the ratios of one octave
+    void add_scale(int program, const std::string& name, const std::vector<double>& ratios);
+    // upload all tunings, compile the ones not compiled yet
+    void start();
+    // stop uploading, call before the synth is deleted
+    void stop();
+    // block until all queued tunings are uploaded
+    void wait();
+};
+
+
 /****************************************************************
  ** class XSynth
  **
@@ -46,15 +104,14 @@ private:
     fluid_audio_driver_t* adriver;
     fluid_midi_driver_t* mdriver;
     int sf_id;
+    bool offline;
 
-    double cents[128];
     std::map<std::string, double> tuning_map;
     std::map<int, int> channel_tuning_map;
-    void create_tuning_scala(double cent);
+    TuningBank tunings;
     void init_tuning_maps();
     void setup_key_tunnings();
     void setup_tunnings_for_channelemap();
-    void just_intonation();
     fluid_mod_t *amod;
     fluid_mod_t *dmod;
     fluid_mod_t *smod;
@@ -63,12 +120,23 @@ private:
     fluid_mod_t *fmod;
     void setup_envelope();
     void delete_envelope();
+    // soundfonts are loaded by a synth without drivers, so the
+    // playing synth is never blocked by the load
+    fluid_settings_t *loader_settings;
+    fluid_synth_t *loader;
+    fluid_sfont_t *loaded_sfont;
+    std::thread sf_thd;
+    std::atomic<int> sf_state;
+    void init_loader();
+    bool get_channel_program(int channel, int *bank, int *program);
 
 public:
     XSynth();
     ~XSynth();
 
     std::vector<std::string> instruments;
+    // the tuning programs by number, 0 is just intonation, 1 12edo, 2 scala
+    std::vector<std::string> tuning_names;
     int channel_instrument[16];
     int reverb_on;
     double reverb_level;
@@ -84,11 +152,28 @@ public:
     double volume_level;
 
     void setup(unsigned int SampleRate, const char *instance_name);
+    void setup_offline(unsigned int SampleRate);
     void init_synth();
     int synth_send_cc(int channel, int num, int value);
+    int synth_send_event(const uint8_t *midi);
+    int render(float *left, float *right, int frames);
     void reset_modulators();
     int synth_is_active() {return synth ? 1 : 0;}
     int load_soundfont(const char *path);
+    enum { SF_IDLE, SF_LOADING, SF_LOADED, SF_FAILED };
+    // called from the load thread when the load is done
+    std::function<void() > soundfont_loaded;
+    // load a soundfont in a extra thread while the current one keep playing,
+    // return -1 without a synth and 1 while a other load is running
+    int load_soundfont_async(const char *path);
+    int get_soundfont_state() const noexcept {
+        return sf_state.load(std::memory_order_acquire);
+    }
+    // percent of the soundfont file read so far
+    int get_load_progress() const noexcept;
+    // replace the playing soundfont with the loaded one, the channels
+    // keep there bank and program when the new soundfont have them
+    int swap_soundfont();
     void print_soundfont();
     void set_default_instruments();
     void set_instrument_on_channel(int channel, int instrument);
@@ -20,6 +20,7 @@
 
 #include "MidiKeyBoard.h"
 #include "xmkeyboard.h"
+#include "MidiRender.h"
 
 
 /****************************************************************
@@ -45,6 +46,43 @@ int main (int argc, char *argv[]) {
     if(0 == XInitThreads()) 
         fprintf(stderr, "Warning: XInitThreads() failed\n");
 
+    // --dsp-stats print the jack process statistics every 5 seconds
+    // --bench-latency[=probes] measure the midi round trip headless and exit
+    // --render=out.wav render the loops (or the given midi file) offline and exit,
+    //   with --soundfont=, --bpm=, --repeat= and --samplerate=
+    // --transform=rules.mtx transform the midi input by the given rule file
+    bool dsp_stats = false;
+    int bench_probes = 0;
+    const char *render_file = NULL;
+    const char *render_soundfont = NULL;
+    int render_bpm = 0;
+    int render_repeat = 1;
+    unsigned int render_rate = 48000;
+    const char *transform_file = NULL;
+    int file_arg = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dsp-stats") == 0) dsp_stats = true;
+        else if (strncmp(argv[i], "--bench-latency", 15) == 0) {
+            bench_probes = argv[i][15] == '=' ? atoi(&argv[i][16]) : 0;
+            if (bench_probes < 1) bench_probes = 200;
+        }
+        else if (strncmp(argv[i], "--render=", 9) == 0) render_file = &argv[i][9];
+        else if (strncmp(argv[i], "--soundfont=", 12) == 0) render_soundfont = &argv[i][12];
+        else if (strncmp(argv[i], "--bpm=", 6) == 0) render_bpm = atoi(&argv[i][6]);
+        else if (strncmp(argv[i], "--repeat=", 9) == 0) render_repeat = atoi(&argv[i][9]);
+        else if (strncmp(argv[i], "--samplerate=", 13) == 0) {
+            const int rate = atoi(&argv[i][13]);
+            if (rate <= 0) {
+                fprintf(stderr, "usage: --samplerate=rate, rate must be a positive number of Hz, not '%s'\n",
+                                                                                    &argv[i][13]);
+                exit (1);
+            }
+            render_rate = rate;
+        }
+        else if (strncmp(argv[i], "--transform=", 12) == 0) transform_file = &argv[i][12];
+        else if (!file_arg) file_arg = i;
+    }
+
     signalhandler::PosixSignalHandler xsig;
 
     Xputty app;
@@ -57,21 +95,85 @@ int main (int argc, char *argv[]) {
         (int _cc, int _pg, int _bgn, int _num, bool have_channel) noexcept
         {mmessage.send_midi_cc( _cc, _pg, _bgn, _num, have_channel);});
 
+    miditransform::MidiTransform mtransform;
+    velocitycurve::VelocityCurves vcurves;
+
     xalsa::XAlsa xalsa([&mmessage]
-        (int _cc, int _pg, int _bgn, int _num, bool have_channel) noexcept
-        {mmessage.send_midi_cc( _cc, _pg, _bgn, _num, have_channel);},
+        (const uint8_t* m, uint8_t n, uint32_t time) noexcept {mmessage.push(m, n, time);},
         [&midimap] (const uint8_t* m ,uint8_t n ) noexcept {midimap.mmapper_input_notify(m,n);});
 
     xjack::XJack xjack(&mmessage,
-        [&xalsa] (const uint8_t* m ,uint8_t n ) noexcept {xalsa.xalsa_output_notify(m,n);},
+        [&xalsa] (const uint8_t* m ,uint8_t n, uint32_t time ) noexcept {xalsa.xalsa_output_notify(m,n,time);},
         [&xalsa] (int p ) {xalsa.xalsa_set_priority(p);},
-        [&midimap] (const uint8_t* m ,uint8_t n ) noexcept {midimap.mmapper_input_notify(m,n);},
-        [&midimap] (int p ) {midimap.mmapper_set_priority(p);});
+        [&midimap] () noexcept {return midimap.rt_acquire();},
+        [&midimap] (int p ) {midimap.mmapper_set_priority(p);},
+        [&mtransform] () noexcept {return mtransform.rt_acquire();},
+        [&vcurves] () noexcept {return vcurves.rt_acquire();},
+        [&animidi] () noexcept {animidi.notify();});
+
+    mmessage.frame_time = [&xjack] () noexcept -> uint32_t
+        {return xjack.client ? jack_frame_time(xjack.client) : 0;};
+    xalsa.frame_time = mmessage.frame_time;
+    xalsa.transform = [&mtransform] (int source, const uint8_t* m, uint8_t n, uint8_t (*out)[3]) noexcept
+        {return mtransform.transform(source, m, n, out);};
+    xalsa.velocity = [&vcurves] (int source, uint8_t* m, uint8_t n) noexcept
+        {vcurves.apply(source, m, n);};
+
+    if (bench_probes) {
+        xjack.client_name = "Mamba-bench";
+        if (!xjack.init_jack()) exit (1);
+        int ret = 1;
+        {
+            latencybench::LatencyBench bench(&xjack, &xalsa, &midimap);
+            ret = bench.run(bench_probes);
+        }
+        jack_client_close (xjack.client);
+        xjack.client = NULL;
+        exit (ret);
+    }
 
     xsynth::XSynth xsynth;
-    midikeyboard::XKeyBoard xjmkb(&xjack, &xalsa, &xsynth, &midimap, &mmessage, nsmsig, xsig, &animidi);
+    midikeyboard::XKeyBoard xjmkb(&xjack, &xalsa, &xsynth, &midimap, &mtransform, &vcurves, &mmessage, nsmsig, xsig, &animidi);
     nsmhandler::NsmHandler nsmh(&nsmsig);
 
+    if (render_file) {
+        // the session loops and the synth settings come from the config
+        xjmkb.set_config_file();
+        xjmkb.read_config();
+        if (file_arg) {
+            mamba::EventStore play_file;
+            mamba::MidiLoad load;
+            int file_bpm = 0;
+            if (!load.load_from_file(&play_file, &file_bpm, argv[file_arg])) {
+                fprintf(stderr, "render: couldn't load '%s'\n", argv[file_arg]);
+                exit (1);
+            }
+            xjack.rec.loops.update_all([&play_file](mamba::EventStore* play) {
+                play[0] = std::move(play_file);
+                for(int i = 1;i<16;i++)
+                    play[i].clear();
+            });
+            if (render_bpm < 1) render_bpm = file_bpm;
+        }
+        if (render_bpm < 1) render_bpm = 120;
+        if (render_repeat < 1) render_repeat = 1;
+        const char *sf = render_soundfont ? render_soundfont : xjmkb.soundfont.c_str();
+        const double volume = xsynth.volume_level;
+        xsynth.setup_offline(render_rate);
+        xsynth.init_synth();
+        if (xsynth.load_soundfont(sf)) {
+            fprintf(stderr, "render: couldn't load soundfont '%s'\n", sf);
+            exit (1);
+        }
+        xsynth.volume_level = volume;
+        xsynth.set_gain();
+        midirender::MidiRender render(&xsynth);
+        const bool ok = render.render(xjack.rec.loops.get_snapshot(), render_bpm,
+                                        render_rate, render_repeat, 2.0, render_file);
+        xsynth.unload_synth();
+        exit (ok ? 0 : 1);
+    }
+
     nsmsig.nsm_session_control = nsmh.check_nsm(xjmkb.client_name.c_str(), argv);
 
     main_init(&app);
@@ -82,13 +184,19 @@ int main (int argc, char *argv[]) {
             xjmkb.set_config_file();
 
         xjmkb.read_config();
+        if (transform_file) {
+            std::string error;
+            if (!mtransform.load(transform_file, &error))
+                fprintf(stderr, "midi transform: %s\n", error.c_str());
+        }
         xjmkb.init_ui(&app);
         MambaKeyboard *keys = (MambaKeyboard*)xjmkb.wid->parent_struct;
-        midimap.mmapper_start([keys] (int channel, int key, bool set)
-            {mamba_set_key_in_matrix(keys->in_key_matrix[channel], key, set);});
+        midimap.mmapper_start([keys, &animidi] (int channel, int key, bool set)
+            {mamba_set_key_in_matrix(&keys->in_key_matrix[channel], key, set); animidi.notify();});
+        xalsa.samplerate = xjack.SampleRate;
         if (xalsa.xalsa_init(xjack.client_name.c_str(), "input", "output") >= 0) {
-            xalsa.xalsa_start([keys] (int channel, int key, bool set)
-                {mamba_set_key_in_matrix(keys->in_key_matrix[channel], key, set);});
+            xalsa.xalsa_start([keys, &animidi] (int channel, int key, bool set)
+                {mamba_set_key_in_matrix(&keys->in_key_matrix[channel], key, set); animidi.notify();});
         } else {
             fprintf(stderr, _("Couldn't open a alsa port, is the alsa sequencer running?\n"));
         }
@@ -123,23 +231,26 @@ int main (int argc, char *argv[]) {
             xjmkb.init_modulators(&xjmkb);
         }
         
-        if (argc > 1) {
+        if (file_arg) {
 
 #ifdef __XDG_MIME_H__
-            if(strstr(xdg_mime_get_mime_type_from_file_name(argv[1]), "midi")) {
+            if(strstr(xdg_mime_get_mime_type_from_file_name(argv[file_arg]), "midi")) {
 #else
-            if( access(argv[1], F_OK ) != -1 ) {
+            if( access(argv[file_arg], F_OK ) != -1 ) {
 #endif
-                xjmkb.dialog_load_response(xjmkb.win, (void*) &argv[1]);
+                xjmkb.dialog_load_response(xjmkb.win, (void*) &argv[file_arg]);
             }
         }
 
         if (xsynth.synth_is_active()) {
-            for(std::vector<mamba::MidiEvent>::iterator i = xjack.rec.play[0].begin(); i != xjack.rec.play[0].end(); ++i) {
-                if (((*i).buffer[0] & 0xf0) == 0xB0 && ((*i).buffer[1]== 32 || (*i).buffer[1]== 0)) {
-                    mmessage.send_midi_cc((*i).buffer[0], (*i).buffer[1], (*i).buffer[2], 3, true);
-                } else if (((*i).buffer[0] & 0xf0) == 0xC0 ) {
-                    mmessage.send_midi_cc((*i).buffer[0], (*i).buffer[1], 0, 2, true);
+            const mamba::LoopSnapshot loops = xjack.rec.loops.get_snapshot();
+            const mamba::EventStore& play = loops.channel(0);
+            for(size_t i = 0; i < play.size(); i++) {
+                const uint8_t *d = play.get_data(i);
+                if ((d[0] & 0xf0) == 0xB0 && (d[1]== 32 || d[1]== 0)) {
+                    mmessage.send_midi_cc(d[0], d[1], d[2], 3, true);
+                } else if ((d[0] & 0xf0) == 0xC0 ) {
+                    mmessage.send_midi_cc(d[0], d[1], 0, 2, true);
                 }
             }
         }
@@ -152,9 +263,34 @@ int main (int argc, char *argv[]) {
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
         debug_print("%f sec\n",duration/1e+6);
 
+        std::atomic<bool> stats_run(dsp_stats);
+        std::thread stats_thd;
+        if (dsp_stats) {
+            stats_thd = std::thread([&xjack, &xalsa, &mmessage, &stats_run]() {
+                int i = 0;
+                while (stats_run.load(std::memory_order_acquire)) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    if (++i < 50 || !xjack.client) continue;
+                    i = 0;
+                    fprintf(stdout, "%s\n", xjack.stats.report(jack_cpu_load(xjack.client)).c_str());
+                    fprintf(stdout, "midi queue drops: jack %u alsa %u rawmidi %u\n",
+                        mmessage.get_overflows(), xalsa.get_overflows(), xalsa.raw.get_overflows());
+                    fflush(stdout);
+                }
+            });
+        }
+
         main_run(&app);
         
+        if (dsp_stats) {
+            stats_run.store(false, std::memory_order_release);
+            stats_thd.join();
+            fprintf(stdout, "%s\n", xjack.stats.report(0.0).c_str());
+        }
+        xjmkb.roll.stop();
         animidi.stop();
+        // the alsa input thread stamp events with the jack frame time
+        xalsa.xalsa_stop();
         if (xjack.client) jack_client_close (xjack.client);
         xsynth.unload_synth();
         if(!nsmsig.nsm_session_control) xjmkb.save_config();
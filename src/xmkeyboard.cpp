@@ -291,160 +291,86 @@ void mamba_custom_to_midi_key(long custom_keys[128][2], long inkey, float *midi_
     }
 }
 
-void add_major_chord(unsigned long *key_matrix, int inkey, bool set) {
-    unsigned long *use_matrix = &key_matrix[0];
-    int key = inkey + 4;
-    
-    if(key>94) {
-        use_matrix = &key_matrix[3];
-        key -=94;
-    } else if(key>62) {
-        use_matrix = &key_matrix[2];
-        key -=62;
-    } else if(key>31) {
-        use_matrix = &key_matrix[1];
-        key -= 31;
-    }
-    if (set) {
-        (*use_matrix) |= (1 << key);
-    }else {
-        (*use_matrix) &= (~(1 << key));
-    }
-
-    key = inkey + 7;
-    if(key>94) {
-        use_matrix = &key_matrix[3];
-        key -=94;
-    } else if(key>62) {
-        use_matrix = &key_matrix[2];
-        key -=62;
-    } else if(key>31) {
-        use_matrix = &key_matrix[1];
-        key -= 31;
-    }
-    if (set) {
-        (*use_matrix) |= (1 << key);
-    }else {
-        (*use_matrix) &= (~(1 << key));
-    }
+// set a key in a local matrix, not shared with other threads
+static void set_key_bit(MambaKeySet *key_matrix, int key, bool set) {
+    if (key < 0 || key > 127) return;
+    if (set) key_matrix->word[key >> 6] |= (UINT64_C(1) << (key & 63));
+    else key_matrix->word[key >> 6] &= ~(UINT64_C(1) << (key & 63));
 }
 
-void add_minor_chord(unsigned long *key_matrix, int inkey, bool set) {
-    unsigned long *use_matrix = &key_matrix[0];
-    int key = inkey + 3;
-    
-    if(key>94) {
-        use_matrix = &key_matrix[3];
-        key -=94;
-    } else if(key>62) {
-        use_matrix = &key_matrix[2];
-        key -=62;
-    } else if(key>31) {
-        use_matrix = &key_matrix[1];
-        key -= 31;
-    }
-    if (set) {
-        (*use_matrix) |= (1 << key);
-    }else {
-        (*use_matrix) &= (~(1 << key));
-    }
-
-    key = inkey + 7;
-    if(key>94) {
-        use_matrix = &key_matrix[3];
-        key -=94;
-    } else if(key>62) {
-        use_matrix = &key_matrix[2];
-        key -=62;
-    } else if(key>31) {
-        use_matrix = &key_matrix[1];
-        key -= 31;
-    }
-    if (set) {
-        (*use_matrix) |= (1 << key);
-    }else {
-        (*use_matrix) &= (~(1 << key));
-    }
+void add_major_chord(MambaKeySet *key_matrix, int inkey, bool set) {
+    set_key_bit(key_matrix, inkey + 4, set);
+    set_key_bit(key_matrix, inkey + 7, set);
 }
 
-void mamba_set_key_in_matrix(unsigned long *key_matrix, int key, bool set) {
-    unsigned long *use_matrix = &key_matrix[0];
-    if (key > 127) return;
+void add_minor_chord(MambaKeySet *key_matrix, int inkey, bool set) {
+    set_key_bit(key_matrix, inkey + 3, set);
+    set_key_bit(key_matrix, inkey + 7, set);
+}
 
-    if(key>94) {
-        use_matrix = &key_matrix[3];
-        key -=94;
-    } else if(key>62) {
-        use_matrix = &key_matrix[2];
-        key -=62;
-    } else if(key>31) {
-        use_matrix = &key_matrix[1];
-        key -= 31;
-    }
+void mamba_set_key_in_matrix(MambaKeySet *key_matrix, int key, bool set) {
+    if (key < 0 || key > 127) return;
+    const uint64_t bit = UINT64_C(1) << (key & 63);
     if (set) {
-        (*use_matrix) |= (1 << key);
+        __atomic_fetch_or(&key_matrix->word[key >> 6], bit, __ATOMIC_RELEASE);
     }else {
-        (*use_matrix) &= (~(1 << key));
+        __atomic_fetch_and(&key_matrix->word[key >> 6], ~bit, __ATOMIC_RELEASE);
     }
 }
 
-bool mamba_is_key_in_matrix(unsigned long *key_matrix, int key) {
-    unsigned long *use_matrix = &key_matrix[0];
-    if (key > 127) return false;
-
-    if(key>94) {
-        use_matrix = &key_matrix[3];
-        key -=94;
-    } else if(key>62) {
-        use_matrix = &key_matrix[2];
-        key -=62;
-    } else if(key>31) {
-        use_matrix = &key_matrix[1];
-        key -= 31;
-    }
-    bool ret = false;
-    if((*use_matrix) & (1<<key)) {
-        ret = true;
-    }
-    return ret;
+bool mamba_is_key_in_matrix(const MambaKeySet *key_matrix, int key) {
+    if (key < 0 || key > 127) return false;
+    return (__atomic_load_n(&key_matrix->word[key >> 6], __ATOMIC_ACQUIRE)
+            >> (key & 63)) & 1;
 }
 
 int is_key_in_in_matrix(MambaKeyboard *keys, int key) {
+    // most keys are held by no channel at all
+    if (!mamba_is_key_in_matrix(&keys->in_key_union, key)) return -1;
     int i = 0;
     for(;i<16;i++) {
-        if (mamba_is_key_in_matrix(keys->in_key_matrix[i], key)) {
+        if (mamba_is_key_in_matrix(&keys->in_key_matrix[i], key)) {
            return i; 
        }
     }
     return -1;
 }
 
-bool mamba_have_key_in_matrix(unsigned long *key_matrix) {
-    
-    bool ret = false;
-    int i = 0;
-    int j = 0;
-    for(;j<4;j++) {
-        for(;i<32;i++) {
-            if(key_matrix[j] & (1<<i)) {
-                ret = true;
-                break;
-            }
-        }
-        i = 0;
+bool mamba_have_key_in_matrix(const MambaKeySet *key_matrix) {
+    return (__atomic_load_n(&key_matrix->word[0], __ATOMIC_ACQUIRE) |
+            __atomic_load_n(&key_matrix->word[1], __ATOMIC_ACQUIRE)) != 0;
+}
+
+void mamba_clear_key_matrix(MambaKeySet *key_matrix) {
+    __atomic_store_n(&key_matrix->word[0], 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&key_matrix->word[1], 0, __ATOMIC_RELEASE);
+}
+
+int mamba_count_keys_in_matrix(const MambaKeySet *key_matrix) {
+    return __builtin_popcountll(__atomic_load_n(&key_matrix->word[0], __ATOMIC_ACQUIRE)) +
+           __builtin_popcountll(__atomic_load_n(&key_matrix->word[1], __ATOMIC_ACQUIRE));
+}
+
+int mamba_next_key_in_matrix(const MambaKeySet *key_matrix, int key) {
+    if (key < 0) key = 0;
+    for (;key < 128; key = (key | 63) + 1) {
+        const uint64_t word = __atomic_load_n(&key_matrix->word[key >> 6], __ATOMIC_ACQUIRE)
+                              >> (key & 63);
+        if (word) return key + __builtin_ctzll(word);
     }
-    return ret;
+    return -1;
 }
 
-void mamba_clear_key_matrix(unsigned long *key_matrix) {
+// the keys held on any input channel
+static void update_in_key_union(MambaKeyboard *keys) {
+    uint64_t word[2] = {0, 0};
     int i = 0;
-    int j = 0;
-    for(;j<4;j++) {
-        for(;i<32;i++) {
-            key_matrix[j] &= (~(1 << i));
-        }
-        i = 0;
+    for(;i<16;i++) {
+        word[0] |= __atomic_load_n(&keys->in_key_matrix[i].word[0], __ATOMIC_ACQUIRE);
+        word[1] |= __atomic_load_n(&keys->in_key_matrix[i].word[1], __ATOMIC_ACQUIRE);
     }
+    keys->in_key_union.word[0] = word[0];
+    keys->in_key_union.word[1] = word[1];
 }
 
 void use_matrix_color(Widget_t *w, int c) {
@@ -605,197 +531,259 @@ void mamba_set_edo(MambaKeyboard *keys, Widget_t *w, int edo) {
     expose_widget(w);
 }
 
-static void draw_double_key(Widget_t* w, cairo_pattern_t *pat, MambaKeyboard *keys, int *i, int *k, int height) {
-    int ik = is_key_in_in_matrix(keys, (*k)+keys->octave);
-    int key_size = keys->key_size/2;
-    int j = 0;
-    int i_ = (*i);
-    cairo_set_line_width(w->crb, 1.0);
-    for (;j<2;j++) {
-        cairo_rectangle(w->crb,i_+keys->key_offset-2,0, key_size-1,height);
-        if ( (*k)+keys->octave == keys->active_key || mamba_is_key_in_matrix(keys->key_matrix,(*k)+keys->octave)) {
-            //use_base_color_scheme(w, ACTIVE_);
-            use_matrix_color(w, keys->channel);
-            cairo_set_line_width(w->crb, 1.0);
-        } else if (ik > -1) {
-            use_matrix_color(w, ik);
-            cairo_set_line_width(w->crb, 2.0);
-        } else if ( (*k)+keys->octave == keys->prelight_key) {
-            use_base_color_scheme(w, PRELIGHT_);
-            cairo_set_line_width(w->crb, 2.0);
-        } else {
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_set_line_width(w->crb, 1.0);
-        }
-
-        cairo_fill_preserve(w->crb);
-        cairo_set_source(w->crb, pat);
-        cairo_fill_preserve(w->crb);
-        use_base_color_scheme(w, NORMAL_);
-        cairo_stroke(w->crb);
-
-        (*k)++;
-        i_ += key_size+1;
-    }
+// key kinds in the layout
+#define KEY_NONE 0
+#define KEY_WHITE 1
+#define KEY_BLACK 2
+#define KEY_HALF 3
+
+// remember where a key is drawn
+static void set_key_area(MambaKeyboard *keys, int key, int x, int width, unsigned char kind) {
+    if (key < 0 || key > 127) return;
+    keys->key_x[key] = x;
+    keys->key_w[key] = width;
+    keys->key_kind[key] = kind;
 }
 
-static void draw_keyboard(void *w_, void* user_data) {
-    Widget_t *w = (Widget_t*)w_;
-    XWindowAttributes attrs;
-    XGetWindowAttributes(w->app->dpy, (Window)w->widget, &attrs);
-    int width_t = attrs.width;
-    int height_t = attrs.height;
-    if (attrs.map_state != IsViewable) return;
-    use_bg_color_scheme(w, NORMAL_);
-    cairo_fill_preserve(w->crb);
-    cairo_paint(w->crb);
-    MambaKeyboard *keys = (MambaKeyboard*)w->parent_struct;
- 
+// place the keys for the current size, octave and edo
+static void layout_keys(MambaKeyboard *keys, int width_t) {
+    memset(keys->key_kind, KEY_NONE, sizeof(keys->key_kind));
     int i = 0;
     int k = 0;
-    int ik = -1;
-    int octave_ofset = keys->key_size/6;
-    int octave = keys->octave;
-    if (keys->key_size<24)
-        cairo_set_font_size (w->crb, w->app->small_font);
-    else
-        cairo_set_font_size (w->crb, w->app->normal_font);
-
     for(;i<width_t;i++) {
-        //fprintf(stderr, " set white k = %i, set = %i, space = %i edo_matrix %i\n", k+keys->octave, set, space, mamba_is_key_in_matrix(keys->edo_matrix[0],k+keys->octave));
-        ik = is_key_in_in_matrix(keys, k+keys->octave);
-        cairo_rectangle(w->crb,i,0,keys->key_size+1,height_t);
-        if ( k+keys->octave == keys->active_key || mamba_is_key_in_matrix(keys->key_matrix,k+keys->octave)) {
-            //use_base_color_scheme(w, ACTIVE_);
-            use_matrix_color(w, keys->channel);
-            cairo_set_line_width(w->crb, 1.0);
-        } else if (ik > -1) {
-            use_matrix_color(w, ik);
-            cairo_set_line_width(w->crb, 2.0);
-        } else if ( k+keys->octave == keys->prelight_key) {
-            use_base_color_scheme(w, PRELIGHT_);
-            cairo_set_line_width(w->crb, 2.0);
-        } else {
-            use_fg_color_scheme(w, NORMAL_);
-            cairo_set_line_width(w->crb, 1.0);
-        }
-
-        cairo_fill_preserve(w->crb);
-        use_base_color_scheme(w, NORMAL_);
-        cairo_stroke(w->crb);
-
-        if(k+octave == 0) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C-1");
-        } else if(k+octave == keys->edo) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C0");
-        } else if(k+octave == keys->edo *2) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C1");
-        } else if(k+octave == keys->edo *3) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C2");
-        } else if(k+octave == keys->edo *4) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C3");
-        } else if(k+octave == keys->edo *5) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C4");
-        } else if(k+octave == keys->edo *6) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C5");
-        } else if(k+octave == keys->edo *7) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C6");
-        } else if(k+octave == keys->edo *8) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C7");
-        } else if(k+octave == keys->edo *9) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C8");
-        } else if(k+octave == keys->edo *10) {
-            cairo_move_to (w->crb, i+octave_ofset, height_t*0.9);
-            use_bg_color_scheme(w, NORMAL_);
-            cairo_show_text(w->crb, "C9");
-        }
-
+        set_key_area(keys, k+keys->octave, i, keys->key_size+1, KEY_WHITE);
         if (!is_key_in_edo_matrix(keys->edo_matrix,k+1+keys->octave)) {
             k++;
             if (!is_key_in_edo_matrix(keys->edo_matrix,k+1+keys->octave))
                 k++;
         }
-
         if (k>127) break;
         i+=keys->key_size;
         k++;
     }
 
     k = 1;
-    ik = -1;
     i = 0;
-    cairo_pattern_t *pat = cairo_pattern_create_linear (0, 0, 0, height_t*0.59);
-    cairo_pattern_add_color_stop_rgba(pat, 0.0, 0.85, 0.85, 0.85, 0.4);
-    cairo_pattern_add_color_stop_rgba(pat, 0.2, 0.0, 0.0, 0.0, 0.0);
-    cairo_pattern_add_color_stop_rgba(pat, 1.0, 0.0, 0.0, 0.0, 0.0);
-
     for(;i<width_t;i++) {
-
         if ((!is_key_in_edo_matrix(keys->edo_matrix,k+keys->octave))) {
             if (!is_key_in_edo_matrix(keys->edo_matrix,k+1+keys->octave)) {
-                draw_double_key(w, pat, keys, &i, &k, height_t*0.59);
-            } else {
-                ik = is_key_in_in_matrix(keys, k+keys->octave);
-                cairo_set_line_width(w->crb, 1.0);
-                cairo_rectangle(w->crb,i+keys->key_offset,0,keys->key_size-4,height_t*0.59);
-                if ( k+keys->octave == keys->active_key || mamba_is_key_in_matrix(keys->key_matrix,k+keys->octave)) {
-                    //use_base_color_scheme(w, ACTIVE_);
-                    use_matrix_color(w, keys->channel);
-                    cairo_set_line_width(w->crb, 1.0);
-                } else if (ik > -1) {
-                    use_matrix_color(w, ik);
-                    cairo_set_line_width(w->crb, 2.0);
-                } else if ( k+keys->octave == keys->prelight_key) {
-                    use_base_color_scheme(w, PRELIGHT_);
-                    cairo_set_line_width(w->crb, 2.0);
-                } else {
-                    use_bg_color_scheme(w, NORMAL_);
-                    cairo_set_line_width(w->crb, 1.0);
+                // two small keys share the place of a black key
+                int key_size = keys->key_size/2;
+                int i_ = i;
+                for (int j = 0;j<2;j++) {
+                    set_key_area(keys, k+keys->octave, i_+keys->key_offset-2, key_size-1, KEY_HALF);
+                    k++;
+                    i_ += key_size+1;
                 }
-
-                cairo_fill_preserve(w->crb);
-                cairo_set_source(w->crb, pat);
-                cairo_fill_preserve(w->crb);
-                use_base_color_scheme(w, NORMAL_);
-                cairo_stroke(w->crb);
-
+            } else {
+                set_key_area(keys, k+keys->octave, i+keys->key_offset, keys->key_size-4, KEY_BLACK);
                 k++;
             }
         }
-
         i+=keys->key_size;
         k++;
         if(k>127)break;
     }
-    cairo_pattern_destroy (pat);
-    pat = cairo_pattern_create_linear (0, 0, 0, height_t);
-    cairo_pattern_add_color_stop_rgba(pat, 1.0, 0.0, 0.0, 0.0, 0.4);
-    cairo_pattern_add_color_stop_rgba(pat, 0.8, 0.0, 0.0, 0.0, 0.0);
-    cairo_pattern_add_color_stop_rgba(pat, 0.0, 0.0, 0.0, 0.0, 0.0);
-    cairo_set_source(w->crb, pat);
+}
+
+// the look of a key, as drawn by draw_keyboard()
+static unsigned char key_state(MambaKeyboard *keys, int key) {
+    if (key == keys->active_key || mamba_is_key_in_matrix(&keys->key_matrix, key)) return 1;
+    int ik = is_key_in_in_matrix(keys, key);
+    if (ik > -1) return 2 + ik;
+    if (key == keys->prelight_key) return 18;
+    return 0;
+}
+
+// draw a key at x into w->crb
+static void paint_key(Widget_t *w, MambaKeyboard *keys, unsigned char kind,
+                      unsigned char state, double x, double width, double height) {
+    cairo_rectangle(w->crb, x, 0, width, height);
+    if (state == 1) {
+        use_matrix_color(w, keys->channel);
+        cairo_set_line_width(w->crb, 1.0);
+    } else if (state > 1 && state < 18) {
+        use_matrix_color(w, state - 2);
+        cairo_set_line_width(w->crb, 2.0);
+    } else if (state == 18) {
+        use_base_color_scheme(w, PRELIGHT_);
+        cairo_set_line_width(w->crb, 2.0);
+    } else {
+        if (kind == KEY_WHITE) use_fg_color_scheme(w, NORMAL_);
+        else use_bg_color_scheme(w, NORMAL_);
+        cairo_set_line_width(w->crb, 1.0);
+    }
+    cairo_fill_preserve(w->crb);
+    if (kind != KEY_WHITE) {
+        cairo_set_source(w->crb, keys->black_pattern);
+        cairo_fill_preserve(w->crb);
+    }
+    use_base_color_scheme(w, NORMAL_);
+    cairo_stroke(w->crb);
+}
+
+static void paint_key_label(Widget_t *w, MambaKeyboard *keys, int key, int height_t) {
+    static const char *labels[11] = {"C-1", "C0", "C1", "C2", "C3", "C4", "C5", "C6", "C7", "C8", "C9"};
+    if (key % keys->edo || key / keys->edo > 10) return;
+    cairo_move_to (w->crb, keys->key_x[key]+keys->key_size/6, height_t*0.9);
+    use_bg_color_scheme(w, NORMAL_);
+    cairo_show_text(w->crb, labels[key / keys->edo]);
+}
+
+static int key_height(unsigned char kind, int height_t) {
+    return kind == KEY_WHITE ? height_t : (int)(height_t*0.59);
+}
+
+// a pre rendered key, with 2px room for the outline
+static cairo_surface_t *get_sprite(Widget_t *w, MambaKeyboard *keys, int key, unsigned char state, int height_t) {
+    const unsigned char kind = keys->key_kind[key];
+    cairo_surface_t **sprite = &keys->sprite[kind-1][state];
+    if (*sprite) return *sprite;
+    const int height = key_height(kind, height_t);
+    *sprite = cairo_surface_create_similar(cairo_get_target(w->crb),
+                        CAIRO_CONTENT_COLOR_ALPHA, keys->key_w[key]+4, height+2);
+    // the color scheme helpers draw to w->crb
+    cairo_t *crb = w->crb;
+    w->crb = cairo_create(*sprite);
+    cairo_translate(w->crb, 2, 0);
+    paint_key(w, keys, kind, state, 0, keys->key_w[key], height);
+    cairo_destroy(w->crb);
+    w->crb = crb;
+    return *sprite;
+}
+
+static void free_key_cache(MambaKeyboard *keys) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 19; j++) {
+            if (keys->sprite[i][j]) cairo_surface_destroy(keys->sprite[i][j]);
+            keys->sprite[i][j] = NULL;
+        }
+    }
+    if (keys->cache) cairo_surface_destroy(keys->cache);
+    keys->cache = NULL;
+    if (keys->black_pattern) cairo_pattern_destroy(keys->black_pattern);
+    keys->black_pattern = NULL;
+    if (keys->shade_pattern) cairo_pattern_destroy(keys->shade_pattern);
+    keys->shade_pattern = NULL;
+}
+
+// draw the keys touching the current clip, the white keys first
+static void compose_keys(Widget_t *w, MambaKeyboard *keys, const unsigned char *state,
+                         int width_t, int height_t, bool use_sprites) {
+    double x1, y1, x2, y2;
+    cairo_clip_extents(w->crb, &x1, &y1, &x2, &y2);
+    use_bg_color_scheme(w, NORMAL_);
+    cairo_paint(w->crb);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int key = 0; key < 128; key++) {
+            const unsigned char kind = keys->key_kind[key];
+            if (kind == KEY_NONE || (kind == KEY_WHITE) != (pass == 0)) continue;
+            if (keys->key_x[key]+keys->key_w[key]+2 < x1 || keys->key_x[key]-2 > x2) continue;
+            if (use_sprites) {
+                cairo_set_source_surface(w->crb, get_sprite(w, keys, key, state[key], height_t),
+                                         keys->key_x[key]-2, 0);
+                cairo_paint(w->crb);
+            } else {
+                paint_key(w, keys, kind, state[key], keys->key_x[key], keys->key_w[key],
+                          key_height(kind, height_t));
+            }
+            if (kind == KEY_WHITE) paint_key_label(w, keys, key, height_t);
+        }
+    }
+    cairo_set_source(w->crb, keys->shade_pattern);
     cairo_rectangle(w->crb,0,0,width_t,height_t);
     cairo_fill(w->crb);
-    cairo_pattern_destroy (pat);
+}
+
+static void draw_keyboard(void *w_, void* user_data) {
+    Widget_t *w = (Widget_t*)w_;
+    // the size xputty keep up to date, no server round trip
+    int width_t = w->width;
+    int height_t = w->height;
+    if (width_t < 1 || height_t < 1) return;
+    MambaKeyboard *keys = (MambaKeyboard*)w->parent_struct;
+    if (keys->key_size<24)
+        cairo_set_font_size (w->crb, w->app->small_font);
+    else
+        cairo_set_font_size (w->crb, w->app->normal_font);
+
+    // render the idle keyboard once per layout
+    const int layout[7] = {width_t, height_t, keys->octave, keys->key_size,
+                           keys->key_offset, keys->edo, keys->channel};
+    if (memcmp(layout, keys->drawn_layout, sizeof(layout)) != 0 || !keys->cache) {
+        free_key_cache(keys);
+        memcpy(keys->drawn_layout, layout, sizeof(layout));
+        layout_keys(keys, width_t);
+        keys->black_pattern = cairo_pattern_create_linear (0, 0, 0, height_t*0.59);
+        cairo_pattern_add_color_stop_rgba(keys->black_pattern, 0.0, 0.85, 0.85, 0.85, 0.4);
+        cairo_pattern_add_color_stop_rgba(keys->black_pattern, 0.2, 0.0, 0.0, 0.0, 0.0);
+        cairo_pattern_add_color_stop_rgba(keys->black_pattern, 1.0, 0.0, 0.0, 0.0, 0.0);
+        keys->shade_pattern = cairo_pattern_create_linear (0, 0, 0, height_t);
+        cairo_pattern_add_color_stop_rgba(keys->shade_pattern, 1.0, 0.0, 0.0, 0.0, 0.4);
+        cairo_pattern_add_color_stop_rgba(keys->shade_pattern, 0.8, 0.0, 0.0, 0.0, 0.0);
+        cairo_pattern_add_color_stop_rgba(keys->shade_pattern, 0.0, 0.0, 0.0, 0.0, 0.0);
+        keys->cache = cairo_surface_create_similar(cairo_get_target(w->crb),
+                                    CAIRO_CONTENT_COLOR_ALPHA, width_t, height_t);
+        unsigned char idle[128];
+        memset(idle, 0, sizeof(idle));
+        cairo_t *crb = w->crb;
+        w->crb = cairo_create(keys->cache);
+        cairo_set_font_size (w->crb, keys->key_size<24 ? w->app->small_font : w->app->normal_font);
+        compose_keys(w, keys, idle, width_t, height_t, false);
+        cairo_destroy(w->crb);
+        w->crb = crb;
+        memset(keys->drawn_state, 0, sizeof(keys->drawn_state));
+        memset(&keys->drawn_keys, 0, sizeof(keys->drawn_keys));
+        // the buffer is new, fill it before drawing the changed keys
+        cairo_set_source_surface(w->crb, keys->cache, 0, 0);
+        cairo_paint(w->crb);
+    }
+
+    // only keys which are, or was, shown not idle need a look
+    update_in_key_union(keys);
+    MambaKeySet busy = keys->in_key_union;
+    busy.word[0] |= __atomic_load_n(&keys->key_matrix.word[0], __ATOMIC_ACQUIRE);
+    busy.word[1] |= __atomic_load_n(&keys->key_matrix.word[1], __ATOMIC_ACQUIRE);
+    set_key_bit(&busy, keys->active_key, true);
+    set_key_bit(&busy, keys->prelight_key, true);
+    MambaKeySet check = busy;
+    check.word[0] |= keys->drawn_keys.word[0];
+    check.word[1] |= keys->drawn_keys.word[1];
+    keys->drawn_keys = busy;
+
+    // collect the keys which changed since the last drawing
+    unsigned char state[128];
+    memset(state, 0, sizeof(state));
+    bool damaged = false;
+    for (int key = mamba_next_key_in_matrix(&check, 0); key > -1;
+            key = mamba_next_key_in_matrix(&check, key+1)) {
+        state[key] = key_state(keys, key);
+        if (state[key] == keys->drawn_state[key]) continue;
+        keys->drawn_state[key] = state[key];
+        if (keys->key_kind[key] == KEY_NONE) continue;
+        cairo_rectangle(w->crb, keys->key_x[key]-2, 0, keys->key_w[key]+4,
+                        key_height(keys->key_kind[key], height_t)+2);
+        damaged = true;
+    }
+    if (!damaged) {
+        // a expose from the server, the buffer could be stale
+        cairo_new_path(w->crb);
+        cairo_set_source_surface(w->crb, keys->cache, 0, 0);
+        cairo_paint(w->crb);
+        // draw all keys which aren't idle on top
+        for (int key = mamba_next_key_in_matrix(&busy, 0); key > -1;
+                key = mamba_next_key_in_matrix(&busy, key+1)) {
+            if (!state[key] || keys->key_kind[key] == KEY_NONE) continue;
+            cairo_rectangle(w->crb, keys->key_x[key]-2, 0, keys->key_w[key]+4,
+                            key_height(keys->key_kind[key], height_t)+2);
+            damaged = true;
+        }
+        if (!damaged) return;
+    }
+    cairo_save(w->crb);
+    cairo_clip(w->crb);
+    compose_keys(w, keys, state, width_t, height_t, true);
+    cairo_restore(w->crb);
 }
 
 static void check_double_key(Widget_t *p, MambaKeyboard *keys, XMotionEvent *xmotion, bool *catchit, int *i, int *set_key, int height) {
@@ -809,8 +797,8 @@ static void check_double_key(Widget_t *p, MambaKeyboard *keys, XMotionEvent *xmo
                 if (keys->active_key != keys->prelight_key) {
                     keys->send_key = keys->active_key;
                     if (keys->send_key>=0 && keys->send_key<128) {
-                        if (mamba_is_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key)) 
-                            mamba_set_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key,false);
+                        if (mamba_is_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key)) 
+                            mamba_set_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key,false);
                         keys->mk_send_note(p, &keys->send_key,false);
                     }
                     keys->active_key = keys->prelight_key;
@@ -845,6 +833,8 @@ static void keyboard_motion(void *w_, void* xmotion_, void* user_data) {
     if (attrs.map_state != IsViewable) return;
     int width = attrs.width;
     int height = attrs.height;
+    const int prelight_key = keys->prelight_key;
+    const int active_key = keys->active_key;
 
     bool catchit = false;
 
@@ -855,8 +845,8 @@ static void keyboard_motion(void *w_, void* xmotion_, void* user_data) {
         for(;i<width;i++) {
             if ((!is_key_in_edo_matrix(keys->edo_matrix,set_key+keys->octave))) {
                 if ((!is_key_in_edo_matrix(keys->edo_matrix,set_key+1+keys->octave)) ||
-                        (!mamba_is_key_in_matrix(keys->edo_matrix,set_key-1+keys->octave) &&
-                        !mamba_is_key_in_matrix(keys->edo_matrix,set_key+keys->octave))) {
+                        (!is_key_in_edo_matrix(keys->edo_matrix,set_key-1+keys->octave) &&
+                        !is_key_in_edo_matrix(keys->edo_matrix,set_key+keys->octave))) {
                     check_double_key(p, keys, xmotion, &catchit, &i, &set_key, height*0.59);
                 } else {
                     if(xmotion->x > i+keys->key_offset && xmotion->x < i+keys->key_size+keys->key_offset-3) {
@@ -865,8 +855,8 @@ static void keyboard_motion(void *w_, void* xmotion_, void* user_data) {
                             if (keys->active_key != keys->prelight_key) {
                                 keys->send_key = keys->active_key;
                                 if (keys->send_key>=0 && keys->send_key<128) {
-                                    if (mamba_is_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key)) 
-                                        mamba_set_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key,false);
+                                    if (mamba_is_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key)) 
+                                        mamba_set_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key,false);
                                     keys->mk_send_note(p, &keys->send_key,false);
                                 }
                                 keys->active_key = keys->prelight_key;
@@ -905,8 +895,8 @@ static void keyboard_motion(void *w_, void* xmotion_, void* user_data) {
                         if (keys->active_key != keys->prelight_key) {
                             keys->send_key = keys->active_key;
                             if (keys->send_key>=0 && keys->send_key<128) {
-                                if (mamba_is_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key)) 
-                                    mamba_set_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key,false);
+                                if (mamba_is_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key)) 
+                                    mamba_set_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key,false);
                                 keys->mk_send_note(p, &keys->send_key,false);
                             }
                             keys->active_key = keys->prelight_key;
@@ -934,6 +924,8 @@ static void keyboard_motion(void *w_, void* xmotion_, void* user_data) {
             k++;
         }
     }
+    if (keys->prelight_key != prelight_key || keys->active_key != active_key)
+        expose_widget(w);
 }
 
 static void get_outkey(MambaKeyboard *keys, KeySym sym, float *outkey) {
@@ -967,19 +959,19 @@ static void key_press(void *w_, void *key_, void *user_data) {
         KeySym sym = XLookupKeysym (key, 0);
         get_outkey(keys, sym, &outkey);
 
-        if ((int)outkey && !mamba_is_key_in_matrix(keys->key_matrix, (int)outkey+keys->octave)) {
-            mamba_set_key_in_matrix(keys->key_matrix,(int)outkey+keys->octave,true);
+        if ((int)outkey && !mamba_is_key_in_matrix(&keys->key_matrix, (int)outkey+keys->octave)) {
+            mamba_set_key_in_matrix(&keys->key_matrix,(int)outkey+keys->octave,true);
             keys->send_key = (int)outkey+keys->octave;
             if (keys->send_key>=0 && keys->send_key<128)
                 keys->mk_send_note(p, &keys->send_key,true);
-            //expose_widget(w);
+            expose_widget(w);
         } 
         if (sym == XK_space) {
-            mamba_clear_key_matrix(&keys->key_matrix[0]);
+            mamba_clear_key_matrix(&keys->key_matrix);
             int i = 0;
-            for (;i<16;i++) mamba_clear_key_matrix(&keys->in_key_matrix[i][0]);
+            for (;i<16;i++) mamba_clear_key_matrix(&keys->in_key_matrix[i]);
             keys->mk_send_all_sound_off(p, NULL);
-            //expose_widget(w);
+            expose_widget(w);
         }
     }
 }
@@ -994,12 +986,12 @@ static void key_release(void *w_, void *key_, void *user_data) {
     float outkey = 0.0;
     KeySym sym = XLookupKeysym (key, 0);
     get_outkey(keys, sym, &outkey);
-    if ((int)outkey && mamba_is_key_in_matrix(keys->key_matrix, (int)outkey+keys->octave)) {
-        mamba_set_key_in_matrix(keys->key_matrix,(int)outkey+keys->octave,false);
+    if ((int)outkey && mamba_is_key_in_matrix(&keys->key_matrix, (int)outkey+keys->octave)) {
+        mamba_set_key_in_matrix(&keys->key_matrix,(int)outkey+keys->octave,false);
         keys->send_key = (int)outkey+keys->octave;
         if (keys->send_key>=0 && keys->send_key<128)
             keys->mk_send_note(p,&keys->send_key,false);
-        //expose_widget(w);
+        expose_widget(w);
     }
 }
 
@@ -1009,7 +1001,7 @@ static void leave_keyboard(void *w_, void* user_data) {
     keys->prelight_key = -1;
     keys->active_key = -1;
     keys->in_motion = 0;
-    //expose_widget(w);
+    expose_widget(w);
 }
 
 static void button_pressed_keyboard(void *w_, void* button_, void* user_data) {
@@ -1024,17 +1016,18 @@ static void button_pressed_keyboard(void *w_, void* button_, void* user_data) {
             keys->last_active_key = keys->active_key;
             if (keys->send_key>=0 && keys->send_key<128)
                 keys->mk_send_note(p,&keys->send_key,true);
-            //expose_widget(w);
+            expose_widget(w);
         } else if (xbutton->button == Button3) {
             keys->send_key = keys->prelight_key;
             if (keys->send_key>=0 && keys->send_key<128) {
-                if (mamba_is_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key)) {
-                    mamba_set_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key,false);
+                if (mamba_is_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key)) {
+                    mamba_set_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key,false);
                     keys->mk_send_note(p,&keys->send_key,false);
                 } else {
-                    mamba_set_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key,true);
+                    mamba_set_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key,true);
                     keys->mk_send_note(p,&keys->send_key,true);
                 }
+                expose_widget(w);
             }
         }
     }
@@ -1050,11 +1043,11 @@ static void button_released_keyboard(void *w_, void* button_, void* user_data) {
             keys->send_key = keys->active_key;
             if (keys->send_key>=0 && keys->send_key<128) {
                 keys->mk_send_note(p,&keys->send_key,false);
-                if (mamba_is_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key)) 
-                    mamba_set_key_in_matrix(keys->in_key_matrix[keys->channel], keys->send_key,false);
+                if (mamba_is_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key)) 
+                    mamba_set_key_in_matrix(&keys->in_key_matrix[keys->channel], keys->send_key,false);
             }
             keys->active_key = -1;
-            //expose_widget(w);
+            expose_widget(w);
         }
     } else {
         if(xbutton->button == Button1) {
@@ -1070,23 +1063,25 @@ static void button_released_keyboard(void *w_, void* button_, void* user_data) {
 static void keyboard_mem_free(void *w_, void* user_data) {
     Widget_t *w = (Widget_t*)w_;
     MambaKeyboard *keys = (MambaKeyboard*)w->parent_struct;
+    free_key_cache(keys);
     free(keys);
 }
 
-bool mamba_need_redraw(MambaKeyboard *keys) {
-    bool have = false;
+// check if the input keys changed since the last call, shown
+// hold the matrix as seen on the last call.
+// Keyboard and pointer input expose the keyboard itself.
+bool mamba_need_redraw(MambaKeyboard *keys, MambaKeySet shown[16]) {
+    uint64_t changed = 0;
     int i = 0;
     for(;i<16;i++) {
-        if (mamba_have_key_in_matrix(keys->in_key_matrix[i])) {
-            have = true;
-            break;
+        int j = 0;
+        for(;j<2;j++) {
+            const uint64_t word = __atomic_load_n(&keys->in_key_matrix[i].word[j], __ATOMIC_ACQUIRE);
+            changed |= word ^ shown[i].word[j];
+            shown[i].word[j] = word;
         }
     }
-
-    return (keys->active_key > 0 ? 1 : 0) |
-    (keys->prelight_key  > 0 ? 1 : 0)  |
-    mamba_have_key_in_matrix(keys->key_matrix) |
-    have;
+    return changed != 0;
 }
 
 const char* dir_name(const char* path) {
@@ -1156,21 +1151,21 @@ void mamba_add_keyboard(Widget_t *wid, const char * label) {
     keys->key_offset = 15;
     keys->edo = 12;
     memset(keys->custom_keys, 0, 128*2*sizeof keys->custom_keys[0][0]);
+    memset(&keys->key_matrix, 0, sizeof(keys->key_matrix));
+    memset(keys->in_key_matrix, 0, sizeof(keys->in_key_matrix));
+    memset(&keys->in_key_union, 0, sizeof(keys->in_key_union));
+    memset(&keys->drawn_keys, 0, sizeof(keys->drawn_keys));
     int j = 0;
-    for(;j<4;j++) {
-        keys->key_matrix[j] = 0;
-    }
-    int i = 0;
-    for(;i<16;i++) {
-        j = 0;
-        for(;j<4;j++) {
-            keys->in_key_matrix[i][j] = 0;
-        }
-    }
-    j = 0;
     for(;j<8;j++) {
         keys->edo_matrix[j] = 0;
     }
+    memset(keys->key_kind, 0, sizeof(keys->key_kind));
+    memset(keys->drawn_state, 0, sizeof(keys->drawn_state));
+    memset(keys->drawn_layout, 0, sizeof(keys->drawn_layout));
+    memset(keys->sprite, 0, sizeof(keys->sprite));
+    keys->cache = NULL;
+    keys->black_pattern = NULL;
+    keys->shade_pattern = NULL;
     mamba_set_edo(keys, wid, 12);
     mamba_read_keymap(keys, label, keys->custom_keys);
 
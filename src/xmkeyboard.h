@@ -23,6 +23,8 @@
 #ifndef XMAMBA_KEYBOARD_H_
 #define XMAMBA_KEYBOARD_H_
 
+#include <stdint.h>
+
 #include "xwidgets.h"
 
 #ifdef __cplusplus
@@ -33,6 +35,13 @@ extern "C" {
 typedef void (*mambakeyfunc)(Widget_t *w, const int *key, const bool on_off);
 typedef void (*mambawheelfunc)(Widget_t *w, const int *value);
 
+// 128 keys as bitset, key n is bit (n & 63) of word[n >> 6].
+// Keys are set and cleared atomic, so the alsa and mapper threads
+// could write while the GUI thread is reading.
+typedef struct {
+    uint64_t word[2];
+} MambaKeySet;
+
 typedef struct {
 
     int channel;
@@ -59,10 +68,26 @@ typedef struct {
     int key_size;
     int key_offset;
     int edo;
-    unsigned long key_matrix[4];
-    unsigned long in_key_matrix[16][4];
+    MambaKeySet key_matrix;
+    MambaKeySet in_key_matrix[16];
+    // the keys held on any input channel, updated before drawing
+    MambaKeySet in_key_union;
     unsigned long edo_matrix[8];
     long custom_keys[128][2];
+    // key areas and states of the last drawing, to clip redraws
+    // to the keys which changed since
+    short key_x[128];
+    short key_w[128];
+    unsigned char key_kind[128];
+    unsigned char drawn_state[128];
+    MambaKeySet drawn_keys;
+    int drawn_layout[7];
+    // the idle keyboard and the keys per kind and state, rendered
+    // once per layout
+    cairo_surface_t *cache;
+    cairo_surface_t *sprite[3][19];
+    cairo_pattern_t *black_pattern;
+    cairo_pattern_t *shade_pattern;
 
     mambakeyfunc mk_send_note;
     mambawheelfunc mk_send_all_sound_off;
@@ -84,13 +109,18 @@ void mamba_custom_to_midi_key(long custom_keys[128], long inkey, float *midi_key
 
 void mamba_read_keymap(MambaKeyboard *keys, const char* keymapfile, long custom_keys[128][2]);
 
-void mamba_set_key_in_matrix(unsigned long *key_matrix, int key, bool set);
+void mamba_set_key_in_matrix(MambaKeySet *key_matrix, int key, bool set);
+
+bool mamba_is_key_in_matrix(const MambaKeySet *key_matrix, int key);
+
+bool mamba_have_key_in_matrix(const MambaKeySet *key_matrix);
 
-bool mamba_is_key_in_matrix(unsigned long *key_matrix, int key);
+void mamba_clear_key_matrix(MambaKeySet *key_matrix);
 
-bool mamba_have_key_in_matrix(unsigned long *key_matrix);
+int mamba_count_keys_in_matrix(const MambaKeySet *key_matrix);
 
-void mamba_clear_key_matrix(unsigned long *key_matrix);
+// the first key in the matrix from key on, or -1
+int mamba_next_key_in_matrix(const MambaKeySet *key_matrix, int key);
 
 void mamba_set_edo(MambaKeyboard *keys, Widget_t *w, int edo);
 
@@ -101,7 +131,7 @@ Widget_t *mamba_open_midi_keyboard(Widget_t *w, const char * label);
 void mamba_add_midi_keyboard(Widget_t *parent, const char * label,
                             int x, int y, int width, int height);
 
-bool mamba_need_redraw(MambaKeyboard *keys);
+bool mamba_need_redraw(MambaKeyboard *keys, MambaKeySet shown[16]);
 
 #ifdef __cplusplus
 }